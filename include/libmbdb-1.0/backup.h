@@ -20,6 +20,8 @@
 #ifndef BACKUP_H_
 #define BACKUP_H_
 
+#include <pthread.h>
+
 #include "backup_file.h"
 #include "mbdb.h"
 
@@ -27,6 +29,10 @@ typedef struct backup_t {
 	char* path;
 	//mbdx_t* mbdx;
 	mbdb_t* mbdb;
+	struct backup_batch_t* batch;	// see backup_begin()
+	pthread_rwlock_t lock;		// lookups share it, changes take it alone
+	pthread_mutex_t decode;		// records decoded on demand by lookups
+	unsigned int inode;		// last inode handed out, 0 until the first one
 	/*plist_t info;
 	plist_t status;
 	plist_t manifest;
@@ -37,15 +43,25 @@ typedef struct backup_t {
 } backup_t;
 
 backup_t* backup_open(const char* directory, const char* udid);
+backup_t* backup_open_ex(const char* directory, const char* udid, unsigned int flags);
 int backup_get_file_index(backup_t* backup, const char* domain, const char* path);
 char* backup_get_file_path(backup_t* backup, backup_file_t* bfile);
+int backup_get_file_path_into(backup_t* backup, backup_file_t* bfile, char* path, size_t size);
+int backup_get_file_view_path_into(backup_t* backup, const backup_file_view_t* view, char* path, size_t size);
 backup_file_t* backup_get_file(backup_t* backup, const char* domain, const char* path);
+int backup_get_file_view(backup_t* backup, const char* domain, const char* path, backup_file_view_t* view);
 int backup_update_file(backup_t* backup, backup_file_t* bfile);
 int backup_remove_file(backup_t* backup, backup_file_t* bfile);
+int backup_write_mbdb(backup_t* backup);
+int backup_checkpoint(backup_t* backup);
+int backup_begin(backup_t* backup);
+int backup_commit(backup_t* backup);
+int backup_rollback(backup_t* backup);
 void backup_free(backup_t* backup);
 
 int backup_get_num_files(backup_t* backup);
 backup_file_t* backup_get_file_by_index(backup_t* backup, int index);
+int backup_get_file_view_by_index(backup_t* backup, int index, backup_file_view_t* view);
 int backup_mkdir(backup_t * backup, char *domain, char *path, int mode, int uid, int gid, int flag);
 int backup_symlink(backup_t * backup, char *domain, char *path, char *to, int uid, int gid, int flag);
 int backup_add_file_from_path(backup_t * backup, char *domain, char *localpath, char *path, int mode, int uid, int gid, int flag);
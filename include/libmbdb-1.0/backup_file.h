@@ -32,9 +32,23 @@ typedef struct backup_file_t {
 	int free_data;
 } backup_file_t;
 
+/* Read-only view of a record of a backup, borrowed and not copied.
+   It stays valid until the backup is changed or freed, nothing pins
+   it against another thread changing the backup. Only use views while
+   no other thread writes to it, backup_get_file() copies otherwise.
+   The record is the live one: opened with MBDB_OPEN_MAPPED its path,
+   target and property strings point into the manifest and are not
+   NUL terminated. Read them with their *_size fields (0 or 0xFFFF is
+   empty), or take a terminated copy with backup_file_create_from_view(). */
+typedef struct backup_file_view_t {
+	const mbdb_record_t* mbdb_record;
+	int index;
+} backup_file_view_t;
+
 backup_file_t* backup_file_create(const char *filepath);
 backup_file_t* backup_file_create_with_data(unsigned char* data, unsigned int size, int copy);
 backup_file_t* backup_file_create_from_record(mbdb_record_t* record);
+backup_file_t* backup_file_create_from_view(const backup_file_view_t* view);
 
 void backup_file_assign_file_data(backup_file_t* bfile, unsigned char* data, unsigned int size, int copy);
 void backup_file_assign_file_path(backup_file_t* bfile, unsigned char* path);
@@ -11,6 +11,19 @@
 #include <libmbdb-1.0/mbdb.h>
 #include <libmbdb-1.0/backup.h>
 #include <libmbdb-1.0/mbdb_record.h>
+#include <libmbdb-1.0/mbdb_arena.h>
+#include <libmbdb-1.0/mbdb_intern.h>
+#include <libmbdb-1.0/mbdb_columns.h>
+#include <libmbdb-1.0/mbdb_cursor.h>
+#include <libmbdb-1.0/mbdb_index.h>
+#include <libmbdb-1.0/mbdb_tree.h>
+#include <libmbdb-1.0/mbdb_names.h>
+#include <libmbdb-1.0/mbdb_content.h>
+#include <libmbdb-1.0/mbdb_reader.h>
+#include <libmbdb-1.0/mbdb_sidecar.h>
+#include <libmbdb-1.0/mbdb_journal.h>
+#include <libmbdb-1.0/mbdb_snapshot.h>
+#include <libmbdb-1.0/mbdb_copy.h>
 #include <libmbdb-1.0/backup_file.h>
 
 
@@ -21,9 +21,35 @@
 #define MBDB_H
 
 #include "mbdb_record.h"
+#include "mbdb_arena.h"
+#include "mbdb_intern.h"
+#include "mbdb_columns.h"
+#include "mbdb_cursor.h"
+#include "mbdb_index.h"
+#include "mbdb_tree.h"
+#include "mbdb_names.h"
+#include "mbdb_content.h"
+#include "mbdb_sidecar.h"
+#include "mbdb_journal.h"
+#include "mbdb_snapshot.h"
 
 #define MBDB_MAGIC "\x6d\x62\x64\x62\x05\x00"
 
+/* mbdb->flags, also accepted by mbdb_open_ex() and mbdb_parse_ex() */
+#define MBDB_OPEN_MAPPED 0x01 // data is a read-only mapping of the file, records are views into it
+#define MBDB_OPEN_LAZY   0x02 // records are decoded on first mbdb_get_record()
+#define MBDB_OPEN_COLUMNS 0x04 // build the columnar view while parsing
+#define MBDB_OPEN_INDEX  0x08 // build the (domain, path) index while parsing
+#define MBDB_OPEN_SIDECAR 0x10 // take offsets and indexes from the sidecar of the file, regenerate it when stale
+#define MBDB_OPEN_JOURNAL 0x20 // replay the journal of the file and log every change to it
+#define MBDB_OPEN_THREADS(n) ((((unsigned int)(n)) & 0xFF) << 24) // decode with n threads
+#define MBDB_OPEN_THREADS_AUTO MBDB_OPEN_THREADS(0xFF) // one thread per online CPU
+#define MBDB_OPEN_THREADS_MASK 0xFF000000
+
+#define MBDB_PARSE_CHUNK 0x1000 // minimum number of records per parser thread
+
+#define MBDB_OFFSET_NONE 0xFFFFFFFF // mbdb->offsets of records that are not in data (changed, added or removed)
+
 
 typedef struct mbdb_header {
     unsigned char magic[6];		       // 'mbdb\5\0'
@@ -33,16 +59,59 @@ typedef struct mbdb_t {
     unsigned int size;
     unsigned char* data;
     mbdb_header_t* header;
-    int num_records;
-    mbdb_record_t** records;
+    int num_records;                 // removed records included, until mbdb_compact()
+    mbdb_record_t** records;         // NULL until decoded with MBDB_OPEN_LAZY, or when removed
+    unsigned int* offsets;           // offset of each record in data, or MBDB_OFFSET_NONE
+    unsigned int capacity;           // room in records and offsets
+    unsigned int num_deleted;        // removed records still holding their index
+    unsigned int edits;              // changes to the records since data was read
+    int dirty;                       // changes not written out yet
+    struct mbdb_batch_t* batch;      // see mbdb_begin()
+    unsigned int flags;
+    mbdb_arena_t* arena;             // parsed records, their strings and properties
+    mbdb_columns_t* columns;         // see mbdb_get_columns()
+    mbdb_intern_t* domains;          // one shared string per distinct domain of the decoded records
+    mbdb_index_t* index;             // see mbdb_find_record()
+    mbdb_tree_t* tree;               // see mbdb_get_tree()
+    mbdb_names_t* names;             // see mbdb_find_record_by_name()
+    mbdb_content_t* content;         // see mbdb_get_content()
+    void* sidecar;                   // mapping of the sidecar index, see mbdb_sidecar.h
+    size_t sidecar_size;
+    struct mbdb_sidecar_job_t* sidecar_job; // sidecar being regenerated in the background
+    struct mbdb_journal_t* journal;  // changes since the manifest was written, see mbdb_journal.h
+    struct mbdb_snapshots_t* snapshots; // published versions, see mbdb_snapshot.h
 } mbdb_t;
 
-extern mbdb_t* apparition_mbdb;
-
 mbdb_t* mbdb_create();
 mbdb_t* mbdb_open(unsigned char* file);
+mbdb_t* mbdb_open_mapped(const char* file);
+mbdb_t* mbdb_open_ex(const char* file, unsigned int flags);
 mbdb_t* mbdb_parse(unsigned char* data, unsigned int size);
+mbdb_t* mbdb_parse_ex(unsigned char* data, unsigned int size, unsigned int flags);
 mbdb_record_t* mbdb_get_record(mbdb_t* mbdb, unsigned int offset);
+void mbdb_get_record_key(mbdb_t* mbdb, unsigned int index, const char** domain, unsigned short* domain_size, const char** path, unsigned short* path_size);
+unsigned int mbdb_get_record_inode(mbdb_t* mbdb, unsigned int index);
+mbdb_columns_t* mbdb_get_columns(mbdb_t* mbdb);
+mbdb_index_t* mbdb_get_index(mbdb_t* mbdb);
+int mbdb_find_record(mbdb_t* mbdb, const char* domain, const char* path);
+mbdb_tree_t* mbdb_get_tree(mbdb_t* mbdb);
+mbdb_names_t* mbdb_get_names(mbdb_t* mbdb);
+int mbdb_find_record_by_name(mbdb_t* mbdb, const char* name);
+mbdb_content_t* mbdb_get_content(mbdb_t* mbdb);
+int mbdb_replace_record(mbdb_t* mbdb, unsigned int index, mbdb_record_t* record);
+int mbdb_insert_record(mbdb_t* mbdb, mbdb_record_t* record);
+int mbdb_remove_record(mbdb_t* mbdb, unsigned int index);
+int mbdb_compact(mbdb_t* mbdb);
+int mbdb_build(mbdb_t* mbdb, unsigned char** data, unsigned int* size);
+int mbdb_serialize(mbdb_t* mbdb, unsigned char** data, unsigned int* size, int threads);
+int mbdb_write(mbdb_t* mbdb, const char* file);
+int mbdb_begin(mbdb_t* mbdb);
+int mbdb_commit(mbdb_t* mbdb);
+int mbdb_rollback(mbdb_t* mbdb);
+void mbdb_get_arena_stats(mbdb_t* mbdb, mbdb_arena_stats_t* stats);
+const char* mbdb_find_domain(mbdb_t* mbdb, const char* domain);
+unsigned int mbdb_get_num_domains(mbdb_t* mbdb);
+const char* mbdb_get_domain(mbdb_t* mbdb, unsigned int index);
 void mbdb_free(mbdb_t* mbdb);
 
 #endif
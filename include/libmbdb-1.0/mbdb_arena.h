@@ -0,0 +1,54 @@
+/**
+  * libmbdb-1.0 - mbdb_arena.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_ARENA_H_
+#define MBDB_ARENA_H_
+
+#include <stddef.h>
+
+#define MBDB_ARENA_MIN_CHUNK 0x10000
+
+typedef struct mbdb_arena_chunk_t {
+	struct mbdb_arena_chunk_t* next;
+	size_t size;
+	size_t used;
+} mbdb_arena_chunk_t;
+
+typedef struct mbdb_arena_stats_t {
+	unsigned long long reserved;    // bytes malloc'd for chunks
+	unsigned long long used;        // bytes handed out, including padding
+	unsigned int chunks;
+	unsigned int allocations;
+} mbdb_arena_stats_t;
+
+typedef struct mbdb_arena_t {
+	mbdb_arena_chunk_t* chunk;      // current chunk, older ones chained on next
+	size_t next_size;
+	mbdb_arena_stats_t stats;
+} mbdb_arena_t;
+
+mbdb_arena_t* mbdb_arena_create(size_t size_hint);
+void* mbdb_arena_alloc(mbdb_arena_t* arena, size_t size);
+char* mbdb_arena_memdup(mbdb_arena_t* arena, const void* data, size_t size, int terminate);
+void mbdb_arena_adopt(mbdb_arena_t* arena, mbdb_arena_t* other);
+void mbdb_arena_reset(mbdb_arena_t* arena);
+void mbdb_arena_get_stats(mbdb_arena_t* arena, mbdb_arena_stats_t* stats);
+void mbdb_arena_free(mbdb_arena_t* arena);
+
+#endif /* MBDB_ARENA_H_ */
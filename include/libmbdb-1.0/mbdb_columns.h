@@ -0,0 +1,64 @@
+/**
+  * libmbdb-1.0 - mbdb_columns.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_COLUMNS_H_
+#define MBDB_COLUMNS_H_
+
+#define MBDB_COLUMNS_HASH_SIZE 20
+
+/* One dense array per record field, indexed like mbdb->records.
+   Strings are (pointer, size) pairs and are not NUL terminated,
+   sizes of 0 or 0xFFFF mean the field is empty. Records without a
+   20 byte datahash get an all zero entry in the datahash column.
+   The distinct domains are kept sorted by their bytes, so the domains
+   starting with any prefix have consecutive ids. */
+typedef struct mbdb_columns_t {
+	unsigned int count;
+	unsigned short* mode;
+	unsigned int* inode;
+	unsigned int* uid;
+	unsigned int* gid;
+	unsigned int* time1;
+	unsigned int* time2;
+	unsigned int* time3;
+	unsigned long long* length;
+	unsigned char* flag;
+	unsigned char* datahash;          // count * MBDB_COLUMNS_HASH_SIZE bytes
+	const char** domain;
+	unsigned short* domain_size;
+	const char** path;
+	unsigned short* path_size;
+	const char** target;
+	unsigned short* target_size;
+	unsigned int* domain_id;          // into unique_domain
+	unsigned int num_domains;
+	const char** unique_domain;
+	unsigned short* unique_domain_size; // 0 for the empty domain
+} mbdb_columns_t;
+
+struct mbdb_t;
+
+mbdb_columns_t* mbdb_columns_build(struct mbdb_t* mbdb);
+unsigned int mbdb_columns_count_type(const mbdb_columns_t* columns, unsigned short type);
+unsigned long long mbdb_columns_total_length(const mbdb_columns_t* columns, unsigned short type);
+unsigned int mbdb_columns_select_type(const mbdb_columns_t* columns, unsigned short type, unsigned int* indices);
+unsigned int mbdb_columns_find_domains(const mbdb_columns_t* columns, const char* domain, unsigned short size, int prefix, unsigned int* first);
+void mbdb_columns_free(mbdb_columns_t* columns);
+
+#endif /* MBDB_COLUMNS_H_ */
@@ -0,0 +1,51 @@
+/**
+  * libmbdb-1.0 - mbdb_content.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_CONTENT_H_
+#define MBDB_CONTENT_H_
+
+#include "mbdb_columns.h"
+
+typedef struct mbdb_content_entry_t {
+	unsigned char hash[MBDB_COLUMNS_HASH_SIZE];
+	unsigned int record;
+} mbdb_content_entry_t;
+
+/* records sharing one datahash, entries[first .. first + count) */
+typedef struct mbdb_content_group_t {
+	unsigned int first;
+	unsigned int count;
+} mbdb_content_group_t;
+
+/* Index of file records by content hash. Entries are sorted by hash,
+   then record, so records with identical contents are adjacent. */
+typedef struct mbdb_content_t {
+	mbdb_content_entry_t* entries;
+	unsigned int count;
+	mbdb_content_group_t* groups;
+	unsigned int num_groups;
+} mbdb_content_t;
+
+struct mbdb_t;
+
+mbdb_content_t* mbdb_content_build(struct mbdb_t* mbdb);
+const mbdb_content_group_t* mbdb_content_find(const mbdb_content_t* content, const unsigned char* hash);
+void mbdb_content_free(mbdb_content_t* content);
+
+#endif /* MBDB_CONTENT_H_ */
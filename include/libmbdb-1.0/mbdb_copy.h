@@ -0,0 +1,36 @@
+/**
+  * libmbdb-1.0 - mbdb_copy.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_COPY_H_
+#define MBDB_COPY_H_
+
+/* ways mbdb_copy_file() can move the data, tried in this order */
+#define MBDB_COPY_RANGE    0x01 // copy_file_range(), the kernel copies or shares the extents
+#define MBDB_COPY_CLONE    0x02 // FICLONE, the copy shares all extents with the source
+#define MBDB_COPY_SENDFILE 0x04 // sendfile(), copied in the page cache
+#define MBDB_COPY_BUFFER   0x08 // read() and write() through one large buffer, works everywhere
+#define MBDB_COPY_ANY      0x0F
+
+#define MBDB_COPY_BUFFER_SIZE (1 << 20)
+
+int mbdb_copy_fd(int in, int out, unsigned long long length, unsigned int methods, unsigned int* used);
+int mbdb_copy_file(const char* from, const char* to, unsigned int methods, unsigned int* used);
+const char* mbdb_copy_method_name(unsigned int method);
+
+#endif /* MBDB_COPY_H_ */
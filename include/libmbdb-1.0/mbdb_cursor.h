@@ -0,0 +1,106 @@
+/**
+  * libmbdb-1.0 - mbdb_cursor.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_CURSOR_H_
+#define MBDB_CURSOR_H_
+
+#include "mbdb_record.h"
+#include "mbdb_columns.h"
+
+struct mbdb_t;
+
+/* filter->match, the tests a record has to pass */
+#define MBDB_FILTER_DOMAIN        0x01 // domain is filter->domain
+#define MBDB_FILTER_DOMAIN_PREFIX 0x02 // domain starts with filter->domain
+#define MBDB_FILTER_PATH_PREFIX   0x04 // path starts with filter->path
+#define MBDB_FILTER_TYPE          0x08 // mode type is filter->type, one of MBDB_MODE_*
+#define MBDB_FILTER_LENGTH        0x10 // min_length <= length <= max_length
+#define MBDB_FILTER_TIME          0x20 // min_time <= time <= max_time, on time_field
+
+/* entry->flags */
+#define MBDB_ENTRY_FILE        0x01
+#define MBDB_ENTRY_DIRECTORY   0x02
+#define MBDB_ENTRY_SYMLINK     0x04
+#define MBDB_ENTRY_DOMAIN_ROOT 0x08 // no path, the record of the domain itself
+
+#define MBDB_CURSOR_BATCH 64 // records that passed the fixed size tests, paths fetched together
+
+/* Filled in by the caller, then compiled once with mbdb_filter_compile()
+   and used by any number of scans. Compiling opens up the ranges that
+   are not tested, so every record passes them. Strings are not copied. */
+typedef struct mbdb_filter_t {
+	unsigned int match;             // MBDB_FILTER_*
+	const char* domain;
+	const char* path;
+	unsigned short type;
+	unsigned char time_field;       // 1 to 3 for time1 to time3, 0 is time3
+	unsigned long long min_length;
+	unsigned long long max_length;
+	unsigned int min_time;
+	unsigned int max_time;
+	unsigned short domain_size;     // set by mbdb_filter_compile()
+	unsigned short path_size;
+	unsigned short type_mask;
+	unsigned short type_value;
+	unsigned short min_path_size;
+} mbdb_filter_t;
+
+/* The record a cursor stands on, read from the columnar view without
+   decoding it. Strings are not NUL terminated, empty ones have size 0. */
+typedef struct mbdb_entry_t {
+	unsigned int index;             // in mbdb->records
+	unsigned int flags;             // MBDB_ENTRY_*
+	const char* domain;
+	unsigned short domain_size;
+	const char* path;
+	unsigned short path_size;
+	const char* target;
+	unsigned short target_size;
+	unsigned short mode;
+	unsigned long long length;
+	unsigned int time1;
+	unsigned int time2;
+	unsigned int time3;
+} mbdb_entry_t;
+
+/* Lives on the caller's stack, nothing is allocated for a scan.
+   The mbdb must not be changed while a cursor is in use. */
+typedef struct mbdb_cursor_t {
+	struct mbdb_t* mbdb;
+	const mbdb_columns_t* columns;
+	const mbdb_filter_t* filter;
+	const unsigned int* time;       // the column the time range is on
+	unsigned int first_domain;      // domain ids that pass, see mbdb_columns_find_domains()
+	unsigned int domain_span;       // last one - first one
+	unsigned int next;              // first record not looked at yet
+	unsigned int batch[MBDB_CURSOR_BATCH];
+	unsigned int batch_count;
+	unsigned int batch_next;
+	mbdb_entry_t entry;
+} mbdb_cursor_t;
+
+typedef int (*mbdb_foreach_callback_t)(const mbdb_entry_t* entry, void* ctx);
+
+void mbdb_filter_compile(mbdb_filter_t* filter);
+int mbdb_cursor_init(mbdb_cursor_t* cursor, struct mbdb_t* mbdb, const mbdb_filter_t* filter);
+int mbdb_cursor_next(mbdb_cursor_t* cursor);
+const mbdb_record_t* mbdb_cursor_record(mbdb_cursor_t* cursor);
+int mbdb_foreach(struct mbdb_t* mbdb, const mbdb_filter_t* filter, mbdb_foreach_callback_t callback, void* ctx);
+
+#endif /* MBDB_CURSOR_H_ */
@@ -0,0 +1,51 @@
+/**
+  * libmbdb-1.0 - mbdb_index.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_INDEX_H_
+#define MBDB_INDEX_H_
+
+#define MBDB_INDEX_EMPTY   0
+#define MBDB_INDEX_DELETED 0xFFFFFFFF
+
+typedef struct mbdb_index_slot_t {
+	unsigned int hash;
+	unsigned int record;            // record index + 1, or MBDB_INDEX_EMPTY / MBDB_INDEX_DELETED
+} mbdb_index_slot_t;
+
+/* Open addressing hash of (domain, path) to record index. Keys are not
+   stored, they are read back from the record or the raw manifest data. */
+typedef struct mbdb_index_t {
+	mbdb_index_slot_t* slots;
+	unsigned int mask;
+	unsigned int count;             // live entries
+	unsigned int used;              // live and deleted entries
+	int borrowed;                   // slots live in a mapping (see mbdb_sidecar.h), not owned
+} mbdb_index_t;
+
+struct mbdb_t;
+
+unsigned int mbdb_index_hash(const char* domain, unsigned short domain_size, const char* path, unsigned short path_size);
+mbdb_index_t* mbdb_index_build(struct mbdb_t* mbdb);
+int mbdb_index_find(mbdb_index_t* index, struct mbdb_t* mbdb, const char* domain, unsigned short domain_size, const char* path, unsigned short path_size);
+int mbdb_index_insert(mbdb_index_t* index, struct mbdb_t* mbdb, unsigned int record);
+int mbdb_index_remove(mbdb_index_t* index, struct mbdb_t* mbdb, unsigned int record);
+void mbdb_index_remap(mbdb_index_t* index, const unsigned int* remap);
+void mbdb_index_free(mbdb_index_t* index);
+
+#endif /* MBDB_INDEX_H_ */
@@ -0,0 +1,56 @@
+/**
+  * libmbdb-1.0 - mbdb_intern.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_INTERN_H_
+#define MBDB_INTERN_H_
+
+#include <pthread.h>
+
+#include "mbdb_arena.h"
+
+#define MBDB_INTERN_MIN_SLOTS 64
+
+typedef struct mbdb_intern_entry_t {
+	const char* str;                // NUL terminated, lives in the table's arena
+	unsigned short size;
+	unsigned int hash;
+} mbdb_intern_entry_t;
+
+/* Set of immutable strings, equal strings share one pointer.
+   Entries keep their insertion order, slots index them by hash. */
+typedef struct mbdb_intern_t {
+	mbdb_arena_t* arena;
+	mbdb_intern_entry_t* entries;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int* slots;            // entry index + 1, 0 if empty
+	unsigned int mask;
+	int frozen;                     // no inserts, lookups skip the lock
+	pthread_mutex_t lock;
+} mbdb_intern_t;
+
+mbdb_intern_t* mbdb_intern_create();
+const char* mbdb_intern_string(mbdb_intern_t* intern, const char* str, unsigned short size);
+const char* mbdb_intern_find(mbdb_intern_t* intern, const char* str, unsigned short size);
+unsigned int mbdb_intern_count(mbdb_intern_t* intern);
+const char* mbdb_intern_get(mbdb_intern_t* intern, unsigned int index, unsigned short* size);
+void mbdb_intern_freeze(mbdb_intern_t* intern, int frozen);
+void mbdb_intern_free(mbdb_intern_t* intern);
+
+#endif /* MBDB_INTERN_H_ */
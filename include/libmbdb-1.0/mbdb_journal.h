@@ -0,0 +1,73 @@
+/**
+  * libmbdb-1.0 - mbdb_journal.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_JOURNAL_H_
+#define MBDB_JOURNAL_H_
+
+#include <stddef.h>
+
+#define MBDB_JOURNAL_MAGIC      "mbdbjnl"
+#define MBDB_JOURNAL_VERSION    2
+#define MBDB_JOURNAL_SUFFIX     ".journal" // next to the manifest, Manifest.mbdb.journal
+#define MBDB_JOURNAL_SAMPLE     0x10000 // bytes from each end of the manifest that go into its checksum
+#define MBDB_JOURNAL_CHECKPOINT 0x400000 // journal size at which backup_write_mbdb() writes the manifest again
+
+/* journal entries */
+#define MBDB_JOURNAL_INSERT 1 // record
+#define MBDB_JOURNAL_UPDATE 2 // domain and path of the record replaced, record
+#define MBDB_JOURNAL_REMOVE 3 // domain and path
+
+/* Journal of the changes made to the records since the manifest was
+   last written. Numbers are big endian like in the manifest, strings
+   are length prefixed the same way. Each entry is
+     op, 3 zero bytes, payload size, FNV-1a of op and payload, payload
+   and a torn entry at the end is dropped on replay. The journal
+   belongs to the manifest of the same inode, mtime, size and checksum. */
+typedef struct mbdb_journal_header_t {
+	char magic[8];
+	unsigned int version;
+	unsigned int header_size;
+	unsigned long long manifest_size;
+	unsigned char manifest_checksum[20]; // SHA1 of the first and last MBDB_JOURNAL_SAMPLE bytes
+	unsigned long long manifest_inode;
+	long long manifest_mtime;
+	long long manifest_mtime_nsec; // writes in place within the second
+	unsigned int reserved;
+} __attribute__((__packed__)) mbdb_journal_header_t;
+
+typedef struct mbdb_journal_entry_t {
+	unsigned char op;
+	unsigned char zero[3];
+	unsigned int size;
+	unsigned int check;
+} __attribute__((__packed__)) mbdb_journal_entry_t;
+
+struct mbdb_t;
+struct mbdb_record_t;
+
+int mbdb_journal_open(struct mbdb_t* mbdb, const char* file);
+int mbdb_journal_log(struct mbdb_t* mbdb, unsigned char op, unsigned int index, struct mbdb_record_t* record);
+size_t mbdb_journal_mark(struct mbdb_t* mbdb);
+void mbdb_journal_discard(struct mbdb_t* mbdb, size_t mark);
+int mbdb_journal_sync(struct mbdb_t* mbdb);
+unsigned long long mbdb_journal_size(struct mbdb_t* mbdb);
+int mbdb_journal_reset(struct mbdb_t* mbdb, const char* file);
+void mbdb_journal_close(struct mbdb_t* mbdb);
+
+#endif /* MBDB_JOURNAL_H_ */
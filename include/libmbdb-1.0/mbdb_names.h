@@ -0,0 +1,70 @@
+/**
+  * libmbdb-1.0 - mbdb_names.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_NAMES_H_
+#define MBDB_NAMES_H_
+
+#define MBDB_NAME_HASH_SIZE 20 // SHA1 of "domain-path", the file name inside the backup directory
+#define MBDB_NAME_SIZE      40 // the hash in hex, without the NUL
+#define MBDB_NAME_SHARED_BLOCKS 4 // leading SHA1 blocks a name can take over from the name before
+
+/* a record key with its MBDB sizes, 0xFFFF for a missing string */
+typedef struct mbdb_name_key_t {
+	const char* domain;
+	unsigned short domain_size;
+	const char* path;
+	unsigned short path_size;
+} mbdb_name_key_t;
+
+/* Carries SHA1 midstates from one name to the next. A name that starts
+   like the last one hashed, the same "domain-" and often the same
+   directory, skips the 64 byte blocks they have in common. Lives on the
+   caller's stack, one per thread. */
+typedef struct mbdb_name_hasher_t {
+	unsigned int blocks;            // of the last name, kept below
+	unsigned int state[MBDB_NAME_SHARED_BLOCKS][5];
+	unsigned char data[MBDB_NAME_SHARED_BLOCKS][64];
+} mbdb_name_hasher_t;
+
+typedef struct mbdb_names_entry_t {
+	unsigned char hash[MBDB_NAME_HASH_SIZE];
+	unsigned int record;
+} mbdb_names_entry_t;
+
+/* Reverse index of backup file names, sorted by hash */
+typedef struct mbdb_names_t {
+	mbdb_names_entry_t* entries;
+	unsigned int count;
+	int borrowed;                   // entries live in a mapping (see mbdb_sidecar.h), not owned
+} mbdb_names_t;
+
+struct mbdb_t;
+
+void mbdb_name_hasher_init(mbdb_name_hasher_t* hasher);
+void mbdb_name_hash_batch(mbdb_name_hasher_t* hasher, const mbdb_name_key_t* keys, unsigned int count, unsigned char* hashes);
+void mbdb_name_hash(const char* domain, unsigned short domain_size, const char* path, unsigned short path_size, unsigned char* hash);
+void mbdb_name_format(const unsigned char* hash, char* name);
+const char* mbdb_name_hash_impl();
+int mbdb_name_hash_use(const char* impl);
+int mbdb_name_parse(const char* name, unsigned char* hash);
+mbdb_names_t* mbdb_names_build(struct mbdb_t* mbdb);
+int mbdb_names_find(const mbdb_names_t* names, const unsigned char* hash);
+void mbdb_names_free(mbdb_names_t* names);
+
+#endif /* MBDB_NAMES_H_ */
@@ -0,0 +1,53 @@
+/**
+  * libmbdb-1.0 - mbdb_reader.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_READER_H_
+#define MBDB_READER_H_
+
+#include <stdio.h>
+
+#include "mbdb_record.h"
+#include "mbdb_arena.h"
+
+#define MBDB_READER_BUFFER_SIZE 0x10000
+
+/* Pull parser reading one record at a time from a file descriptor or FILE*.
+   The record returned by mbdb_reader_next() is a view into the reader's
+   buffer and stays valid until the next call. */
+typedef struct mbdb_reader_t {
+	int fd;
+	FILE* file;
+	int close_fd;
+	int eof;
+	unsigned char* buffer;
+	unsigned int capacity;
+	unsigned int start;               // first unconsumed byte in buffer
+	unsigned int end;                 // end of valid data in buffer
+	unsigned long long offset;        // file offset of buffer[start]
+	unsigned int index;               // number of records returned so far
+	mbdb_arena_t* arena;              // current record and its properties
+} mbdb_reader_t;
+
+mbdb_reader_t* mbdb_reader_open(const char* file);
+mbdb_reader_t* mbdb_reader_open_fd(int fd);
+mbdb_reader_t* mbdb_reader_open_file(FILE* file);
+int mbdb_reader_next(mbdb_reader_t* reader, const mbdb_record_t** record);
+void mbdb_reader_close(mbdb_reader_t* reader);
+
+#endif /* MBDB_READER_H_ */
@@ -20,8 +20,29 @@
 #ifndef MBDB_RECORD_H_
 #define MBDB_RECORD_H_
 
+#include "mbdb_arena.h"
+#include "mbdb_intern.h"
+#include "mbdb_names.h"
+
 struct mbdb_t;
 
+#define MBDB_RECORD_TAIL_SIZE 40 // mode through property_count, fixed size
+
+#define MBDB_MODE_TYPE_MASK 0xF000
+#define MBDB_MODE_SYMLINK   0xA000
+#define MBDB_MODE_FILE      0x8000
+#define MBDB_MODE_DIRECTORY 0x4000
+
+/* record->flags */
+#define MBDB_RECORD_BORROWED 0x01 // strings point into the mbdb data or arena, not owned by the record
+#define MBDB_RECORD_ARENA    0x02 // record and property table live in the mbdb arena
+#define MBDB_RECORD_INTERNED 0x04 // domain is shared through the mbdb domain table, compare it by pointer
+
+/* record->name_state */
+#define MBDB_RECORD_NAME_NONE    0
+#define MBDB_RECORD_NAME_WRITING 1 // one thread is storing name_hash, the others hash for themselves
+#define MBDB_RECORD_NAME_VALID   2
+
 struct mbdb_record_property_t {
 	unsigned short name_size;
 	char* name;
@@ -55,12 +76,24 @@ struct mbdb_record_t {
     unsigned char property_count;     // number of properties
     mbdb_record_property_t** properties; // properties
     unsigned int this_size; // size of this record in bytes
+    unsigned char flags;              // MBDB_RECORD_* storage flags
+    unsigned char name_state;         // MBDB_RECORD_NAME_*, the cache below
+    unsigned char name_hash[MBDB_NAME_HASH_SIZE]; // of "domain-path", see mbdb_record_get_name_hash()
 } __attribute__((__packed__));
 
 typedef struct mbdb_record_t mbdb_record_t;
 
 mbdb_record_t* mbdb_record_create();
 mbdb_record_t* mbdb_record_parse(unsigned char* data);
+int mbdb_record_scan(const unsigned char* data, unsigned int size);
+void mbdb_record_decode_tail(mbdb_record_t* record, const unsigned char* data);
+mbdb_record_t* mbdb_record_parse_view(const unsigned char* data, unsigned int size);
+mbdb_record_t* mbdb_record_parse_arena(mbdb_arena_t* arena, const unsigned char* data, unsigned int size, int borrow);
+mbdb_record_t* mbdb_record_parse_interned(mbdb_arena_t* arena, mbdb_intern_t* domains, const unsigned char* data, unsigned int size, int borrow);
+mbdb_record_t* mbdb_record_copy(const mbdb_record_t* record);
+int mbdb_record_own(mbdb_record_t* record);
+int mbdb_record_matches(const mbdb_record_t* record, const char* domain, const char* path);
+void mbdb_record_get_name_hash(const mbdb_record_t* record, unsigned char* hash);
 void mbdb_record_debug(mbdb_record_t* record);
 void mbdb_record_free(mbdb_record_t* record);
 
@@ -83,6 +116,7 @@ void mbdb_record_set_flag(mbdb_record_t* record, unsigned char flag);
 // TODO sth like mbdb_record_add_property()
 
 int mbdb_record_build(mbdb_record_t* record, unsigned char** data, unsigned int* size);
+int mbdb_record_serialize_into(const mbdb_record_t* record, unsigned char* cursor, unsigned int size);
 
 
 #endif /* MBDB_RECORD_H_ */
@@ -0,0 +1,67 @@
+/**
+  * libmbdb-1.0 - mbdb_sidecar.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_SIDECAR_H_
+#define MBDB_SIDECAR_H_
+
+#include <stddef.h>
+
+#define MBDB_SIDECAR_MAGIC      "mbdbidx"
+#define MBDB_SIDECAR_VERSION    2
+#define MBDB_SIDECAR_BYTE_ORDER 0x01020304
+#define MBDB_SIDECAR_SUFFIX     ".idx" // next to the manifest, Manifest.mbdb.idx
+#define MBDB_SIDECAR_SAMPLE     0x10000 // bytes from each end of the manifest that go into its checksum
+
+/* Sidecar index file, written in host byte order so it can be mapped
+   as is. The sections follow the header, each 8 byte aligned:
+     offsets  num_records * unsigned int
+     index    index_slots * mbdb_index_slot_t
+     names    num_records * mbdb_names_entry_t
+   It belongs to the manifest of the same inode, size, mtime and checksum. */
+typedef struct mbdb_sidecar_header_t {
+	char magic[8];
+	unsigned int version;
+	unsigned int byte_order;
+	unsigned int header_size;
+	unsigned int num_records;
+	unsigned long long manifest_size;
+	long long manifest_mtime;
+	long long manifest_mtime_nsec;
+	unsigned long long manifest_inode; // mbdb_write() always makes a new one
+	unsigned char manifest_checksum[20]; // SHA1 of the first and last MBDB_SIDECAR_SAMPLE bytes
+	unsigned int index_slots;
+	unsigned int index_count;
+	unsigned int reserved;
+	unsigned long long offsets_start;
+	unsigned long long index_start;
+	unsigned long long names_start;
+	unsigned long long total_size;
+} mbdb_sidecar_header_t;
+
+struct mbdb_t;
+struct mbdb_sidecar_job_t;
+
+int mbdb_sidecar_load(struct mbdb_t* mbdb, const char* file);
+int mbdb_sidecar_write(struct mbdb_t* mbdb, const char* file);
+int mbdb_sidecar_start(struct mbdb_t* mbdb, const char* file);
+int mbdb_sidecar_refresh(struct mbdb_t* mbdb, const char* file);
+void mbdb_sidecar_wait(struct mbdb_t* mbdb);
+void mbdb_sidecar_close(struct mbdb_t* mbdb);
+
+#endif /* MBDB_SIDECAR_H_ */
@@ -0,0 +1,75 @@
+/**
+  * libmbdb-1.0 - mbdb_snapshot.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_SNAPSHOT_H_
+#define MBDB_SNAPSHOT_H_
+
+#include "mbdb_record.h"
+
+#define MBDB_SNAPSHOT_PAGE   1024 // records per page
+#define MBDB_SNAPSHOT_SHARDS 256  // lookup tables, by the top byte of the key hash
+
+#define MBDB_SNAPSHOT_DELETED ((const mbdb_record_t*) 1)
+
+typedef struct mbdb_snapshot_page_t {
+	const mbdb_record_t* records[MBDB_SNAPSHOT_PAGE];
+} mbdb_snapshot_page_t;
+
+typedef struct mbdb_snapshot_slot_t {
+	unsigned int hash;
+	const mbdb_record_t* record;    // NULL if empty, or MBDB_SNAPSHOT_DELETED
+} mbdb_snapshot_slot_t;
+
+/* open addressing hash of (domain, path) to record, like mbdb_index_t */
+typedef struct mbdb_snapshot_shard_t {
+	unsigned int mask;
+	unsigned int count;             // live entries
+	unsigned int used;              // live and deleted entries
+	mbdb_snapshot_slot_t slots[1];  // mask + 1 of them
+} mbdb_snapshot_shard_t;
+
+/* One published version of the records, never changed once published.
+   Pages and shards that didn't change are shared with the version
+   before, and so are the records themselves. */
+typedef struct mbdb_snapshot_t {
+	unsigned int version;
+	unsigned int num_records;
+	unsigned int num_pages;
+	mbdb_snapshot_page_t** pages;
+	mbdb_snapshot_shard_t* shards[MBDB_SNAPSHOT_SHARDS];
+	int refs;                       // readers, under the lock of owner
+	struct mbdb_snapshots_t* owner;
+	struct mbdb_snapshot_t* next;   // newer version
+	void** garbage;                 // pages and shards this version was the last to use
+	unsigned int num_garbage;
+	mbdb_record_t** retired;        // records this version was the last to see
+	unsigned int num_retired;
+} mbdb_snapshot_t;
+
+struct mbdb_t;
+
+int mbdb_snapshot_publish(struct mbdb_t* mbdb);
+mbdb_snapshot_t* mbdb_snapshot_acquire(struct mbdb_t* mbdb);
+void mbdb_snapshot_release(mbdb_snapshot_t* snapshot);
+const mbdb_record_t* mbdb_snapshot_get_record(mbdb_snapshot_t* snapshot, unsigned int index);
+const mbdb_record_t* mbdb_snapshot_find_record(mbdb_snapshot_t* snapshot, const char* domain, const char* path);
+int mbdb_snapshot_retire(struct mbdb_t* mbdb, mbdb_record_t* record);
+void mbdb_snapshot_free_all(struct mbdb_t* mbdb);
+
+#endif /* MBDB_SNAPSHOT_H_ */
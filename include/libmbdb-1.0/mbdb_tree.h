@@ -0,0 +1,57 @@
+/**
+  * libmbdb-1.0 - mbdb_tree.h
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef MBDB_TREE_H_
+#define MBDB_TREE_H_
+
+#define MBDB_TREE_ROOT 0
+
+/* One node per path component. The children of node n are
+   tree->children[n.first_child .. n.first_child + n.num_children),
+   sorted by name. The root's children are the domains. */
+typedef struct mbdb_tree_node_t {
+	const char* name;               // not NUL terminated, points into the records or mbdb data
+	unsigned short name_size;
+	int record;                     // -1 for directories without a record of their own
+	unsigned int parent;
+	unsigned int first_child;
+	unsigned int num_children;
+} mbdb_tree_node_t;
+
+typedef struct mbdb_tree_t {
+	mbdb_tree_node_t* nodes;
+	unsigned int num_nodes;
+	unsigned int* children;
+} mbdb_tree_t;
+
+/* return non zero to stop the iteration */
+typedef int (*mbdb_tree_callback_t)(mbdb_tree_t* tree, unsigned int node, void* ctx);
+
+struct mbdb_t;
+
+mbdb_tree_t* mbdb_tree_build(struct mbdb_t* mbdb);
+int mbdb_tree_child(mbdb_tree_t* tree, unsigned int node, const char* name, unsigned short name_size);
+int mbdb_tree_lookup(mbdb_tree_t* tree, const char* domain, const char* path);
+int mbdb_tree_list(mbdb_tree_t* tree, unsigned int node, mbdb_tree_callback_t callback, void* ctx);
+int mbdb_tree_walk(mbdb_tree_t* tree, unsigned int node, mbdb_tree_callback_t callback, void* ctx);
+int mbdb_tree_glob(mbdb_tree_t* tree, const char* domain, const char* pattern, mbdb_tree_callback_t callback, void* ctx);
+int mbdb_tree_path(mbdb_tree_t* tree, unsigned int node, char* buf, unsigned int size);
+void mbdb_tree_free(mbdb_tree_t* tree);
+
+#endif /* MBDB_TREE_H_ */
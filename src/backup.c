@@ -20,11 +20,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <libmbdb-1.0/backup.h>
+#include <libmbdb-1.0/mbdb_copy.h>
 #include <libcrippy-1.0/debug.h>
 
 backup_t* backup_open(const char* backupdir, const char* udid)
+{
+	return backup_open_ex(backupdir, udid, 0);
+}
+
+backup_t* backup_open_ex(const char* backupdir, const char* udid, unsigned int flags)
 {
 	if (!backupdir || !udid) {
 		return NULL;
@@ -40,7 +47,7 @@ backup_t* backup_open(const char* backupdir, const char* udid)
 	strcat(mbdb_path, "/");
 	strcat(mbdb_path, "Manifest.mbdb");
 
-	mbdb_t* mbdb = mbdb_open(mbdb_path);
+	mbdb_t* mbdb = mbdb_open_ex(mbdb_path, flags);
 	if (mbdb) {
 		debug("Manifest.mbdb opened, %d records\n", mbdb->num_records);
 	} else {
@@ -59,57 +66,161 @@ backup_t* backup_open(const char* backupdir, const char* udid)
 
 	backup->mbdb = mbdb;
 	backup->path = backup_path;
+	pthread_rwlock_init(&backup->lock, NULL);
+	pthread_mutex_init(&backup->decode, NULL);
 
 	return backup;
 }
 
+/* Lookups run side by side under the read lock, so everything they
+   would build on demand has to exist first: the index is built under
+   the write lock here, records are decoded under backup->decode. */
+static void backup_read_lock(backup_t* backup)
+{
+	pthread_rwlock_rdlock(&backup->lock);
+	if (backup->mbdb->index == NULL) {
+		pthread_rwlock_unlock(&backup->lock);
+		pthread_rwlock_wrlock(&backup->lock);
+		mbdb_get_index(backup->mbdb);
+		pthread_rwlock_unlock(&backup->lock);
+		pthread_rwlock_rdlock(&backup->lock);
+	}
+}
+
+/* under the read lock, a missing index means it could not be built */
+static int backup_find(backup_t* backup, const char* domain, const char* path)
+{
+	return mbdb_index_find(backup->mbdb->index, backup->mbdb, domain, domain ? strlen(domain) : 0,
+		path, path ? strlen(path) : 0);
+}
+
+static mbdb_record_t* backup_read_record(backup_t* backup, int index)
+{
+	mbdb_record_t* rec = __atomic_load_n(&backup->mbdb->records[index], __ATOMIC_ACQUIRE);
+	if (rec == NULL) {
+		pthread_mutex_lock(&backup->decode);
+		rec = mbdb_get_record(backup->mbdb, index);
+		pthread_mutex_unlock(&backup->decode);
+	}
+	return rec;
+}
+
+/* under the read lock, a writer frees the record once it's released */
+static backup_file_t* backup_copy_record(backup_t* backup, int index)
+{
+	mbdb_record_t* rec = (index >= 0) ? backup_read_record(backup, index) : NULL;
+	return rec ? backup_file_create_from_record(rec) : NULL;
+}
+
 int backup_get_file_index(backup_t* backup, const char* domain, const char* path)
 {
 	if (!backup || !backup->mbdb) {
 		return -1;
 	}
-	int i = 0;
-	int found = 0;
-	mbdb_record_t* rec = NULL;
-	for (i = 0; i < backup->mbdb->num_records; i++) {
-		rec = backup->mbdb->records[i];
-		if (rec->domain && !strcmp(rec->domain, domain) && rec->path && !strcmp(rec->path, path)) {
-			found = 1;
-			break;
-		}
+	backup_read_lock(backup);
+	int idx = backup_find(backup, domain, path);
+	pthread_rwlock_unlock(&backup->lock);
+	return idx;
+}
+
+/* Points view at the record, nothing is copied. Returns -1 if there
+   is no such file. */
+int backup_get_file_view(backup_t* backup, const char* domain, const char* path, backup_file_view_t* view)
+{
+	if (!backup || !backup->mbdb || !view) {
+		return -1;
 	}
-	return (found) ? i : -1;
+	backup_read_lock(backup);
+	view->index = backup_find(backup, domain, path);
+	view->mbdb_record = (view->index >= 0) ? backup_read_record(backup, view->index) : NULL;
+	pthread_rwlock_unlock(&backup->lock);
+	return view->mbdb_record ? 0 : -1;
 }
 
+/* a copy of the record the caller owns and may change */
 backup_file_t* backup_get_file(backup_t* backup, const char* domain, const char* path)
 {
 	if (!backup || !backup->mbdb) {
 		return NULL;
 	}
-	int idx = backup_get_file_index(backup, domain, path);
-	if (idx < 0) {
-		// not found
-		return NULL;
-	}
-	mbdb_record_t* rec = backup->mbdb->records[idx];
-	return backup_file_create_from_record(rec);
+	backup_read_lock(backup);
+	backup_file_t* file = backup_copy_record(backup, backup_find(backup, domain, path));
+	pthread_rwlock_unlock(&backup->lock);
+	return file;
 }
 
 int backup_get_num_files(backup_t* backup)
 {
 	if (!backup || !backup->mbdb)
 		return 0;
-	return backup->mbdb->num_records;
+	pthread_rwlock_rdlock(&backup->lock);
+	if (backup->mbdb->num_deleted > 0) {
+		// callers walk the files by index, close the holes of removed ones first
+		pthread_rwlock_unlock(&backup->lock);
+		pthread_rwlock_wrlock(&backup->lock);
+		mbdb_compact(backup->mbdb);
+	}
+	int count = backup->mbdb->num_records;
+	pthread_rwlock_unlock(&backup->lock);
+	return count;
+}
+
+/* Like backup_get_file_view(), removed files leave no view behind */
+int backup_get_file_view_by_index(backup_t* backup, int index, backup_file_view_t* view)
+{
+	if (!backup || !backup->mbdb || !view)
+		return -1;
+	view->index = index;
+	view->mbdb_record = NULL;
+	pthread_rwlock_rdlock(&backup->lock);
+	if (index >= 0 && index < backup->mbdb->num_records) {
+		view->mbdb_record = backup_read_record(backup, index);
+	}
+	pthread_rwlock_unlock(&backup->lock);
+	return view->mbdb_record ? 0 : -1;
 }
 
 backup_file_t* backup_get_file_by_index(backup_t* backup, int index)
 {
 	if (!backup || !backup->mbdb)
 		return NULL;
-	if (index < 0 || index >= backup->mbdb->num_records)
+	backup_file_t* file = NULL;
+	pthread_rwlock_rdlock(&backup->lock);
+	if (index < backup->mbdb->num_records) {
+		file = backup_copy_record(backup, index);
+	}
+	pthread_rwlock_unlock(&backup->lock);
+	return file;
+}
+
+/* "<backup dir>/<hash of domain-path>", where the data of record lives.
+   Returns the length written, or -1 if size is too small. */
+static int backup_format_file_path(backup_t* backup, const mbdb_record_t* record, char* path, size_t size)
+{
+	unsigned char hash[MBDB_NAME_HASH_SIZE];
+	size_t length = strlen(backup->path);
+
+	if (size < length + 1 + MBDB_NAME_SIZE + 1) {
+		return -1;
+	}
+	mbdb_record_get_name_hash(record, hash);
+	memcpy(path, backup->path, length);
+	path[length] = '/';
+	mbdb_name_format(hash, path + length + 1);
+	return (int) (length + 1 + MBDB_NAME_SIZE);
+}
+
+static char* backup_record_filename(backup_t* backup, const mbdb_record_t* record)
+{
+	size_t size = strlen(backup->path) + 1 + MBDB_NAME_SIZE + 1;
+
+	char* backupfname = (char*)malloc(size);
+	if (backupfname == NULL) {
+		error("Allocation Error!\n");
 		return NULL;
-	mbdb_record_t* rec = backup->mbdb->records[index];
-	return backup_file_create_from_record(rec);
+	}
+	backup_format_file_path(backup, record, backupfname, size);
+	return backupfname;
 }
 
 char* backup_get_file_path(backup_t* backup, backup_file_t* bfile)
@@ -124,23 +235,9 @@ char* backup_get_file_path(backup_t* backup, backup_file_t* bfile)
 		return NULL;
 	}
 
-	char* bfntmp = (char*)malloc(bfile->mbdb_record->domain_size + 1 + bfile->mbdb_record->path_size+1+4);
-	strcpy(bfntmp, bfile->mbdb_record->domain);
-	strcat(bfntmp, "-");
-	strcat(bfntmp, bfile->mbdb_record->path);
-
-	char* backupfname = (char*)malloc(strlen(backup->path)+1+40+1);
-	unsigned char sha1[20] = {0, };
-	SHA1(bfntmp, strlen(bfntmp), sha1);
-	free(bfntmp);
-
-	strcpy(backupfname, backup->path);
-	strcat(backupfname, "/");
-
-	int i;
-	char* p = backupfname + strlen(backup->path) + 1;
-	for (i = 0; i < 20; i++) {
-		sprintf(p + i*2, "%02x", sha1[i]);
+	char* backupfname = backup_record_filename(backup, bfile->mbdb_record);
+	if (backupfname == NULL) {
+		return NULL;
 	}
 
 	debug("backup filename is %s\n", backupfname);
@@ -148,122 +245,148 @@ char* backup_get_file_path(backup_t* backup, backup_file_t* bfile)
 	return backupfname;
 }
 
-int backup_update_file(backup_t* backup, backup_file_t* bfile)
+/* backup_get_file_path() into a buffer of the caller, nothing is
+   allocated. size has to hold strlen(backup->path) + 1 + MBDB_NAME_SIZE
+   and the NUL. Returns the length of the path, or -1. */
+int backup_get_file_path_into(backup_t* backup, backup_file_t* bfile, char* path, size_t size)
 {
-	int res = 0;
+	if (!backup || !bfile || !path) {
+		return -1;
+	}
+	return backup_format_file_path(backup, bfile->mbdb_record, path, size);
+}
 
-	if (!backup || !bfile) {
+/* same for a view, valid as long as the view is */
+int backup_get_file_view_path_into(backup_t* backup, const backup_file_view_t* view, char* path, size_t size)
+{
+	if (!backup || !view || !view->mbdb_record || !path) {
 		return -1;
 	}
-	if (!backup->mbdb) {
-		error("%s: ERROR: no mbdb in given backup_t\n", __func__);
+	return backup_format_file_path(backup, view->mbdb_record, path, size);
+}
+
+/* file operations of a batch, applied in order by backup_commit():
+   from is moved to to, or to is removed if there is no from */
+typedef struct backup_batch_op_t {
+	char* from;
+	char* to;
+} backup_batch_op_t;
+
+struct backup_batch_t {
+	backup_batch_op_t* ops;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int serial;            // names the files written aside
+};
+
+static char* backup_batch_name(backup_t* backup, const char* backupfname)
+{
+	char* name = (char*)malloc(strlen(backupfname) + 32);
+	if (name == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	sprintf(name, "%s.batch-%d-%u", backupfname, (int)getpid(), backup->batch->serial++);
+	return name;
+}
+
+/* takes from, copies to */
+static int backup_batch_add(backup_t* backup, char* from, const char* to)
+{
+	struct backup_batch_t* batch = backup->batch;
+	if (batch->count == batch->capacity) {
+		unsigned int capacity = batch->capacity ? batch->capacity * 2 : 64;
+		backup_batch_op_t* ops = (backup_batch_op_t*)realloc(batch->ops, capacity * sizeof(backup_batch_op_t));
+		if (ops == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		batch->ops = ops;
+		batch->capacity = capacity;
+	}
+	char* copy = strdup(to);
+	if (copy == NULL) {
+		error("Allocation Error!\n");
 		return -1;
 	}
+	batch->ops[batch->count].from = from;
+	batch->ops[batch->count].to = copy;
+	batch->count++;
+	return 0;
+}
 
-	unsigned char* rec = NULL;
-	unsigned int rec_size = 0;
+static void backup_batch_free(struct backup_batch_t* batch)
+{
+	unsigned int i = 0;
+	for (i = 0; i < batch->count; i++) {
+		free(batch->ops[i].from);
+		free(batch->ops[i].to);
+	}
+	free(batch->ops);
+	free(batch);
+}
 
-	if (backup_file_get_record_data(bfile, &rec, &rec_size) < 0) {
-		error("%s: ERROR: could not build mbdb_record data\n", __func__);
+/* under the write lock */
+static int backup_update_record(backup_t* backup, backup_file_t* bfile)
+{
+	int res = 0;
+
+	// before the copy, so it takes the name hash along
+	char* backupfname = backup_record_filename(backup, bfile->mbdb_record);
+	if (backupfname == NULL) {
 		return -1;
 	}
 
-	unsigned int newsize = 0;
-	unsigned char* newdata = NULL;
+	// the mbdb keeps a copy, the caller keeps bfile
+	mbdb_record_t* rec = mbdb_record_copy(bfile->mbdb_record);
+	if (rec == NULL) {
+		error("%s: ERROR: could not copy mbdb_record\n", __func__);
+		free(backupfname);
+		return -1;
+	}
 
 	// find record
-	int idx = backup_get_file_index(backup, bfile->mbdb_record->domain, bfile->mbdb_record->path);
+	int idx = mbdb_find_record(backup->mbdb, bfile->mbdb_record->domain, bfile->mbdb_record->path);
 	if (idx < 0) {
 		// append record to mbdb
-		newsize = backup->mbdb->size + rec_size;
-		newdata = (unsigned char*)malloc(newsize);
-
-		memcpy(newdata, backup->mbdb->data, backup->mbdb->size);
-		memcpy(newdata+backup->mbdb->size, rec, rec_size);
+		res = mbdb_insert_record(backup->mbdb, rec);
 	} else {
 		// update record in mbdb
-		backup_file_t* oldfile = backup_file_create_from_record(backup->mbdb->records[idx]);
-		unsigned int oldsize = oldfile->mbdb_record->this_size;
-		backup_file_free(oldfile);
-
-		newsize = backup->mbdb->size - oldsize + rec_size;
-		newdata = (unsigned char*)malloc(newsize);
-
-		char* p = newdata;
-		memcpy(p, backup->mbdb->data, sizeof(mbdb_header_t));
-		p+=sizeof(mbdb_header_t);
-
-		mbdb_record_t* r;
-		unsigned char* rd;
-		unsigned int rs;
-		int i;
-
-		for (i = 0; i < idx; i++) {
-			r = backup->mbdb->records[i];
-			rd = NULL;
-			rs = 0;
-			mbdb_record_build(r, &rd, &rs);
-			memcpy(p, rd, rs);
-			free(rd);
-			p+=rs;
-		}
-		memcpy(p, rec, rec_size);
-		p+=rec_size;
-		for (i = idx+1; i < backup->mbdb->num_records; i++) {
-			r = backup->mbdb->records[i];
-			rd = NULL;
-			rs = 0;
-			mbdb_record_build(r, &rd, &rs);
-			memcpy(p, rd, rs);
-			free(rd);
-			p+=rs;
-		}
+		res = mbdb_replace_record(backup->mbdb, idx, rec);
 	}
-
-	if (!newdata) {
-		error("Uh, could not re-create mbdb data?!\n");
+	if (res < 0) {
+		error("Uh, could not update mbdb record?!\n");
+		mbdb_record_free(rec);
+		free(backupfname);
 		return -1;
 	}
-
-	mbdb_free(backup->mbdb);
-	free(rec);
-
-	// parse the new data
-	backup->mbdb = mbdb_parse(newdata, newsize);
-	free(newdata);
+	res = 0;
 
 	// write out the file data
-	char* bfntmp = (char*)malloc(bfile->mbdb_record->domain_size + 1 + bfile->mbdb_record->path_size+1+4);
-	strcpy(bfntmp, bfile->mbdb_record->domain);
-	strcat(bfntmp, "-");
-	strcat(bfntmp, bfile->mbdb_record->path);
-
-	char* backupfname = (char*)malloc(strlen(backup->path)+1+40+1);
-	unsigned char sha1[20] = {0, };
-	SHA1(bfntmp, strlen(bfntmp), sha1);
-	free(bfntmp);
-
-	strcpy(backupfname, backup->path);
-	strcat(backupfname, "/");
-
-	int i;
-	char* p = backupfname + strlen(backup->path) + 1;
-	for (i = 0; i < 20; i++) {
-		sprintf(p + i*2, "%02x", sha1[i]);
-	}
 
 	debug("backup filename is %s\n", backupfname);
 
-	if (bfile->filepath) {
-		// copy file to backup dir
-		if (file_copy(bfile->filepath, backupfname) < 0) {
-			error("%s: ERROR: could not copy file '%s' to '%s'\n", __func__, bfile->filepath, backupfname);
+	if (bfile->filepath || bfile->data) {
+		// inside a batch the data goes aside, backup_commit() moves it in place
+		char* target = backup->batch ? backup_batch_name(backup, backupfname) : backupfname;
+		if (target == NULL) {
 			res = -1;
+		} else if (bfile->filepath) {
+			// copy file to backup dir, in the kernel where it can
+			if (mbdb_copy_file(bfile->filepath, target, MBDB_COPY_ANY, NULL) < 0) {
+				error("%s: ERROR: could not copy file '%s' to '%s'\n", __func__, bfile->filepath, target);
+				res = -1;
+			}
+		} else {
+			// write data buffer to file
+			if (file_write(target, bfile->data, bfile->size) < 0) {
+				error("%s: ERROR: could not write to '%s'\n", __func__, target);
+				res = -1;
+			}
 		}
-	} else if (bfile->data) {
-		// write data buffer to file
-		if (file_write(backupfname, bfile->data, bfile->size) < 0) {
-			error("%s: ERROR: could not write to '%s'\n", __func__, backupfname);
+		if (target && target != backupfname && (res < 0 || backup_batch_add(backup, target, backupfname) < 0)) {
+			unlink(target);
+			free(target);
 			res = -1;
 		}
 	} else if ((bfile->mbdb_record->mode) & 040000) {
@@ -279,10 +402,8 @@ int backup_update_file(backup_t* backup, backup_file_t* bfile)
 	return res;
 }
 
-int backup_remove_file(backup_t* backup, backup_file_t* bfile)
+int backup_update_file(backup_t* backup, backup_file_t* bfile)
 {
-	int res = 0;
-
 	if (!backup || !bfile) {
 		return -1;
 	}
@@ -290,87 +411,43 @@ int backup_remove_file(backup_t* backup, backup_file_t* bfile)
 		error("%s: ERROR: no mbdb in given backup_t\n", __func__);
 		return -1;
 	}
+	pthread_rwlock_wrlock(&backup->lock);
+	int res = backup_update_record(backup, bfile);
+	pthread_rwlock_unlock(&backup->lock);
+	return res;
+}
 
-	unsigned int newsize = 0;
-	unsigned char* newdata = NULL;
+/* under the write lock */
+static int backup_remove_record(backup_t* backup, backup_file_t* bfile)
+{
+	int res = 0;
 
 	// find record
-	int idx = backup_get_file_index(backup, bfile->mbdb_record->domain, bfile->mbdb_record->path);
+	int idx = mbdb_find_record(backup->mbdb, bfile->mbdb_record->domain, bfile->mbdb_record->path);
 	if (idx < 0) {
 		debug("file %s-%s not found in backup so not removed.\n", bfile->mbdb_record->domain, bfile->mbdb_record->path);
 		return -1;
-	} else {
-		// remove record from mbdb
-		backup_file_t* oldfile = backup_file_create_from_record(backup->mbdb->records[idx]);
-		unsigned int oldsize = oldfile->mbdb_record->this_size;
-		backup_file_free(oldfile);
-
-		newsize = backup->mbdb->size - oldsize;
-		newdata = (unsigned char*)malloc(newsize);
-
-		char* p = newdata;
-		memcpy(p, backup->mbdb->data, sizeof(mbdb_header_t));
-		p+=sizeof(mbdb_header_t);
-
-		mbdb_record_t* r;
-		unsigned char* rd;
-		unsigned int rs;
-		int i;
-
-		for (i = 0; i < idx; i++) {
-			r = backup->mbdb->records[i];
-			rd = NULL;
-			rs = 0;
-			mbdb_record_build(r, &rd, &rs);
-			memcpy(p, rd, rs);
-			free(rd);
-			p+=rs;
-		}
-		for (i = idx+1; i < backup->mbdb->num_records; i++) {
-			r = backup->mbdb->records[i];
-			rd = NULL;
-			rs = 0;
-			mbdb_record_build(r, &rd, &rs);
-			memcpy(p, rd, rs);
-			free(rd);
-			p+=rs;
-		}
 	}
-
-	if (!newdata) {
-		error("Uh, could not re-create mbdb data?!\n");
+	// remove record from mbdb
+	if (mbdb_remove_record(backup->mbdb, idx) < 0) {
+		error("Uh, could not remove mbdb record?!\n");
 		return -1;
 	}
 
-	mbdb_free(backup->mbdb);
-
-	// parse the new data
-	backup->mbdb = mbdb_parse(newdata, newsize);
-	free(newdata);
-
 	// write out the file data
-	char* bfntmp = (char*)malloc(bfile->mbdb_record->domain_size + 1 + bfile->mbdb_record->path_size+1+4);
-	strcpy(bfntmp, bfile->mbdb_record->domain);
-	strcat(bfntmp, "-");
-	strcat(bfntmp, bfile->mbdb_record->path);
-
-	char* backupfname = (char*)malloc(strlen(backup->path)+1+40+1);
-	unsigned char sha1[20] = {0, };
-	SHA1(bfntmp, strlen(bfntmp), sha1);
-	free(bfntmp);
-
-	strcpy(backupfname, backup->path);
-	strcat(backupfname, "/");
-
-	int i;
-	char* p = backupfname + strlen(backup->path) + 1;
-	for (i = 0; i < 20; i++) {
-		sprintf(p + i*2, "%02x", sha1[i]);
+	char* backupfname = backup_record_filename(backup, bfile->mbdb_record);
+	if (backupfname == NULL) {
+		return -1;
 	}
 
 	if (!(bfile->mbdb_record->mode & 040000)) {
-		debug("deleting file %s\n", backupfname);
-		remove(backupfname);
+		if (backup->batch) {
+			// the data stays until backup_commit(), a rollback still needs it
+			res = backup_batch_add(backup, NULL, backupfname);
+		} else {
+			debug("deleting file %s\n", backupfname);
+			remove(backupfname);
+		}
 	}
 
 	free(backupfname);
@@ -378,7 +455,58 @@ int backup_remove_file(backup_t* backup, backup_file_t* bfile)
 	return res;
 }
 
-int inode_start = 54327;        /* Whatever. */
+int backup_remove_file(backup_t* backup, backup_file_t* bfile)
+{
+	if (!backup || !bfile) {
+		return -1;
+	}
+	if (!backup->mbdb) {
+		error("%s: ERROR: no mbdb in given backup_t\n", __func__);
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	int res = backup_remove_record(backup, bfile);
+	pthread_rwlock_unlock(&backup->lock);
+	return res;
+}
+
+#define BACKUP_INODE_START 54327 /* Whatever. */
+
+/* New files get inodes past any in the manifest, under the write lock */
+static unsigned int backup_next_inode(backup_t* backup)
+{
+	int i = 0;
+	if (backup->inode == 0) {
+		backup->inode = BACKUP_INODE_START;
+		// straight from the data, decoding every record would undo a lazy open
+		for (i = 0; i < backup->mbdb->num_records; i++) {
+			unsigned int inode = mbdb_get_record_inode(backup->mbdb, i);
+			if (inode > backup->inode) {
+				backup->inode = inode;
+			}
+		}
+	}
+	return ++backup->inode;
+}
+
+static int backup_save(backup_t* backup);
+
+/* numbers and stores a new file, then saves the manifest */
+static int backup_add(backup_t* backup, backup_file_t* file)
+{
+	int ret = 0;
+	if (!backup || !backup->mbdb) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	backup_file_set_inode(file, backup_next_inode(backup));
+	ret = backup_update_record(backup, file);
+	if (ret >= 0 && !backup->batch) {
+		backup_save(backup);
+	}
+	pthread_rwlock_unlock(&backup->lock);
+	return ret < 0 ? -1 : 0;
+}
 
 int backup_mkdir(backup_t * backup, char *domain, char *path, int mode, int uid,
                  int gid, int flag)
@@ -390,9 +518,6 @@ int backup_mkdir(backup_t * backup, char *domain, char *path, int mode, int uid,
         backup_file_set_domain(file, domain);
         backup_file_set_path(file, path);
         backup_file_set_mode(file, mode | 040000);
-        inode_start++;
-
-        backup_file_set_inode(file, inode_start);
         backup_file_set_uid(file, uid);
         backup_file_set_gid(file, gid);
         backup_file_set_time1(file, time(NULL));
@@ -400,14 +525,8 @@ int backup_mkdir(backup_t * backup, char *domain, char *path, int mode, int uid,
         backup_file_set_time3(file, time(NULL));
         backup_file_set_flag(file, flag);
 
-        if (backup_update_file(backup, file) >= 0)
-            ret = 0;
-        else
-            ret = -1;
+        ret = backup_add(backup, file);
         backup_file_free(file);
-
-        if (!ret)
-            backup_write_mbdb(backup);
     }
     return ret;
 }
@@ -423,9 +542,6 @@ int backup_symlink(backup_t * backup, char *domain, char *path, char *to,
         backup_file_set_path(file, path);
         backup_file_set_target(file, to);
         backup_file_set_mode(file, 0120644);
-        inode_start++;
-
-        backup_file_set_inode(file, inode_start);
         backup_file_set_uid(file, uid);
         backup_file_set_gid(file, gid);
         backup_file_set_time1(file, time(NULL));
@@ -433,14 +549,8 @@ int backup_symlink(backup_t * backup, char *domain, char *path, char *to,
         backup_file_set_time3(file, time(NULL));
         backup_file_set_flag(file, flag);
 
-        if (backup_update_file(backup, file) >= 0)
-            ret = 0;
-        else
-            ret = -1;
+        ret = backup_add(backup, file);
         backup_file_free(file);
-
-        if (!ret)
-            backup_write_mbdb(backup);
     }
     return ret;
 }
@@ -449,23 +559,17 @@ int backup_add_file_from_path(backup_t * backup, char *domain, char *localpath,
                               char *path, int mode, int uid, int gid, int flag)
 {
     int ret = -1;
-    unsigned int size = 0;
-    unsigned char *data = NULL;
     struct stat buf;
 
     if (stat(localpath, &buf) == -1) return -1;
 
-    file_read(localpath, &data, &size);
-
-    backup_file_t *file = backup_file_create_with_data(data, size, 0);
+    // the data is copied straight from localpath by backup_update_file()
+    backup_file_t *file = backup_file_create(localpath);
 
     if (file) {
         backup_file_set_domain(file, domain);
         backup_file_set_path(file, path);
         backup_file_set_mode(file, mode | 0100000);
-        inode_start++;
-
-        backup_file_set_inode(file, inode_start);
         backup_file_set_uid(file, uid);
         backup_file_set_gid(file, gid);
         backup_file_set_time1(file, time(NULL));
@@ -473,16 +577,10 @@ int backup_add_file_from_path(backup_t * backup, char *domain, char *localpath,
         backup_file_set_time3(file, time(NULL));
         backup_file_set_flag(file, flag);
 
-        backup_file_set_length(file, size);
+        backup_file_set_length(file, buf.st_size);
 
-        if (backup_update_file(backup, file) >= 0)
-            ret = 0;
-        else
-            ret = -1;
+        ret = backup_add(backup, file);
         backup_file_free(file);
-
-        if (!ret)
-            backup_write_mbdb(backup);
     }
     return ret;
 }
@@ -498,9 +596,6 @@ int backup_add_file_from_data(backup_t * backup, char *domain, char *data,
         backup_file_set_domain(file, domain);
         backup_file_set_path(file, path);
         backup_file_set_mode(file, mode | 0100000);
-        inode_start++;
-
-        backup_file_set_inode(file, inode_start);
         backup_file_set_uid(file, uid);
         backup_file_set_gid(file, gid);
         backup_file_set_time1(file, time(NULL));
@@ -510,19 +605,13 @@ int backup_add_file_from_data(backup_t * backup, char *domain, char *data,
 
         backup_file_set_length(file, size);
 
-        if (backup_update_file(backup, file) >= 0)
-            ret = 0;
-        else
-            ret = -1;
+        ret = backup_add(backup, file);
         backup_file_free(file);
-
-        if (!ret)
-            backup_write_mbdb(backup);
     }
     return ret;
 }
 
-int backup_write_mbdb(backup_t* backup)
+static int backup_write_manifest(backup_t* backup)
 {
 	if (!backup || !backup->path || !backup->mbdb) {
 		return -1;
@@ -533,20 +622,187 @@ int backup_write_mbdb(backup_t* backup)
 	strcat(mbdb_path, "/");
 	strcat(mbdb_path, "Manifest.mbdb");
 
-	int res = file_write(mbdb_path, backup->mbdb->data, backup->mbdb->size);
+	int res = mbdb_write(backup->mbdb, mbdb_path);
+	if (res >= 0) {
+		backup->mbdb->dirty = 0;
+	}
+	if (res >= 0 && backup->mbdb->journal && mbdb_journal_reset(backup->mbdb, mbdb_path) < 0) {
+		res = -1;
+	}
+	if (res >= 0 && (backup->mbdb->flags & MBDB_OPEN_SIDECAR)) {
+		// the old sidecar is stale now, describe the manifest just written
+		mbdb_sidecar_refresh(backup->mbdb, mbdb_path);
+	}
 	free(mbdb_path);
 	return res;
 }
 
+/* With a journal the changes are only appended to it, the manifest
+   is written again once the journal grows past MBDB_JOURNAL_CHECKPOINT.
+   Once snapshots were published, each save publishes the next one. */
+static int backup_save(backup_t* backup)
+{
+	if (!backup || !backup->mbdb) {
+		return -1;
+	}
+	int res = 0;
+	if (backup->mbdb->journal == NULL) {
+		res = backup_write_manifest(backup);
+	} else if (mbdb_journal_sync(backup->mbdb) < 0) {
+		res = -1;
+	} else {
+		backup->mbdb->dirty = 0;
+		if (mbdb_journal_size(backup->mbdb) >= MBDB_JOURNAL_CHECKPOINT) {
+			res = backup_write_manifest(backup);
+		}
+	}
+	// readers of snapshots see what was saved
+	if (res == 0 && backup->mbdb->snapshots && !backup->mbdb->batch) {
+		mbdb_snapshot_publish(backup->mbdb);
+	}
+	return res;
+}
+
+int backup_write_mbdb(backup_t* backup)
+{
+	if (!backup) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	// backup_commit() writes the manifest once for the whole batch
+	int res = backup->batch ? 0 : backup_save(backup);
+	pthread_rwlock_unlock(&backup->lock);
+	return res;
+}
+
+/* Writes the manifest with every change so far and empties the journal */
+int backup_checkpoint(backup_t* backup)
+{
+	int res = 0;
+	if (!backup || !backup->mbdb) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	if (backup->batch) {
+		res = -1;
+	} else if (backup->mbdb->dirty || mbdb_journal_size(backup->mbdb) > 0) {
+		res = backup_write_manifest(backup);
+	}
+	pthread_rwlock_unlock(&backup->lock);
+	return res;
+}
+
+/* Starts a batch: changes are applied in memory only, backup_commit()
+   writes the manifest once and backup_rollback() drops them all */
+int backup_begin(backup_t* backup)
+{
+	int res = 0;
+	if (!backup || !backup->mbdb) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	if (backup->batch) {
+		res = -1;
+	} else if ((backup->batch = (struct backup_batch_t*)calloc(1, sizeof(struct backup_batch_t))) == NULL) {
+		error("Allocation Error!\n");
+		res = -1;
+	} else if (mbdb_begin(backup->mbdb) < 0) {
+		free(backup->batch);
+		backup->batch = NULL;
+		res = -1;
+	}
+	pthread_rwlock_unlock(&backup->lock);
+	return res;
+}
+
+/* If the manifest can't be written the batch stays open,
+   to be committed again or rolled back */
+int backup_commit(backup_t* backup)
+{
+	unsigned int i = 0;
+
+	if (!backup) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	if (!backup->batch) {
+		pthread_rwlock_unlock(&backup->lock);
+		return -1;
+	}
+	if (backup_save(backup) < 0) {
+		error("%s: ERROR: could not write the manifest\n", __func__);
+		pthread_rwlock_unlock(&backup->lock);
+		return -1;
+	}
+	mbdb_commit(backup->mbdb);
+	if (backup->mbdb->snapshots) {
+		mbdb_snapshot_publish(backup->mbdb);
+	}
+
+	struct backup_batch_t* batch = backup->batch;
+	backup->batch = NULL;
+	for (i = 0; i < batch->count; i++) {
+		backup_batch_op_t* op = &batch->ops[i];
+		if (op->from) {
+			if (rename(op->from, op->to) < 0) {
+				error("%s: ERROR: could not move '%s' to '%s'\n", __func__, op->from, op->to);
+			}
+		} else {
+			debug("deleting file %s\n", op->to);
+			remove(op->to);
+		}
+	}
+	// moved under the lock, lookups find the new records with their data
+	pthread_rwlock_unlock(&backup->lock);
+	backup_batch_free(batch);
+	return 0;
+}
+
+int backup_rollback(backup_t* backup)
+{
+	unsigned int i = 0;
+
+	if (!backup) {
+		return -1;
+	}
+	pthread_rwlock_wrlock(&backup->lock);
+	if (!backup->batch) {
+		pthread_rwlock_unlock(&backup->lock);
+		return -1;
+	}
+	mbdb_rollback(backup->mbdb);
+
+	struct backup_batch_t* batch = backup->batch;
+	backup->batch = NULL;
+	pthread_rwlock_unlock(&backup->lock);
+	for (i = 0; i < batch->count; i++) {
+		if (batch->ops[i].from) {
+			unlink(batch->ops[i].from);
+		}
+	}
+	backup_batch_free(batch);
+	return 0;
+}
+
+/* no other thread may use the backup by now */
 void backup_free(backup_t* backup)
 {
 	if (backup) {
+		if (backup->batch) {
+			backup_rollback(backup);
+		}
+		if (backup->mbdb && backup->mbdb->journal) {
+			// leave a manifest with everything in it, and an empty journal
+			backup_checkpoint(backup);
+		}
 		if (backup->mbdb) {
 			mbdb_free(backup->mbdb);
 		}
 		if (backup->path) {
 			free(backup->path);
 		}
+		pthread_rwlock_destroy(&backup->lock);
+		pthread_mutex_destroy(&backup->decode);
 		free(backup);
 	}
 }
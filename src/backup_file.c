@@ -70,48 +70,26 @@ backup_file_t* backup_file_create_from_record(mbdb_record_t* record)
 	backup_file_t* file = backup_file_new();
 	if (!file) return NULL;
 	
-	file->mbdb_record = (mbdb_record_t*)malloc(sizeof(mbdb_record_t));
+	// we need to make a real copy of the record
+	file->mbdb_record = mbdb_record_copy(record);
 	if(file->mbdb_record == NULL) {
 		error("Allocation Error\n");
+		backup_file_free(file);
 		return NULL;
 	}
 
-	// we need to make a real copy of the record
-	memcpy(file->mbdb_record, record, sizeof(mbdb_record_t));
-	if (record->domain) {
-		file->mbdb_record->domain = strdup(record->domain);
-	}
-	if (record->path) {
-		file->mbdb_record->path = strdup(record->path);
-	}
-	if (record->target) {
-		file->mbdb_record->target = strdup(record->target);
-	}
-	if (record->datahash) {
-		file->mbdb_record->datahash = (char*) malloc(record->datahash_size);
-		memcpy(file->mbdb_record->datahash, record->datahash, record->datahash_size);
-	}
-	if (record->unknown1) {
-		file->mbdb_record->unknown1 = (char*) malloc(record->unknown1_size);
-		memcpy(file->mbdb_record->unknown1, record->unknown1, record->unknown1_size);
-	}
-	if (record->property_count > 0) {
-		file->mbdb_record->properties = (mbdb_record_property_t**)malloc(sizeof(mbdb_record_property_t*) * record->property_count);
-		int i;
-		for (i = 0; i < record->property_count; i++) {
-			mbdb_record_property_t* prop = malloc(sizeof(mbdb_record_property_t));
-			prop->name_size = record->properties[i]->name_size;
-			prop->name = (char*)malloc(prop->name_size+1);
-			memcpy(prop->name, record->properties[i]->name, prop->name_size);
-			prop->value_size = record->properties[i]->value_size;
-			prop->value = (char*)malloc(prop->value_size+1);
-			memcpy(prop->value, record->properties[i]->value, prop->value_size);
-		}
-	}
-	
 	return file;
 }
 
+/* a mutable copy of what the view shows */
+backup_file_t* backup_file_create_from_view(const backup_file_view_t* view)
+{
+	if (!view) {
+		return NULL;
+	}
+	return backup_file_create_from_record((mbdb_record_t*) view->mbdb_record);
+}
+
 void backup_file_assign_file_data(backup_file_t* bfile, unsigned char* data, unsigned int size, int copy)
 {
 	if (copy) {
@@ -20,9 +20,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <libmbdb-1.0/mbdb.h>
 #include <libcrippy-1.0/debug.h>
+#include <libcrippy-1.0/endianness.h>
 
 mbdb_t* mbdb_create() {
 	mbdb_t* mbdb = NULL;
@@ -35,24 +43,303 @@ mbdb_t* mbdb_create() {
 	return mbdb;
 }
 
-mbdb_t* mbdb_parse(unsigned char* data, unsigned int size) {
+/* room for count records in the record and offset tables */
+static int mbdb_reserve(mbdb_t* mbdb, unsigned int count) {
+	if (count <= mbdb->capacity) {
+		return 0;
+	}
+	mbdb_record_t** records = (mbdb_record_t**)realloc(mbdb->records, (count + 1) * sizeof(*mbdb->records));
+	if (records == NULL) {
+		error("Unable to grow record table\n");
+		return -1;
+	}
+	mbdb->records = records;
+	unsigned int* offsets = (unsigned int*)realloc(mbdb->offsets, (count + 1) * sizeof(*mbdb->offsets));
+	if (offsets == NULL) {
+		error("Unable to grow record table\n");
+		return -1;
+	}
+	mbdb->offsets = offsets;
+	memset(&mbdb->records[mbdb->capacity], '\0', (count + 1 - mbdb->capacity) * sizeof(*mbdb->records));
+	mbdb->capacity = count;
+	return 0;
+}
+
+typedef struct mbdb_parse_job_t {
+	mbdb_t* mbdb;
+	unsigned int first;
+	unsigned int last;
+	int borrow;
+	int failed;
+	mbdb_arena_t* arena;
+	pthread_t thread;
+	int started;
+} mbdb_parse_job_t;
+
+/* 0 or less is one thread per online CPU */
+static int mbdb_limit_threads(mbdb_t* mbdb, int threads) {
+	if (threads <= 0) {
+		threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	// don't bother splitting small manifests
+	if (threads > mbdb->num_records / MBDB_PARSE_CHUNK + 1) {
+		threads = mbdb->num_records / MBDB_PARSE_CHUNK + 1;
+	}
+	return (threads > 1) ? threads : 1;
+}
+
+static int mbdb_parse_threads(mbdb_t* mbdb) {
+	int threads = (mbdb->flags & MBDB_OPEN_THREADS_MASK) >> 24;
+	if (threads == 0) {
+		return 1;
+	}
+	return mbdb_limit_threads(mbdb, (threads == 0xFF) ? 0 : threads);
+}
+
+static void* mbdb_parse_worker(void* arg) {
+	mbdb_parse_job_t* job = (mbdb_parse_job_t*) arg;
+	mbdb_t* mbdb = job->mbdb;
+	unsigned int i = 0;
+
+	unsigned int end = (job->last < (unsigned int)mbdb->num_records) ? mbdb->offsets[job->last] : mbdb->size;
+	unsigned int bytes = end - mbdb->offsets[job->first];
+	job->arena = mbdb_arena_create(job->borrow ? bytes : bytes * 2);
+	if (job->arena == NULL) {
+		job->failed = 1;
+		return NULL;
+	}
+
+	for (i = job->first; i < job->last; i++) {
+		unsigned int offset = mbdb->offsets[i];
+		mbdb->records[i] = mbdb_record_parse_interned(job->arena, mbdb->domains, &(mbdb->data)[offset],
+			mbdb->size - offset, job->borrow);
+		if (mbdb->records[i] == NULL) {
+			job->failed = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Interns every domain before the workers start so they only have to
+   look them up. Records come grouped by domain, a run of equal spans
+   costs one memcmp per record. */
+static int mbdb_parse_domains(mbdb_t* mbdb) {
+	const unsigned char* last = NULL;
+	unsigned short last_size = 0;
+	unsigned int i = 0;
+
+	for (i = 0; i < (unsigned int)mbdb->num_records; i++) {
+		unsigned int offset = mbdb->offsets[i];
+		if (mbdb->size - offset < 2) {
+			continue;
+		}
+		unsigned short size = be16toh(*((unsigned short*)&(mbdb->data)[offset]));
+		const unsigned char* str = &(mbdb->data)[offset + 2];
+		// broken records are left to the workers to report
+		if (size == 0 || size == 0xFFFF || mbdb->size - offset - 2 < size) {
+			continue;
+		}
+		if (last && size == last_size && !memcmp(str, last, size)) {
+			continue;
+		}
+		if (mbdb_intern_string(mbdb->domains, (const char*) str, size) == NULL) {
+			return -1;
+		}
+		last = str;
+		last_size = size;
+	}
+	return 0;
+}
+
+/* Second phase of a threaded parse: the offset table is complete,
+   each worker decodes a disjoint slice of it into its own arena. */
+static int mbdb_parse_parallel(mbdb_t* mbdb, int threads) {
 	int i = 0;
-	unsigned int count = 0;
+	int failed = 0;
+
+	if (mbdb_parse_domains(mbdb) < 0) {
+		error("Unable to parse mbdb records\n");
+		return -1;
+	}
+
+	mbdb_parse_job_t* jobs = (mbdb_parse_job_t*) calloc(threads, sizeof(mbdb_parse_job_t));
+	if (jobs == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+
+	for (i = 0; i < threads; i++) {
+		jobs[i].mbdb = mbdb;
+		jobs[i].first = (unsigned int) (((unsigned long long) mbdb->num_records * i) / threads);
+		jobs[i].last = (unsigned int) (((unsigned long long) mbdb->num_records * (i + 1)) / threads);
+		jobs[i].borrow = (mbdb->flags & MBDB_OPEN_MAPPED) ? 1 : 0;
+	}
+	// the workers only look domains up, without taking the table's lock
+	mbdb_intern_freeze(mbdb->domains, 1);
+	// the calling thread takes the first slice itself
+	for (i = 1; i < threads; i++) {
+		jobs[i].started = (pthread_create(&jobs[i].thread, NULL, mbdb_parse_worker, &jobs[i]) == 0);
+		if (!jobs[i].started) {
+			mbdb_parse_worker(&jobs[i]);
+		}
+	}
+	mbdb_parse_worker(&jobs[0]);
+
+	for (i = 0; i < threads; i++) {
+		if (jobs[i].started) {
+			pthread_join(jobs[i].thread, NULL);
+		}
+		failed |= jobs[i].failed;
+		mbdb_arena_adopt(mbdb->arena, jobs[i].arena);
+	}
+	mbdb_intern_freeze(mbdb->domains, 0);
+	free(jobs);
+
+	if (failed) {
+		error("Unable to parse mbdb records\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int mbdb_parse_records(mbdb_t* mbdb, const char* file) {
 	unsigned int offset = 0;
+	int borrow = (mbdb->flags & MBDB_OPEN_MAPPED) ? 1 : 0;
+	// threaded parses find all boundaries first and decode afterwards
+	int scan_only = (mbdb->flags & MBDB_OPEN_LAZY) || (mbdb->flags & MBDB_OPEN_THREADS_MASK);
 
+	if (mbdb->size < sizeof(mbdb_header_t)
+	 || memcmp(mbdb->data, MBDB_MAGIC, sizeof(mbdb_header_t)) != 0) {
+		error("Unable to identify this filetype\n");
+		return -1;
+	}
+	offset += sizeof(mbdb_header_t);
+
+	// a current sidecar already knows every boundary, nothing left to scan
+	int sidecar = 0;
+	if (file && (mbdb->flags & MBDB_OPEN_SIDECAR)) {
+		sidecar = (mbdb_sidecar_load(mbdb, file) == 0);
+		if (sidecar) {
+			scan_only = 1;
+			offset = mbdb->size;
+		}
+	}
+
+	mbdb->capacity = sidecar ? (unsigned int) mbdb->num_records : (mbdb->size / 64) + 1;
+	mbdb->records = (mbdb_record_t**)calloc(mbdb->capacity + 1, sizeof(*mbdb->records));
+	if (!sidecar) {
+		mbdb->offsets = (unsigned int*)malloc((mbdb->capacity + 1) * sizeof(*mbdb->offsets));
+		mbdb->num_records = 0;
+	}
+	if(mbdb->records == NULL || mbdb->offsets == NULL) {
+		error("Unable to allocate record table\n");
+		return -1;
+	}
+
+	// mapped records only need room for their structs, copies hold the strings too,
+	// lazy ones only for whatever gets decoded later on
+	size_t arena_size = mbdb->size * 2;
+	if (scan_only) {
+		arena_size = 0;
+	} else if (borrow) {
+		arena_size = mbdb->size;
+	}
+	mbdb->arena = mbdb_arena_create(arena_size);
+	mbdb->domains = mbdb_intern_create();
+	if (mbdb->arena == NULL || mbdb->domains == NULL) {
+		error("Unable to allocate record arena\n");
+		return -1;
+	}
+
+	while (offset < mbdb->size) {
+		if (mbdb->num_records >= (int)mbdb->capacity && mbdb_reserve(mbdb, mbdb->capacity * 2) < 0) {
+			break;
+		}
+
+		int rec_size = 0;
+		if (scan_only) {
+			// only find the boundary, the records are decoded later on
+			rec_size = mbdb_record_scan(&(mbdb->data)[offset], mbdb->size - offset);
+		} else {
+			mbdb_record_t* rec = mbdb_record_parse_interned(mbdb->arena, mbdb->domains, &(mbdb->data)[offset],
+				mbdb->size - offset, borrow);
+			if (rec) {
+				mbdb->records[mbdb->num_records] = rec;
+				rec_size = rec->this_size;
+			} else {
+				rec_size = -1;
+			}
+		}
+		if (rec_size <= 0) {
+			error("Unable to parse record at offset 0x%x!\n", offset);
+			break;
+		}
+		mbdb->offsets[mbdb->num_records++] = offset;
+		offset += rec_size;
+	}
+
+	if (scan_only && !(mbdb->flags & MBDB_OPEN_LAZY)) {
+		int threads = mbdb_parse_threads(mbdb);
+		if (threads > 1) {
+			if (mbdb_parse_parallel(mbdb, threads) < 0) {
+				return -1;
+			}
+		} else {
+			unsigned int i;
+			for (i = 0; i < (unsigned int)mbdb->num_records; i++) {
+				if (mbdb_get_record(mbdb, i) == NULL) {
+					error("Unable to parse record at offset 0x%x!\n", mbdb->offsets[i]);
+					return -1;
+				}
+			}
+		}
+	}
+
+	if (mbdb->flags & MBDB_OPEN_COLUMNS) {
+		mbdb->columns = mbdb_columns_build(mbdb);
+		if (mbdb->columns == NULL) {
+			error("Unable to build columns\n");
+			return -1;
+		}
+	}
+
+	if ((mbdb->flags & MBDB_OPEN_INDEX) && mbdb->index == NULL) {
+		mbdb->index = mbdb_index_build(mbdb);
+		if (mbdb->index == NULL) {
+			error("Unable to build index\n");
+			return -1;
+		}
+	}
+
+	// missing or stale, the next open will find a current one
+	if (file && (mbdb->flags & MBDB_OPEN_SIDECAR) && !sidecar) {
+		mbdb_sidecar_start(mbdb, file);
+	}
+
+	// changes logged since the manifest was last written
+	if (file && (mbdb->flags & MBDB_OPEN_JOURNAL) && mbdb_journal_open(mbdb, file) < 0) {
+		error("Unable to open the journal of %s\n", file);
+		return -1;
+	}
+
+	return 0;
+}
+
+static mbdb_t* mbdb_parse_file(unsigned char* data, unsigned int size, unsigned int flags, const char* file) {
 	mbdb_t* mbdb = NULL;
-	mbdb_header_t* header = NULL;
-	mbdb_record_t* record = NULL;
 
 	mbdb = mbdb_create();
 	if(mbdb == NULL) {
 		error("Unable to create mbdb\n");
 		return NULL;
 	}
+	// the caller keeps its buffer, so there is nothing to map
+	mbdb->flags = flags & ~MBDB_OPEN_MAPPED;
 
-	header = (mbdb_header_t*) data;
-	if(strncmp(header->magic, MBDB_MAGIC, 6) != 0) {
+	if (size < sizeof(mbdb_header_t)) {
 		error("Unable to identify this filetype\n");
+		mbdb_free(mbdb);
 		return NULL;
 	}
 
@@ -60,68 +347,103 @@ mbdb_t* mbdb_parse(unsigned char* data, unsigned int size) {
 	mbdb->header = (mbdb_header_t*)malloc(sizeof(mbdb_header_t));
 	if(mbdb->header == NULL) {
 		error("Allocation error\n");
+		mbdb_free(mbdb);
 		return NULL;
 	}
-	memset(mbdb->header, '\0', sizeof(mbdb_header_t));
-	memcpy(mbdb->header, &data[offset], sizeof(mbdb_header_t));
-	offset += sizeof(mbdb_header_t);
+	memcpy(mbdb->header, data, sizeof(mbdb_header_t));
 
 	mbdb->data = (unsigned char*)malloc(size);
 	if (mbdb->data == NULL) {
 		error("Allocation Error!!\n");
+		mbdb_free(mbdb);
 		return NULL;
 	}
 	memcpy(mbdb->data, data, size);
 	mbdb->size = size;
 
-	size_t records_capacity = (mbdb->size / 64) + 1;
-	mbdb->records = (mbdb_record_t**)malloc(records_capacity * sizeof(*mbdb->records));
-	if(mbdb->records == NULL) {
-		error("Unable to allocate record table\n");
+	if (mbdb_parse_records(mbdb, file) < 0) {
+		mbdb_free(mbdb);
 		return NULL;
 	}
-	mbdb->num_records = 0;
 
-	while (offset < mbdb->size) {
-		if (mbdb->num_records >= (int)records_capacity) {
-			size_t new_capacity = records_capacity * 2;
-			mbdb_record_t** new_records = (mbdb_record_t**)realloc(
-				mbdb->records, new_capacity * sizeof(*mbdb->records));
-			if (!new_records) {
-				error("Unable to grow record table\n");
-				break;
-			}
-			mbdb->records = new_records;
-			records_capacity = new_capacity;
-		}
-		mbdb_record_t* rec = mbdb_record_parse(&(mbdb->data)[offset]);
-		if (!rec) {
-			error("Unable to parse record at offset 0x%x!\n", offset);
-			break;
-		}
-		mbdb->records[mbdb->num_records++] = rec;
-		offset += rec->this_size;
+	return mbdb;
+}
+
+mbdb_t* mbdb_parse_ex(unsigned char* data, unsigned int size, unsigned int flags) {
+	return mbdb_parse_file(data, size, flags, NULL);
+}
+
+mbdb_t* mbdb_parse(unsigned char* data, unsigned int size) {
+	return mbdb_parse_ex(data, size, 0);
+}
+
+static mbdb_t* mbdb_map(const char* file, unsigned int flags) {
+	int fd = -1;
+	struct stat st;
+	void* map = NULL;
+
+	mbdb_t* mbdb = NULL;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		error("Unable to open mbdb file\n");
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(mbdb_header_t) || st.st_size > 0xFFFFFFFFLL) {
+		error("Unable to identify this filetype\n");
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("Unable to map mbdb file\n");
+		return NULL;
+	}
+	madvise(map, st.st_size, (flags & MBDB_OPEN_LAZY) ? MADV_RANDOM : MADV_WILLNEED);
+
+	mbdb = mbdb_create();
+	if (mbdb == NULL) {
+		error("Unable to create mbdb\n");
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	mbdb->flags = flags | MBDB_OPEN_MAPPED;
+	mbdb->data = (unsigned char*) map;
+	mbdb->size = (unsigned int) st.st_size;
+	mbdb->header = (mbdb_header_t*) map;
+
+	if (mbdb_parse_records(mbdb, file) < 0) {
+		error("Unable to parse mbdb file\n");
+		mbdb_free(mbdb);
+		return NULL;
 	}
 
 	return mbdb;
 }
 
-mbdb_t* mbdb_open(unsigned char* file) {
+mbdb_t* mbdb_open_ex(const char* file, unsigned int flags) {
 	int err = 0;
 	unsigned int size = 0;
 	unsigned char* data = NULL;
 
 	mbdb_t* mbdb = NULL;
 
+	if (flags & MBDB_OPEN_MAPPED) {
+		return mbdb_map(file, flags);
+	}
+
 	err = file_read(file, &data, &size);
 	if(err < 0) {
 		error("Unable to read mbdb file\n");
 		return NULL;
 	}
 
-	mbdb = mbdb_parse(data, size);
+	mbdb = mbdb_parse_file(data, size, flags, file);
 	if(mbdb == NULL) {
 		error("Unable to parse mbdb file\n");
+		free(data);
 		return NULL;
 	}
 
@@ -129,6 +451,14 @@ mbdb_t* mbdb_open(unsigned char* file) {
 	return mbdb;
 }
 
+mbdb_t* mbdb_open(unsigned char* file) {
+	return mbdb_open_ex((const char*) file, 0);
+}
+
+mbdb_t* mbdb_open_mapped(const char* file) {
+	return mbdb_open_ex(file, MBDB_OPEN_MAPPED);
+}
+
 mbdb_record_t* mbdb_get_record(mbdb_t* mbdb, unsigned int index)
 {
 	if (!mbdb || !mbdb->records) {
@@ -137,24 +467,864 @@ mbdb_record_t* mbdb_get_record(mbdb_t* mbdb, unsigned int index)
 	if (index >= (unsigned int)mbdb->num_records) {
 		return NULL;
 	}
-	return mbdb->records[index];
+	mbdb_record_t* rec = __atomic_load_n(&mbdb->records[index], __ATOMIC_ACQUIRE);
+	if (rec == NULL && mbdb->offsets[index] != MBDB_OFFSET_NONE) {
+		unsigned int offset = mbdb->offsets[index];
+		rec = mbdb_record_parse_interned(mbdb->arena, mbdb->domains, &(mbdb->data)[offset],
+			mbdb->size - offset, (mbdb->flags & MBDB_OPEN_MAPPED) ? 1 : 0);
+		// lookups on other threads may see it before this returns, see backup_get_file()
+		__atomic_store_n(&mbdb->records[index], rec, __ATOMIC_RELEASE);
+	}
+	return rec;
+}
+
+mbdb_columns_t* mbdb_get_columns(mbdb_t* mbdb)
+{
+	if (!mbdb) {
+		return NULL;
+	}
+	if (mbdb->columns == NULL && mbdb_compact(mbdb) == 0) {
+		mbdb->columns = mbdb_columns_build(mbdb);
+	}
+	return mbdb->columns;
+}
+
+static const char* mbdb_raw_string(const unsigned char* data, unsigned int* offset, unsigned short* size) {
+	const char* str = (const char*) &data[*offset + 2];
+
+	*size = be16toh(*((unsigned short*)&data[*offset]));
+	*offset += 2;
+	if (*size == 0xFFFF) {
+		*size = 0;
+	}
+	*offset += *size;
+	return str;
+}
+
+/* domain and path of a record, from the decoded record if there is one,
+   otherwise straight from the data without decoding it. Sizes of 0xFFFF
+   are reported as 0 and the strings are not NUL terminated. Removed
+   records have an empty key. */
+void mbdb_get_record_key(mbdb_t* mbdb, unsigned int index, const char** domain, unsigned short* domain_size, const char** path, unsigned short* path_size)
+{
+	mbdb_record_t* rec = mbdb->records ? __atomic_load_n(&mbdb->records[index], __ATOMIC_ACQUIRE) : NULL;
+	if (rec) {
+		*domain = rec->domain;
+		*domain_size = (rec->domain_size == 0xFFFF) ? 0 : rec->domain_size;
+		*path = rec->path;
+		*path_size = (rec->path_size == 0xFFFF) ? 0 : rec->path_size;
+	} else if (mbdb->offsets[index] == MBDB_OFFSET_NONE) {
+		// removed
+		*domain = NULL;
+		*domain_size = 0;
+		*path = NULL;
+		*path_size = 0;
+	} else {
+		// mbdb_parse already checked the record bounds when it built the offset table
+		unsigned int offset = 0;
+		const unsigned char* data = &mbdb->data[mbdb->offsets[index]];
+		*domain = mbdb_raw_string(data, &offset, domain_size);
+		*path = mbdb_raw_string(data, &offset, path_size);
+	}
+}
+
+/* inode of a record without decoding it, 0 for removed records */
+unsigned int mbdb_get_record_inode(mbdb_t* mbdb, unsigned int index)
+{
+	mbdb_record_t* rec = mbdb->records ? __atomic_load_n(&mbdb->records[index], __ATOMIC_ACQUIRE) : NULL;
+	if (rec) {
+		return rec->inode;
+	}
+	if (mbdb->offsets[index] == MBDB_OFFSET_NONE) {
+		return 0;
+	}
+	// domain, path, target, datahash and unknown1, then mode and unknown2
+	unsigned int offset = 0;
+	unsigned short size = 0;
+	int i = 0;
+	const unsigned char* data = &mbdb->data[mbdb->offsets[index]];
+	for (i = 0; i < 5; i++) {
+		mbdb_raw_string(data, &offset, &size);
+	}
+	return be32toh(*((unsigned int*)&data[offset + 6]));
+}
+
+mbdb_index_t* mbdb_get_index(mbdb_t* mbdb)
+{
+	if (!mbdb) {
+		return NULL;
+	}
+	if (mbdb->index == NULL && mbdb_compact(mbdb) == 0) {
+		mbdb->index = mbdb_index_build(mbdb);
+	}
+	return mbdb->index;
+}
+
+int mbdb_find_record(mbdb_t* mbdb, const char* domain, const char* path)
+{
+	mbdb_index_t* index = mbdb_get_index(mbdb);
+	if (index == NULL) {
+		return -1;
+	}
+	return mbdb_index_find(index, mbdb, domain, domain ? strlen(domain) : 0, path, path ? strlen(path) : 0);
+}
+
+mbdb_tree_t* mbdb_get_tree(mbdb_t* mbdb)
+{
+	if (!mbdb) {
+		return NULL;
+	}
+	if (mbdb->tree == NULL && mbdb_compact(mbdb) == 0) {
+		mbdb->tree = mbdb_tree_build(mbdb);
+	}
+	return mbdb->tree;
+}
+
+mbdb_names_t* mbdb_get_names(mbdb_t* mbdb)
+{
+	if (!mbdb) {
+		return NULL;
+	}
+	if (mbdb->names == NULL && mbdb_compact(mbdb) == 0) {
+		mbdb->names = mbdb_names_build(mbdb);
+	}
+	return mbdb->names;
+}
+
+/* record stored in the backup file of the given name, the
+   40 hex digits of its hash with or without a directory */
+int mbdb_find_record_by_name(mbdb_t* mbdb, const char* name)
+{
+	unsigned char hash[MBDB_NAME_HASH_SIZE];
+
+	if (mbdb_name_parse(name, hash) < 0) {
+		return -1;
+	}
+	return mbdb_names_find(mbdb_get_names(mbdb), hash);
+}
+
+mbdb_content_t* mbdb_get_content(mbdb_t* mbdb)
+{
+	if (!mbdb) {
+		return NULL;
+	}
+	if (mbdb->content == NULL && mbdb_compact(mbdb) == 0) {
+		mbdb->content = mbdb_content_build(mbdb);
+	}
+	return mbdb->content;
+}
+
+/* State to go back to on mbdb_rollback(). The tables are copied as
+   they were, records replaced or removed since are kept until the
+   commit, records added since are freed on a rollback. */
+struct mbdb_batch_t {
+	mbdb_record_t** records;
+	unsigned int* offsets;
+	int num_records;
+	unsigned int capacity;
+	unsigned int num_deleted;
+	unsigned int edits;
+	int dirty;
+	mbdb_record_t** added;
+	unsigned int num_added;
+	mbdb_record_t** retired;
+	unsigned int num_retired;
+	unsigned int list_capacity;     // of added and retired each
+	size_t journal_mark;            // journal entries after it belong to the batch
+};
+
+/* room to log one more change, so the change itself can't fail half way */
+static int mbdb_batch_reserve(mbdb_t* mbdb) {
+	struct mbdb_batch_t* batch = mbdb->batch;
+	if (batch == NULL || (batch->num_added < batch->list_capacity && batch->num_retired < batch->list_capacity)) {
+		return 0;
+	}
+	unsigned int capacity = batch->list_capacity ? batch->list_capacity * 2 : 64;
+	mbdb_record_t** added = (mbdb_record_t**)realloc(batch->added, capacity * sizeof(mbdb_record_t*));
+	if (added == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	batch->added = added;
+	mbdb_record_t** retired = (mbdb_record_t**)realloc(batch->retired, capacity * sizeof(mbdb_record_t*));
+	if (retired == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	batch->retired = retired;
+	batch->list_capacity = capacity;
+	return 0;
+}
+
+/* a record the table is done with, published snapshots may still read it */
+static void mbdb_release_record(mbdb_t* mbdb, mbdb_record_t* record) {
+	if (mbdb_snapshot_retire(mbdb, record) < 0) {
+		mbdb_record_free(record);
+	}
+}
+
+/* a record leaves the table, inside a batch it may come back */
+static void mbdb_retire_record(mbdb_t* mbdb, mbdb_record_t* record) {
+	if (mbdb->batch) {
+		mbdb->batch->retired[mbdb->batch->num_retired++] = record;
+	} else {
+		mbdb_release_record(mbdb, record);
+	}
+}
+
+static void mbdb_drop_views(mbdb_t* mbdb) {
+	if (mbdb->columns) {
+		mbdb_columns_free(mbdb->columns);
+		mbdb->columns = NULL;
+	}
+	if (mbdb->tree) {
+		mbdb_tree_free(mbdb->tree);
+		mbdb->tree = NULL;
+	}
+	if (mbdb->names) {
+		mbdb_names_free(mbdb->names);
+		mbdb->names = NULL;
+	}
+	if (mbdb->content) {
+		mbdb_content_free(mbdb->content);
+		mbdb->content = NULL;
+	}
+}
+
+/* whole-table views are dropped on every change, the next
+   mbdb_get_*() call builds them again. The index is kept. */
+static void mbdb_changed(mbdb_t* mbdb) {
+	mbdb_drop_views(mbdb);
+	mbdb->edits++;
+	mbdb->dirty = 1;
+}
+
+/* Replaces the record at index with the given one, which the mbdb
+   owns from then on. The record must not be part of any mbdb yet. */
+int mbdb_replace_record(mbdb_t* mbdb, unsigned int index, mbdb_record_t* record)
+{
+	if (!mbdb || !record || index >= (unsigned int)mbdb->num_records) {
+		return -1;
+	}
+	if (mbdb->records[index] == NULL && mbdb->offsets[index] == MBDB_OFFSET_NONE) {
+		return -1;
+	}
+	if (mbdb_batch_reserve(mbdb) < 0) {
+		return -1;
+	}
+	if (mbdb_journal_log(mbdb, MBDB_JOURNAL_UPDATE, index, record) < 0) {
+		return -1;
+	}
+	if (mbdb->index) {
+		mbdb_index_remove(mbdb->index, mbdb, index);
+	}
+	if (mbdb->records[index]) {
+		mbdb_retire_record(mbdb, mbdb->records[index]);
+	}
+	if (mbdb->batch) {
+		mbdb->batch->added[mbdb->batch->num_added++] = record;
+	}
+	mbdb->records[index] = record;
+	mbdb->offsets[index] = MBDB_OFFSET_NONE;
+	if (mbdb->index) {
+		mbdb_index_insert(mbdb->index, mbdb, index);
+	}
+	mbdb_changed(mbdb);
+	return 0;
+}
+
+/* Appends the given record, which the mbdb owns from then on.
+   Returns its index. */
+int mbdb_insert_record(mbdb_t* mbdb, mbdb_record_t* record)
+{
+	if (!mbdb || !record || !mbdb->records) {
+		return -1;
+	}
+	if (mbdb->num_records >= (int)mbdb->capacity && mbdb_reserve(mbdb, mbdb->capacity * 2 + 1) < 0) {
+		return -1;
+	}
+	if (mbdb_batch_reserve(mbdb) < 0) {
+		return -1;
+	}
+	if (mbdb_journal_log(mbdb, MBDB_JOURNAL_INSERT, 0, record) < 0) {
+		return -1;
+	}
+	if (mbdb->batch) {
+		mbdb->batch->added[mbdb->batch->num_added++] = record;
+	}
+	unsigned int index = (unsigned int)mbdb->num_records++;
+	mbdb->records[index] = record;
+	mbdb->offsets[index] = MBDB_OFFSET_NONE;
+	if (mbdb->index) {
+		mbdb_index_insert(mbdb->index, mbdb, index);
+	}
+	mbdb_changed(mbdb);
+	return (int)index;
+}
+
+/* Frees the record at index and leaves a hole in its place, so the
+   other records keep their index until mbdb_compact(). */
+int mbdb_remove_record(mbdb_t* mbdb, unsigned int index)
+{
+	if (!mbdb || index >= (unsigned int)mbdb->num_records) {
+		return -1;
+	}
+	if (mbdb->records[index] == NULL && mbdb->offsets[index] == MBDB_OFFSET_NONE) {
+		return -1;
+	}
+	if (mbdb_batch_reserve(mbdb) < 0) {
+		return -1;
+	}
+	if (mbdb_journal_log(mbdb, MBDB_JOURNAL_REMOVE, index, NULL) < 0) {
+		return -1;
+	}
+	if (mbdb->index) {
+		mbdb_index_remove(mbdb->index, mbdb, index);
+	}
+	if (mbdb->records[index]) {
+		mbdb_retire_record(mbdb, mbdb->records[index]);
+		mbdb->records[index] = NULL;
+	}
+	mbdb->offsets[index] = MBDB_OFFSET_NONE;
+	mbdb->num_deleted++;
+	mbdb_changed(mbdb);
+	return 0;
+}
+
+/* Closes the holes left by removed records. The records after each
+   hole move down, the index follows them. */
+int mbdb_compact(mbdb_t* mbdb)
+{
+	unsigned int i = 0;
+	unsigned int count = 0;
+
+	if (!mbdb) {
+		return -1;
+	}
+	if (mbdb->num_deleted == 0) {
+		return 0;
+	}
+	unsigned int* remap = (unsigned int*)malloc(mbdb->num_records * sizeof(unsigned int));
+	if (remap == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	for (i = 0; i < (unsigned int)mbdb->num_records; i++) {
+		if (mbdb->records[i] == NULL && mbdb->offsets[i] == MBDB_OFFSET_NONE) {
+			remap[i] = MBDB_OFFSET_NONE;
+			continue;
+		}
+		mbdb->records[count] = mbdb->records[i];
+		mbdb->offsets[count] = mbdb->offsets[i];
+		remap[i] = count++;
+	}
+	memset(&mbdb->records[count], '\0', (mbdb->num_records - count) * sizeof(*mbdb->records));
+	if (mbdb->index) {
+		mbdb_index_remap(mbdb->index, remap);
+	}
+	free(remap);
+
+	mbdb->num_records = (int)count;
+	mbdb->num_deleted = 0;
+	return 0;
+}
+
+typedef struct mbdb_serialize_job_t {
+	mbdb_t* mbdb;
+	unsigned char* data;
+	const unsigned int* starts;     // where each record goes in data
+	unsigned int first;
+	unsigned int last;
+	pthread_t thread;
+	int started;
+	int failed;
+} mbdb_serialize_job_t;
+
+static void* mbdb_serialize_worker(void* arg) {
+	mbdb_serialize_job_t* job = (mbdb_serialize_job_t*) arg;
+	mbdb_t* mbdb = job->mbdb;
+	unsigned int i = 0;
+
+	for (i = job->first; i < job->last; i++) {
+		unsigned int size = job->starts[i + 1] - job->starts[i];
+		if (mbdb->offsets[i] != MBDB_OFFSET_NONE) {
+			memcpy(&job->data[job->starts[i]], &mbdb->data[mbdb->offsets[i]], size);
+		} else if (mbdb->records[i]) {
+			if (mbdb_record_serialize_into(mbdb->records[i], &job->data[job->starts[i]], size) != (int) size) {
+				job->failed = 1;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Serializes the records as they are now into one buffer, with the given
+   number of threads (0 for one per online CPU). Records that still match
+   the data are copied from it, changed ones are serialized in place. The
+   size of every record is known up front, so each thread writes its slice
+   at its final offset and nothing is allocated per record. */
+int mbdb_serialize(mbdb_t* mbdb, unsigned char** data, unsigned int* size, int threads)
+{
+	unsigned int i = 0;
+	int failed = 0;
+	unsigned long long total = sizeof(mbdb_header_t);
+
+	if (!mbdb || !data || !size || !mbdb->records) {
+		return -1;
+	}
+	unsigned int* starts = (unsigned int*)malloc((mbdb->num_records + 1) * sizeof(unsigned int));
+	if (starts == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	for (i = 0; i < (unsigned int)mbdb->num_records && total <= 0xFFFFFFFFULL; i++) {
+		starts[i] = (unsigned int)total;
+		if (mbdb->records[i]) {
+			total += mbdb->records[i]->this_size;
+		} else if (mbdb->offsets[i] != MBDB_OFFSET_NONE) {
+			int rec_size = mbdb_record_scan(&mbdb->data[mbdb->offsets[i]], mbdb->size - mbdb->offsets[i]);
+			if (rec_size <= 0) {
+				error("Unable to parse record at offset 0x%x!\n", mbdb->offsets[i]);
+				free(starts);
+				return -1;
+			}
+			total += rec_size;
+		}
+	}
+	if (total > 0xFFFFFFFFULL) {
+		error("mbdb too large\n");
+		free(starts);
+		return -1;
+	}
+	starts[mbdb->num_records] = (unsigned int)total;
+
+	unsigned char* buf = (unsigned char*)malloc(total);
+	threads = mbdb_limit_threads(mbdb, threads);
+	mbdb_serialize_job_t* jobs = (mbdb_serialize_job_t*)calloc(threads, sizeof(mbdb_serialize_job_t));
+	if (buf == NULL || jobs == NULL) {
+		error("Allocation Error!\n");
+		free(buf);
+		free(jobs);
+		free(starts);
+		return -1;
+	}
+	memcpy(buf, MBDB_MAGIC, sizeof(mbdb_header_t));
+
+	for (i = 0; i < (unsigned int)threads; i++) {
+		jobs[i].mbdb = mbdb;
+		jobs[i].data = buf;
+		jobs[i].starts = starts;
+		jobs[i].first = (unsigned int) (((unsigned long long) mbdb->num_records * i) / threads);
+		jobs[i].last = (unsigned int) (((unsigned long long) mbdb->num_records * (i + 1)) / threads);
+	}
+	// the calling thread takes the first slice itself
+	for (i = 1; i < (unsigned int)threads; i++) {
+		jobs[i].started = (pthread_create(&jobs[i].thread, NULL, mbdb_serialize_worker, &jobs[i]) == 0);
+		if (!jobs[i].started) {
+			mbdb_serialize_worker(&jobs[i]);
+		}
+	}
+	mbdb_serialize_worker(&jobs[0]);
+	for (i = 0; i < (unsigned int)threads; i++) {
+		if (jobs[i].started) {
+			pthread_join(jobs[i].thread, NULL);
+		}
+		failed |= jobs[i].failed;
+	}
+	free(jobs);
+	free(starts);
+
+	if (failed) {
+		error("Unable to serialize mbdb records\n");
+		free(buf);
+		return -1;
+	}
+	*data = buf;
+	*size = (unsigned int)total;
+	return 0;
+}
+
+/* mbdb_serialize() with the threads the mbdb was opened with */
+int mbdb_build(mbdb_t* mbdb, unsigned char** data, unsigned int* size)
+{
+	if (!mbdb) {
+		return -1;
+	}
+	return mbdb_serialize(mbdb, data, size, mbdb_parse_threads(mbdb));
+}
+
+#define MBDB_WRITE_IOV   1024     // pieces handed to one writev()
+#define MBDB_WRITE_STAGE 0x100000 // room for changed records serialized before they are written
+
+typedef struct mbdb_writer_t {
+	int fd;
+	struct iovec iov[MBDB_WRITE_IOV];
+	int count;
+	unsigned char* stage;           // changed records, serialized
+	size_t stage_used;
+	size_t stage_size;
+} mbdb_writer_t;
+
+static int mbdb_writer_flush(mbdb_writer_t* writer) {
+	struct iovec* iov = writer->iov;
+	int count = writer->count;
+
+	while (count > 0) {
+		ssize_t n = writev(writer->fd, iov, count);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		// a short write ends somewhere inside the pieces, go on from there
+		while (count > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (unsigned char*) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	writer->count = 0;
+	writer->stage_used = 0;
+	return 0;
+}
+
+static int mbdb_writer_add(mbdb_writer_t* writer, const void* data, size_t size) {
+	if (writer->count == MBDB_WRITE_IOV && mbdb_writer_flush(writer) < 0) {
+		return -1;
+	}
+	writer->iov[writer->count].iov_base = (void*) data;
+	writer->iov[writer->count].iov_len = size;
+	writer->count++;
+	return 0;
+}
+
+static int mbdb_writer_add_record(mbdb_writer_t* writer, mbdb_record_t* record) {
+	// flushed first when full, the stage is reused from its start then
+	if (writer->count == MBDB_WRITE_IOV || writer->stage_used + record->this_size > writer->stage_size) {
+		if (mbdb_writer_flush(writer) < 0) {
+			return -1;
+		}
+		// only ever grows for a record bigger than all of it
+		if (record->this_size > writer->stage_size) {
+			unsigned char* stage = (unsigned char*)realloc(writer->stage, record->this_size);
+			if (stage == NULL) {
+				error("Allocation Error!\n");
+				return -1;
+			}
+			writer->stage = stage;
+			writer->stage_size = record->this_size;
+		}
+	}
+	unsigned char* cursor = &writer->stage[writer->stage_used];
+	int written = mbdb_record_serialize_into(record, cursor, writer->stage_size - writer->stage_used);
+	if (written < 0) {
+		return -1;
+	}
+	writer->stage_used += written;
+	return mbdb_writer_add(writer, cursor, written);
+}
+
+static int mbdb_writer_records(mbdb_t* mbdb, mbdb_writer_t* writer) {
+	unsigned int i = 0;
+	unsigned int span_start = 0;
+	unsigned int span_end = 0;
+
+	if (mbdb_writer_add(writer, MBDB_MAGIC, sizeof(mbdb_header_t)) < 0) {
+		return -1;
+	}
+	for (i = 0; i < (unsigned int)mbdb->num_records; i++) {
+		unsigned int offset = mbdb->offsets[i];
+		if (offset != MBDB_OFFSET_NONE) {
+			int rec_size = mbdb_record_scan(&mbdb->data[offset], mbdb->size - offset);
+			if (rec_size <= 0) {
+				error("Unable to parse record at offset 0x%x!\n", offset);
+				return -1;
+			}
+			// unchanged neighbours in the data go out as one piece
+			if (span_end != offset) {
+				if (span_end > span_start && mbdb_writer_add(writer, &mbdb->data[span_start], span_end - span_start) < 0) {
+					return -1;
+				}
+				span_start = offset;
+			}
+			span_end = offset + rec_size;
+		} else if (mbdb->records[i]) {
+			if (span_end > span_start && mbdb_writer_add(writer, &mbdb->data[span_start], span_end - span_start) < 0) {
+				return -1;
+			}
+			span_start = span_end = 0;
+			if (mbdb_writer_add_record(writer, mbdb->records[i]) < 0) {
+				return -1;
+			}
+		}
+	}
+	if (span_end > span_start && mbdb_writer_add(writer, &mbdb->data[span_start], span_end - span_start) < 0) {
+		return -1;
+	}
+	return mbdb_writer_flush(writer);
+}
+
+/* the rename is only durable once the directory is */
+static int mbdb_sync_dir(const char* file) {
+	char* dir = strdup(file);
+	if (dir == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	char* slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else if (slash == dir) {
+		slash[1] = '\0';
+	} else {
+		*slash = '\0';
+	}
+	int res = -1;
+	int fd = open(dir, O_RDONLY);
+	if (fd >= 0) {
+		res = fsync(fd);
+		close(fd);
+	}
+	free(dir);
+	return res;
+}
+
+/* Streams the records into a temporary file next to file, unchanged
+   ones straight from the data, and renames it over file once it is on
+   the disk. A crash leaves either the old file or the new one. */
+int mbdb_write(mbdb_t* mbdb, const char* file)
+{
+	if (!mbdb || !file || !mbdb->records) {
+		return -1;
+	}
+	char* temp = (char*)malloc(strlen(file) + 8);
+	mbdb_writer_t* writer = (mbdb_writer_t*)calloc(1, sizeof(mbdb_writer_t));
+	unsigned char* stage = (unsigned char*)malloc(MBDB_WRITE_STAGE);
+	if (temp == NULL || writer == NULL || stage == NULL) {
+		error("Allocation Error!\n");
+		free(temp);
+		free(writer);
+		free(stage);
+		return -1;
+	}
+	writer->stage = stage;
+	writer->stage_size = MBDB_WRITE_STAGE;
+	strcpy(temp, file);
+	strcat(temp, ".XXXXXX");
+
+	int res = -1;
+	writer->fd = mkstemp(temp);
+	if (writer->fd >= 0) {
+		/* mkstemp() creates the file 0600, keep the mode of the
+		   file being replaced */
+		struct stat st;
+		fchmod(writer->fd, (stat(file, &st) == 0) ? (st.st_mode & 07777) : 0644);
+		if (mbdb_writer_records(mbdb, writer) == 0 && fsync(writer->fd) == 0) {
+			res = 0;
+		}
+		if (close(writer->fd) < 0) {
+			res = -1;
+		}
+		if (res == 0 && rename(temp, file) < 0) {
+			res = -1;
+		}
+		if (res < 0) {
+			unlink(temp);
+		}
+	}
+	if (res < 0) {
+		error("Unable to write %s\n", file);
+	} else {
+		mbdb_sync_dir(file);
+	}
+
+	free(writer->stage);
+	free(writer);
+	free(temp);
+	return res;
+}
+
+/* Starts a batch of changes, mbdb_rollback() undoes all of them
+   at once. Costs a copy of the record and offset tables. */
+int mbdb_begin(mbdb_t* mbdb)
+{
+	if (!mbdb || !mbdb->records || mbdb->batch) {
+		return -1;
+	}
+	struct mbdb_batch_t* batch = (struct mbdb_batch_t*)calloc(1, sizeof(struct mbdb_batch_t));
+	if (batch == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	batch->records = (mbdb_record_t**)malloc((mbdb->capacity + 1) * sizeof(*mbdb->records));
+	batch->offsets = (unsigned int*)malloc((mbdb->capacity + 1) * sizeof(*mbdb->offsets));
+	if (batch->records == NULL || batch->offsets == NULL) {
+		error("Allocation Error!\n");
+		free(batch->records);
+		free(batch->offsets);
+		free(batch);
+		return -1;
+	}
+	memcpy(batch->records, mbdb->records, (mbdb->capacity + 1) * sizeof(*mbdb->records));
+	memcpy(batch->offsets, mbdb->offsets, mbdb->num_records * sizeof(*mbdb->offsets));
+	batch->num_records = mbdb->num_records;
+	batch->capacity = mbdb->capacity;
+	batch->num_deleted = mbdb->num_deleted;
+	batch->edits = mbdb->edits;
+	batch->dirty = mbdb->dirty;
+	batch->journal_mark = mbdb_journal_mark(mbdb);
+	mbdb->batch = batch;
+	return 0;
+}
+
+static void mbdb_batch_free(struct mbdb_batch_t* batch) {
+	free(batch->records);
+	free(batch->offsets);
+	free(batch->added);
+	free(batch->retired);
+	free(batch);
+}
+
+/* keeps the changes of the batch, the records they replaced are released */
+int mbdb_commit(mbdb_t* mbdb)
+{
+	unsigned int i = 0;
+
+	if (!mbdb || !mbdb->batch) {
+		return -1;
+	}
+	for (i = 0; i < mbdb->batch->num_retired; i++) {
+		mbdb_release_record(mbdb, mbdb->batch->retired[i]);
+	}
+	mbdb_batch_free(mbdb->batch);
+	mbdb->batch = NULL;
+	return 0;
+}
+
+/* puts the tables back the way they were at mbdb_begin() */
+int mbdb_rollback(mbdb_t* mbdb)
+{
+	unsigned int i = 0;
+
+	if (!mbdb || !mbdb->batch) {
+		return -1;
+	}
+	struct mbdb_batch_t* batch = mbdb->batch;
+	for (i = 0; i < batch->num_added; i++) {
+		mbdb_record_free(batch->added[i]);
+	}
+	// records decoded meanwhile are still good, the offset tells it's the same one
+	for (i = 0; i < (unsigned int)batch->num_records && i < (unsigned int)mbdb->num_records; i++) {
+		if (batch->records[i] == NULL && batch->offsets[i] != MBDB_OFFSET_NONE
+		 && mbdb->offsets[i] == batch->offsets[i]) {
+			batch->records[i] = mbdb->records[i];
+		}
+	}
+	free(mbdb->records);
+	free(mbdb->offsets);
+	mbdb->records = batch->records;
+	mbdb->offsets = batch->offsets;
+	mbdb->num_records = batch->num_records;
+	mbdb->capacity = batch->capacity;
+	mbdb->num_deleted = batch->num_deleted;
+	mbdb->edits = batch->edits;
+	mbdb->dirty = batch->dirty;
+	batch->records = NULL;
+	batch->offsets = NULL;
+
+	// the index followed the changes, it is built again on the next lookup
+	if (mbdb->index) {
+		mbdb_index_free(mbdb->index);
+		mbdb->index = NULL;
+	}
+	mbdb_drop_views(mbdb);
+	mbdb_journal_discard(mbdb, batch->journal_mark);
+
+	mbdb_batch_free(batch);
+	mbdb->batch = NULL;
+	return 0;
+}
+
+void mbdb_get_arena_stats(mbdb_t* mbdb, mbdb_arena_stats_t* stats)
+{
+	mbdb_arena_get_stats(mbdb ? mbdb->arena : NULL, stats);
+}
+
+const char* mbdb_find_domain(mbdb_t* mbdb, const char* domain) {
+	if (!mbdb || !domain) {
+		return NULL;
+	}
+	return mbdb_intern_find(mbdb->domains, domain, strlen(domain));
+}
+
+unsigned int mbdb_get_num_domains(mbdb_t* mbdb) {
+	return mbdb ? mbdb_intern_count(mbdb->domains) : 0;
+}
+
+const char* mbdb_get_domain(mbdb_t* mbdb, unsigned int index) {
+	return mbdb ? mbdb_intern_get(mbdb->domains, index, NULL) : NULL;
 }
 
 void mbdb_free(mbdb_t* mbdb) {
 	if(mbdb) {
-		if(mbdb->header) {
+		// the background writer still reads the data
+		mbdb_sidecar_wait(mbdb);
+		if (mbdb->batch) {
+			mbdb_rollback(mbdb);
+		}
+		if(mbdb->header && !(mbdb->flags & MBDB_OPEN_MAPPED)) {
 			free(mbdb->header);
 			mbdb->header = NULL;
 		}
+		// before the records, the versions share them
+		mbdb_snapshot_free_all(mbdb);
 		if(mbdb->records) {
 			int i;
 			for (i = 0; i < mbdb->num_records; i++) {
-				mbdb_record_free(mbdb->records[i]);
+				if (mbdb->records[i]) {
+					mbdb_record_free(mbdb->records[i]);
+				}
 			}
 			free(mbdb->records);
 		}
+		if(mbdb->offsets) {
+			free(mbdb->offsets);
+		}
+		if(mbdb->columns) {
+			mbdb_columns_free(mbdb->columns);
+		}
+		if(mbdb->index) {
+			mbdb_index_free(mbdb->index);
+		}
+		if(mbdb->tree) {
+			mbdb_tree_free(mbdb->tree);
+		}
+		if(mbdb->names) {
+			mbdb_names_free(mbdb->names);
+		}
+		if(mbdb->content) {
+			mbdb_content_free(mbdb->content);
+		}
+		if(mbdb->domains) {
+			mbdb_intern_free(mbdb->domains);
+		}
+		if(mbdb->arena) {
+			mbdb_arena_free(mbdb->arena);
+		}
+		mbdb_sidecar_close(mbdb);
+		mbdb_journal_close(mbdb);
 		if(mbdb->data) {
-			free(mbdb->data);
+			if (mbdb->flags & MBDB_OPEN_MAPPED) {
+				munmap(mbdb->data, mbdb->size);
+			} else {
+				free(mbdb->data);
+			}
 		}
 		free(mbdb);
 	}
@@ -0,0 +1,167 @@
+/**
+  * libmbdb-1.0 - mbdb_arena.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb_arena.h>
+#include <libcrippy-1.0/debug.h>
+
+#define MBDB_ARENA_ALIGN(x) (((x) + 7) & ~((size_t)7))
+
+static mbdb_arena_chunk_t* mbdb_arena_chunk_new(mbdb_arena_t* arena, size_t size) {
+	mbdb_arena_chunk_t* chunk = (mbdb_arena_chunk_t*) malloc(sizeof(mbdb_arena_chunk_t) + size);
+	if (chunk == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	chunk->next = arena->chunk;
+	chunk->size = size;
+	chunk->used = 0;
+	arena->chunk = chunk;
+	arena->stats.reserved += size;
+	arena->stats.chunks++;
+	return chunk;
+}
+
+mbdb_arena_t* mbdb_arena_create(size_t size_hint) {
+	mbdb_arena_t* arena = (mbdb_arena_t*) malloc(sizeof(mbdb_arena_t));
+	if (arena == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(arena, '\0', sizeof(mbdb_arena_t));
+
+	// one chunk sized from the hint usually holds the whole manifest
+	arena->next_size = MBDB_ARENA_ALIGN(size_hint);
+	if (arena->next_size < MBDB_ARENA_MIN_CHUNK) {
+		arena->next_size = MBDB_ARENA_MIN_CHUNK;
+	}
+	return arena;
+}
+
+void* mbdb_arena_alloc(mbdb_arena_t* arena, size_t size) {
+	mbdb_arena_chunk_t* chunk = NULL;
+	void* ptr = NULL;
+
+	if (!arena) {
+		return NULL;
+	}
+	size = MBDB_ARENA_ALIGN(size);
+
+	chunk = arena->chunk;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = arena->next_size;
+		while (chunk_size < size) {
+			chunk_size *= 2;
+		}
+		chunk = mbdb_arena_chunk_new(arena, chunk_size);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		arena->next_size = chunk_size * 2;
+	}
+
+	ptr = (unsigned char*) (chunk + 1) + chunk->used;
+	chunk->used += size;
+	arena->stats.used += size;
+	arena->stats.allocations++;
+	return ptr;
+}
+
+char* mbdb_arena_memdup(mbdb_arena_t* arena, const void* data, size_t size, int terminate) {
+	char* copy = (char*) mbdb_arena_alloc(arena, size + (terminate ? 1 : 0));
+	if (copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, data, size);
+	if (terminate) {
+		copy[size] = 0;
+	}
+	return copy;
+}
+
+void mbdb_arena_adopt(mbdb_arena_t* arena, mbdb_arena_t* other) {
+	if (!arena || !other) {
+		return;
+	}
+
+	if (other->chunk) {
+		// slot the chunks in behind the current one, which keeps serving allocations
+		mbdb_arena_chunk_t* tail = other->chunk;
+		while (tail->next) {
+			tail = tail->next;
+		}
+		if (arena->chunk) {
+			tail->next = arena->chunk->next;
+			arena->chunk->next = other->chunk;
+		} else {
+			arena->chunk = other->chunk;
+		}
+	}
+	arena->stats.reserved += other->stats.reserved;
+	arena->stats.used += other->stats.used;
+	arena->stats.chunks += other->stats.chunks;
+	arena->stats.allocations += other->stats.allocations;
+	free(other);
+}
+
+void mbdb_arena_reset(mbdb_arena_t* arena) {
+	if (!arena || !arena->chunk) {
+		return;
+	}
+
+	// keep the newest (and largest) chunk around for the next round
+	mbdb_arena_chunk_t* chunk = arena->chunk->next;
+	while (chunk) {
+		mbdb_arena_chunk_t* next = chunk->next;
+		arena->stats.reserved -= chunk->size;
+		arena->stats.chunks--;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunk->next = NULL;
+	arena->chunk->used = 0;
+	arena->stats.used = 0;
+	arena->stats.allocations = 0;
+}
+
+void mbdb_arena_get_stats(mbdb_arena_t* arena, mbdb_arena_stats_t* stats) {
+	if (!stats) {
+		return;
+	}
+	if (!arena) {
+		memset(stats, '\0', sizeof(mbdb_arena_stats_t));
+		return;
+	}
+	memcpy(stats, &arena->stats, sizeof(mbdb_arena_stats_t));
+}
+
+void mbdb_arena_free(mbdb_arena_t* arena) {
+	if (arena) {
+		mbdb_arena_chunk_t* chunk = arena->chunk;
+		while (chunk) {
+			mbdb_arena_chunk_t* next = chunk->next;
+			free(chunk);
+			chunk = next;
+		}
+		free(arena);
+	}
+}
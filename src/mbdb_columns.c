@@ -0,0 +1,401 @@
+/**
+  * libmbdb-1.0 - mbdb_columns.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_columns.h>
+
+#include <libcrippy-1.0/debug.h>
+#include <libcrippy-1.0/endianness.h>
+
+static void mbdb_columns_set_record(mbdb_columns_t* columns, unsigned int i, const mbdb_record_t* record) {
+	columns->mode[i] = record->mode;
+	columns->inode[i] = record->inode;
+	columns->uid[i] = record->uid;
+	columns->gid[i] = record->gid;
+	columns->time1[i] = record->time1;
+	columns->time2[i] = record->time2;
+	columns->time3[i] = record->time3;
+	columns->length[i] = record->length;
+	columns->flag[i] = record->flag;
+	if (record->datahash && record->datahash_size == MBDB_COLUMNS_HASH_SIZE) {
+		memcpy(&columns->datahash[i * MBDB_COLUMNS_HASH_SIZE], record->datahash, MBDB_COLUMNS_HASH_SIZE);
+	}
+	columns->domain[i] = record->domain;
+	columns->domain_size[i] = record->domain_size;
+	columns->path[i] = record->path;
+	columns->path_size[i] = record->path_size;
+	columns->target[i] = record->target;
+	columns->target_size[i] = record->target_size;
+}
+
+static const unsigned char* mbdb_columns_string(const unsigned char* data, unsigned int* offset, unsigned short* size) {
+	const unsigned char* str = NULL;
+
+	*size = be16toh(*((unsigned short*)&data[*offset]));
+	*offset += 2;
+	if (*size != 0 && *size != 0xFFFF) {
+		str = &data[*offset];
+		*offset += *size;
+	}
+	return str;
+}
+
+static void mbdb_columns_set_raw(mbdb_columns_t* columns, unsigned int i, const unsigned char* data) {
+	unsigned int offset = 0;
+	unsigned short size = 0;
+
+	// mbdb_parse already checked the record bounds when it built the offset table
+	columns->domain[i] = (const char*) mbdb_columns_string(data, &offset, &size);
+	columns->domain_size[i] = size;
+	columns->path[i] = (const char*) mbdb_columns_string(data, &offset, &size);
+	columns->path_size[i] = size;
+	columns->target[i] = (const char*) mbdb_columns_string(data, &offset, &size);
+	columns->target_size[i] = size;
+	const unsigned char* hash = mbdb_columns_string(data, &offset, &size);
+	if (hash && size == MBDB_COLUMNS_HASH_SIZE) {
+		memcpy(&columns->datahash[i * MBDB_COLUMNS_HASH_SIZE], hash, MBDB_COLUMNS_HASH_SIZE);
+	}
+	mbdb_columns_string(data, &offset, &size);
+
+	columns->mode[i] = be16toh(*((unsigned short*) &data[offset]));
+	offset += 2 + 4;
+	columns->inode[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->uid[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->gid[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->time1[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->time2[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->time3[i] = be32toh(*((unsigned int*) &data[offset]));
+	offset += 4;
+	columns->length[i] = be64toh(*((unsigned long long*) &data[offset]));
+	offset += 8;
+	columns->flag[i] = data[offset];
+}
+
+static unsigned short mbdb_columns_domain_size(unsigned short size) {
+	return (size == 0xFFFF) ? 0 : size;
+}
+
+static int mbdb_columns_compare(const char* a, unsigned short a_size, const char* b, unsigned short b_size) {
+	int res = memcmp(a, b, (a_size < b_size) ? a_size : b_size);
+	if (res == 0) {
+		res = (int) a_size - (int) b_size;
+	}
+	return res;
+}
+
+typedef struct mbdb_columns_domain_t {
+	const char* domain;
+	unsigned short size;
+	unsigned int id;                  // in the order they were seen
+} mbdb_columns_domain_t;
+
+static int mbdb_columns_compare_domains(const void* p1, const void* p2) {
+	const mbdb_columns_domain_t* a = (const mbdb_columns_domain_t*) p1;
+	const mbdb_columns_domain_t* b = (const mbdb_columns_domain_t*) p2;
+	return mbdb_columns_compare(a->domain, a->size, b->domain, b->size);
+}
+
+static unsigned int mbdb_columns_hash(const char* str, unsigned short size) {
+	unsigned int i = 0;
+	unsigned int hash = 2166136261u;
+	for (i = 0; i < size; i++) {
+		hash = (hash ^ (unsigned char) str[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* slots of a table with mask + 1 of them, for the domains seen so far */
+static unsigned int* mbdb_columns_domain_table(const mbdb_columns_domain_t* domains, unsigned int count, unsigned int mask) {
+	unsigned int i = 0;
+	unsigned int* slots = (unsigned int*) malloc((mask + 1) * sizeof(unsigned int));
+	if (slots == NULL) {
+		return NULL;
+	}
+	memset(slots, 0xFF, (mask + 1) * sizeof(unsigned int));
+	for (i = 0; i < count; i++) {
+		unsigned int slot = mbdb_columns_hash(domains[i].domain, domains[i].size) & mask;
+		while (slots[slot] != ~0U) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = i;
+	}
+	return slots;
+}
+
+/* Numbers the distinct domains in sorted order. Each record's domain is
+   looked up by its bytes among the ones seen so far, then the ids are
+   renumbered by rank. */
+static int mbdb_columns_number_domains(mbdb_columns_t* columns) {
+	unsigned int i = 0;
+	unsigned int count = 0;
+	unsigned int capacity = 64;
+	unsigned int mask = 2 * capacity - 1;
+	mbdb_columns_domain_t* domains = (mbdb_columns_domain_t*) malloc(capacity * sizeof(mbdb_columns_domain_t));
+	unsigned int* slots = mbdb_columns_domain_table(domains, 0, mask);
+	if (!domains || !slots) {
+		free(domains);
+		free(slots);
+		return -1;
+	}
+
+	for (i = 0; i < columns->count; i++) {
+		const char* domain = columns->domain[i] ? columns->domain[i] : "";
+		unsigned short size = mbdb_columns_domain_size(columns->domain_size[i]);
+		unsigned int slot = mbdb_columns_hash(domain, size) & mask;
+		while (slots[slot] != ~0U
+		 && mbdb_columns_compare(domains[slots[slot]].domain, domains[slots[slot]].size, domain, size)) {
+			slot = (slot + 1) & mask;
+		}
+		if (slots[slot] != ~0U) {
+			columns->domain_id[i] = slots[slot];
+			continue;
+		}
+		if (count == capacity) {
+			// the table stays at most half full
+			mbdb_columns_domain_t* larger = (mbdb_columns_domain_t*) realloc(domains, capacity * 2 * sizeof(mbdb_columns_domain_t));
+			unsigned int* table = larger ? mbdb_columns_domain_table(larger, count, mask * 2 + 1) : NULL;
+			if (table == NULL) {
+				free(larger ? larger : domains);
+				free(slots);
+				return -1;
+			}
+			domains = larger;
+			free(slots);
+			slots = table;
+			capacity *= 2;
+			mask = mask * 2 + 1;
+			slot = mbdb_columns_hash(domain, size) & mask;
+			while (slots[slot] != ~0U) {
+				slot = (slot + 1) & mask;
+			}
+		}
+		domains[count].domain = domain;
+		domains[count].size = size;
+		domains[count].id = count;
+		slots[slot] = count;
+		columns->domain_id[i] = count++;
+	}
+	free(slots);
+
+	qsort(domains, count, sizeof(mbdb_columns_domain_t), mbdb_columns_compare_domains);
+	unsigned int* rank = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->unique_domain = (const char**) malloc(count * sizeof(const char*) + 1);
+	columns->unique_domain_size = (unsigned short*) malloc(count * sizeof(unsigned short) + 1);
+	if (!rank || !columns->unique_domain || !columns->unique_domain_size) {
+		free(rank);
+		free(domains);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		rank[domains[i].id] = i;
+		columns->unique_domain[i] = domains[i].domain;
+		columns->unique_domain_size[i] = domains[i].size;
+	}
+	for (i = 0; i < columns->count; i++) {
+		columns->domain_id[i] = rank[columns->domain_id[i]];
+	}
+	columns->num_domains = count;
+	free(rank);
+	free(domains);
+	return 0;
+}
+
+mbdb_columns_t* mbdb_columns_build(mbdb_t* mbdb) {
+	unsigned int i = 0;
+	unsigned int count = 0;
+
+	if (!mbdb || mbdb->num_records < 0) {
+		return NULL;
+	}
+	count = (unsigned int) mbdb->num_records;
+
+	mbdb_columns_t* columns = (mbdb_columns_t*) malloc(sizeof(mbdb_columns_t));
+	if (columns == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(columns, '\0', sizeof(mbdb_columns_t));
+	columns->count = count;
+
+	// one spare byte each so an empty manifest is not mistaken for a failed malloc
+	columns->mode = (unsigned short*) malloc(count * sizeof(unsigned short) + 1);
+	columns->inode = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->uid = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->gid = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->time1 = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->time2 = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->time3 = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	columns->length = (unsigned long long*) malloc(count * sizeof(unsigned long long) + 1);
+	columns->flag = (unsigned char*) malloc(count + 1);
+	columns->datahash = (unsigned char*) calloc(count + 1, MBDB_COLUMNS_HASH_SIZE);
+	columns->domain = (const char**) malloc(count * sizeof(const char*) + 1);
+	columns->domain_size = (unsigned short*) malloc(count * sizeof(unsigned short) + 1);
+	columns->path = (const char**) malloc(count * sizeof(const char*) + 1);
+	columns->path_size = (unsigned short*) malloc(count * sizeof(unsigned short) + 1);
+	columns->target = (const char**) malloc(count * sizeof(const char*) + 1);
+	columns->target_size = (unsigned short*) malloc(count * sizeof(unsigned short) + 1);
+	columns->domain_id = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	if (!columns->mode || !columns->inode || !columns->uid || !columns->gid
+	 || !columns->time1 || !columns->time2 || !columns->time3 || !columns->length
+	 || !columns->flag || !columns->datahash || !columns->domain || !columns->domain_size
+	 || !columns->path || !columns->path_size || !columns->target || !columns->target_size
+	 || !columns->domain_id) {
+		error("Allocation Error!\n");
+		mbdb_columns_free(columns);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		// decoded records are used as they are, lazy ones straight from the data
+		if (mbdb->records[i]) {
+			mbdb_columns_set_record(columns, i, mbdb->records[i]);
+		} else {
+			mbdb_columns_set_raw(columns, i, &mbdb->data[mbdb->offsets[i]]);
+		}
+	}
+	if (mbdb_columns_number_domains(columns) < 0) {
+		error("Allocation Error!\n");
+		mbdb_columns_free(columns);
+		return NULL;
+	}
+
+	return columns;
+}
+
+unsigned int mbdb_columns_count_type(const mbdb_columns_t* columns, unsigned short type) {
+	unsigned int i = 0;
+	unsigned int count = 0;
+
+	if (!columns) {
+		return 0;
+	}
+	if (type == 0) {
+		return columns->count;
+	}
+	const unsigned short* mode = columns->mode;
+	for (i = 0; i < columns->count; i++) {
+		count += ((mode[i] & MBDB_MODE_TYPE_MASK) == type);
+	}
+	return count;
+}
+
+unsigned long long mbdb_columns_total_length(const mbdb_columns_t* columns, unsigned short type) {
+	unsigned int i = 0;
+	unsigned long long total = 0;
+
+	if (!columns) {
+		return 0;
+	}
+	const unsigned short* mode = columns->mode;
+	const unsigned long long* length = columns->length;
+	if (type == 0) {
+		for (i = 0; i < columns->count; i++) {
+			total += length[i];
+		}
+	} else {
+		for (i = 0; i < columns->count; i++) {
+			total += ((mode[i] & MBDB_MODE_TYPE_MASK) == type) ? length[i] : 0;
+		}
+	}
+	return total;
+}
+
+unsigned int mbdb_columns_select_type(const mbdb_columns_t* columns, unsigned short type, unsigned int* indices) {
+	unsigned int i = 0;
+	unsigned int count = 0;
+
+	if (!columns || !indices) {
+		return 0;
+	}
+	const unsigned short* mode = columns->mode;
+	for (i = 0; i < columns->count; i++) {
+		// branch free, the slot is simply overwritten when the record does not match
+		indices[count] = i;
+		count += (type == 0 || (mode[i] & MBDB_MODE_TYPE_MASK) == type);
+	}
+	return count;
+}
+
+/* Ids of the domains that are domain, or start with it if prefix is
+   set. They are consecutive, the first one goes to first. */
+unsigned int mbdb_columns_find_domains(const mbdb_columns_t* columns, const char* domain, unsigned short size, int prefix, unsigned int* first) {
+	unsigned int lo = 0;
+	unsigned int hi = 0;
+
+	if (!columns || !first) {
+		return 0;
+	}
+	if (domain == NULL) {
+		domain = "";
+		size = 0;
+	}
+	// the first one not sorting before domain
+	hi = columns->num_domains;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (mbdb_columns_compare(columns->unique_domain[mid], columns->unique_domain_size[mid], domain, size) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*first = lo;
+	for (hi = lo; hi < columns->num_domains; hi++) {
+		unsigned short other = columns->unique_domain_size[hi];
+		if (prefix ? (other < size || memcmp(columns->unique_domain[hi], domain, size))
+		           : (other != size || memcmp(columns->unique_domain[hi], domain, size))) {
+			break;
+		}
+	}
+	return hi - lo;
+}
+
+void mbdb_columns_free(mbdb_columns_t* columns) {
+	if (columns) {
+		free(columns->mode);
+		free(columns->inode);
+		free(columns->uid);
+		free(columns->gid);
+		free(columns->time1);
+		free(columns->time2);
+		free(columns->time3);
+		free(columns->length);
+		free(columns->flag);
+		free(columns->datahash);
+		free(columns->domain);
+		free(columns->domain_size);
+		free(columns->path);
+		free(columns->path_size);
+		free(columns->target);
+		free(columns->target_size);
+		free(columns->domain_id);
+		free(columns->unique_domain);
+		free(columns->unique_domain_size);
+		free(columns);
+	}
+}
@@ -0,0 +1,136 @@
+/**
+  * libmbdb-1.0 - mbdb_content.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_content.h>
+
+#include <libcrippy-1.0/debug.h>
+
+static const unsigned char mbdb_content_no_hash[MBDB_COLUMNS_HASH_SIZE];
+
+static int mbdb_content_compare(const void* p1, const void* p2) {
+	const mbdb_content_entry_t* e1 = (const mbdb_content_entry_t*) p1;
+	const mbdb_content_entry_t* e2 = (const mbdb_content_entry_t*) p2;
+	int res = memcmp(e1->hash, e2->hash, MBDB_COLUMNS_HASH_SIZE);
+	if (res == 0) {
+		res = (e1->record < e2->record) ? -1 : (e1->record > e2->record);
+	}
+	return res;
+}
+
+mbdb_content_t* mbdb_content_build(struct mbdb_t* mbdb) {
+	unsigned int i = 0;
+
+	mbdb_columns_t* columns = mbdb_get_columns(mbdb);
+	if (columns == NULL) {
+		return NULL;
+	}
+
+	mbdb_content_t* content = (mbdb_content_t*) malloc(sizeof(mbdb_content_t));
+	if (content == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(content, '\0', sizeof(mbdb_content_t));
+
+	// files only, the column is all zero for records without a hash
+	unsigned int* files = (unsigned int*) malloc(columns->count * sizeof(unsigned int) + 1);
+	if (files == NULL) {
+		error("Allocation Error!\n");
+		mbdb_content_free(content);
+		return NULL;
+	}
+	unsigned int num_files = mbdb_columns_select_type(columns, MBDB_MODE_FILE, files);
+
+	content->entries = (mbdb_content_entry_t*) malloc(num_files * sizeof(mbdb_content_entry_t) + 1);
+	if (content->entries == NULL) {
+		error("Allocation Error!\n");
+		free(files);
+		mbdb_content_free(content);
+		return NULL;
+	}
+	for (i = 0; i < num_files; i++) {
+		const unsigned char* hash = &columns->datahash[files[i] * MBDB_COLUMNS_HASH_SIZE];
+		if (memcmp(hash, mbdb_content_no_hash, MBDB_COLUMNS_HASH_SIZE) != 0) {
+			memcpy(content->entries[content->count].hash, hash, MBDB_COLUMNS_HASH_SIZE);
+			content->entries[content->count].record = files[i];
+			content->count++;
+		}
+	}
+	free(files);
+
+	qsort(content->entries, content->count, sizeof(mbdb_content_entry_t), mbdb_content_compare);
+
+	// one pass over the sorted entries finds the runs of equal hashes
+	content->groups = (mbdb_content_group_t*) malloc(content->count * sizeof(mbdb_content_group_t) + 1);
+	if (content->groups == NULL) {
+		error("Allocation Error!\n");
+		mbdb_content_free(content);
+		return NULL;
+	}
+	for (i = 0; i < content->count; i++) {
+		if (i == 0 || memcmp(content->entries[i].hash, content->entries[i - 1].hash, MBDB_COLUMNS_HASH_SIZE) != 0) {
+			content->groups[content->num_groups].first = i;
+			content->groups[content->num_groups].count = 0;
+			content->num_groups++;
+		}
+		content->groups[content->num_groups - 1].count++;
+	}
+
+	return content;
+}
+
+const mbdb_content_group_t* mbdb_content_find(const mbdb_content_t* content, const unsigned char* hash) {
+	if (!content || !hash) {
+		return NULL;
+	}
+
+	// the groups are sorted by hash as well
+	unsigned int lo = 0;
+	unsigned int hi = content->num_groups;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		int res = memcmp(content->entries[content->groups[mid].first].hash, hash, MBDB_COLUMNS_HASH_SIZE);
+		if (res == 0) {
+			return &content->groups[mid];
+		}
+		if (res < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+void mbdb_content_free(mbdb_content_t* content) {
+	if (content) {
+		if (content->entries) {
+			free(content->entries);
+		}
+		if (content->groups) {
+			free(content->groups);
+		}
+		free(content);
+	}
+}
@@ -0,0 +1,290 @@
+/**
+  * libmbdb-1.0 - mbdb_copy.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+#include <libmbdb-1.0/mbdb_copy.h>
+
+#include <libcrippy-1.0/debug.h>
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define MBDB_COPY_HAVE_RANGE
+#endif
+
+#define MBDB_COPY_CHUNK (1U << 30) // per call, the kernel stops near 2G anyway
+
+/* the kernel or filesystem can't do it, the next way may */
+static int mbdb_copy_unsupported(int err) {
+	return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP
+		|| err == ENOTTY || err == EBADF || err == EPERM;
+}
+
+static unsigned int mbdb_copy_chunk(unsigned long long left) {
+	return (left < MBDB_COPY_CHUNK) ? (unsigned int) left : MBDB_COPY_CHUNK;
+}
+
+/* Each copier moves bytes [*done, length) of in to the same offsets
+   of out and advances *done. They return -1 with errno set when they
+   stop early, the caller decides whether the next one carries on.
+   A source that ends before length is EIO. */
+
+static int mbdb_copy_range(int in, int out, unsigned long long length, unsigned long long* done) {
+#ifdef MBDB_COPY_HAVE_RANGE
+	while (*done < length) {
+		loff_t from = (loff_t) *done;
+		loff_t to = (loff_t) *done;
+		ssize_t n = copy_file_range(in, &from, out, &to, mbdb_copy_chunk(length - *done), 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			// the source got shorter
+			errno = EIO;
+			return -1;
+		}
+		*done += (unsigned long long) n;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int mbdb_copy_clone(int in, int out, unsigned long long length, unsigned long long* done) {
+#if defined(__linux__) && defined(FICLONE)
+	// all or nothing, the whole of in becomes the whole of out
+	if (*done != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct stat st;
+	if (ioctl(out, FICLONE, in) < 0) {
+		return -1;
+	}
+	// the source changed size since it was measured
+	if (fstat(out, &st) < 0 || (unsigned long long) st.st_size != length) {
+		errno = EIO;
+		return -1;
+	}
+	*done = length;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int mbdb_copy_sendfile(int in, int out, unsigned long long length, unsigned long long* done) {
+#ifdef __linux__
+	if (lseek(out, (off_t) *done, SEEK_SET) < 0) {
+		return -1;
+	}
+	while (*done < length) {
+		off_t from = (off_t) *done;
+		ssize_t n = sendfile(out, in, &from, mbdb_copy_chunk(length - *done));
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		*done += (unsigned long long) n;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int mbdb_copy_buffer(int in, int out, unsigned long long length, unsigned long long* done) {
+	unsigned char* buffer = (unsigned char*) malloc(MBDB_COPY_BUFFER_SIZE);
+	if (buffer == NULL) {
+		error("Allocation Error!\n");
+		errno = ENOMEM;
+		return -1;
+	}
+	while (*done < length) {
+		size_t size = (length - *done < MBDB_COPY_BUFFER_SIZE) ? (size_t) (length - *done) : MBDB_COPY_BUFFER_SIZE;
+		ssize_t n = pread(in, buffer, size, (off_t) *done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(buffer);
+			return -1;
+		}
+		if (n == 0) {
+			free(buffer);
+			errno = EIO;
+			return -1;
+		}
+		ssize_t written = 0;
+		while (written < n) {
+			ssize_t w = pwrite(out, buffer + written, (size_t) (n - written), (off_t) (*done + written));
+			if (w < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				free(buffer);
+				return -1;
+			}
+			written += w;
+		}
+		*done += (unsigned long long) n;
+	}
+	free(buffer);
+	return 0;
+}
+
+typedef int (*mbdb_copier_t)(int in, int out, unsigned long long length, unsigned long long* done);
+
+static const struct {
+	unsigned int method;
+	const char* name;
+	mbdb_copier_t copy;
+} mbdb_copiers[] = {
+	{ MBDB_COPY_RANGE, "copy_file_range", mbdb_copy_range },
+	{ MBDB_COPY_CLONE, "clone", mbdb_copy_clone },
+	{ MBDB_COPY_SENDFILE, "sendfile", mbdb_copy_sendfile },
+	{ MBDB_COPY_BUFFER, "buffer", mbdb_copy_buffer },
+	{ 0, NULL, NULL }
+};
+
+const char* mbdb_copy_method_name(unsigned int method) {
+	int i = 0;
+	for (i = 0; mbdb_copiers[i].name; i++) {
+		if (mbdb_copiers[i].method == method) {
+			return mbdb_copiers[i].name;
+		}
+	}
+	return "none";
+}
+
+/* Copies length bytes of in to the empty file out, both from offset 0,
+   the first of methods that works. A way the kernel or filesystem
+   doesn't have is skipped, one that stops half way is taken over by
+   the next from there. used gets the one that finished. */
+int mbdb_copy_fd(int in, int out, unsigned long long length, unsigned int methods, unsigned int* used) {
+	unsigned long long done = 0;
+	int i = 0;
+
+	if (in < 0 || out < 0) {
+		return -1;
+	}
+	if (used) {
+		*used = 0;
+	}
+	if (length == 0) {
+		return 0;
+	}
+	for (i = 0; mbdb_copiers[i].name; i++) {
+		if (!(methods & mbdb_copiers[i].method)) {
+			continue;
+		}
+		if (mbdb_copiers[i].copy(in, out, length, &done) == 0) {
+			if (used) {
+				*used = mbdb_copiers[i].method;
+			}
+			return 0;
+		}
+		if (!mbdb_copy_unsupported(errno)) {
+			error("%s: ERROR: %s failed after %llu bytes: %s\n", __func__, mbdb_copiers[i].name, done, strerror(errno));
+			return -1;
+		}
+		debug("%s: %s not available: %s\n", __func__, mbdb_copiers[i].name, strerror(errno));
+	}
+	return -1;
+}
+
+/* Copies the file from to to, replacing it, without the data passing
+   through memory where the kernel allows. The copy goes to a temporary
+   file next to to and is renamed over it once complete, a failed copy
+   leaves to as it was. */
+int mbdb_copy_file(const char* from, const char* to, unsigned int methods, unsigned int* used) {
+	struct stat st;
+	struct stat old;
+	int res = -1;
+
+	if (!from || !to) {
+		return -1;
+	}
+	int in = open(from, O_RDONLY);
+	if (in < 0) {
+		error("%s: ERROR: could not open '%s': %s\n", __func__, from, strerror(errno));
+		return -1;
+	}
+	if (fstat(in, &st) < 0) {
+		close(in);
+		return -1;
+	}
+	char* temp = (char*) malloc(strlen(to) + 8);
+	if (temp == NULL) {
+		error("Allocation Error!\n");
+		close(in);
+		return -1;
+	}
+	strcpy(temp, to);
+	strcat(temp, ".XXXXXX");
+	int out = mkstemp(temp);
+	if (out < 0) {
+		error("%s: ERROR: could not create '%s': %s\n", __func__, temp, strerror(errno));
+		free(temp);
+		close(in);
+		return -1;
+	}
+	// mkstemp() creates the file 0600, keep the mode of the file being replaced
+	fchmod(out, (stat(to, &old) == 0) ? (old.st_mode & 07777) : 0644);
+
+	res = mbdb_copy_fd(in, out, (unsigned long long) st.st_size, methods, used);
+	close(in);
+	if (close(out) < 0) {
+		res = -1;
+	}
+	if (res == 0 && rename(temp, to) < 0) {
+		error("%s: ERROR: could not rename '%s': %s\n", __func__, temp, strerror(errno));
+		res = -1;
+	}
+	if (res < 0) {
+		unlink(temp);
+	}
+	free(temp);
+	return res;
+}
@@ -0,0 +1,211 @@
+/**
+  * libmbdb-1.0 - mbdb_cursor.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_cursor.h>
+
+#include <libcrippy-1.0/debug.h>
+
+void mbdb_filter_compile(mbdb_filter_t* filter) {
+	if (!filter) {
+		return;
+	}
+	filter->domain_size = filter->domain ? (unsigned short) strlen(filter->domain) : 0;
+	filter->path_size = filter->path ? (unsigned short) strlen(filter->path) : 0;
+	if (filter->match & MBDB_FILTER_TYPE) {
+		filter->type_mask = MBDB_MODE_TYPE_MASK;
+		filter->type_value = filter->type & MBDB_MODE_TYPE_MASK;
+	} else {
+		filter->type_mask = 0;
+		filter->type_value = 0;
+	}
+	if (!(filter->match & MBDB_FILTER_LENGTH)) {
+		filter->min_length = 0;
+		filter->max_length = ~0ULL;
+	}
+	if (!(filter->match & MBDB_FILTER_TIME)) {
+		filter->min_time = 0;
+		filter->max_time = ~0U;
+	}
+	if (filter->time_field < 1 || filter->time_field > 3) {
+		filter->time_field = 3;
+	}
+	// paths too short are out before their bytes are looked at
+	filter->min_path_size = (filter->match & MBDB_FILTER_PATH_PREFIX) ? filter->path_size : 0;
+}
+
+/* Scans the columnar view, nothing is decoded. A NULL filter
+   matches every record. The domain test turns into a range of domain
+   ids here, so the domains themselves are never compared. */
+int mbdb_cursor_init(mbdb_cursor_t* cursor, mbdb_t* mbdb, const mbdb_filter_t* filter) {
+	if (!cursor || !mbdb) {
+		return -1;
+	}
+	memset(cursor, '\0', sizeof(mbdb_cursor_t));
+	cursor->columns = mbdb_get_columns(mbdb);
+	if (cursor->columns == NULL) {
+		return -1;
+	}
+	cursor->mbdb = mbdb;
+	cursor->filter = filter;
+	cursor->domain_span = ~0U;
+	cursor->entry.index = ~0U;
+	if (filter) {
+		switch (filter->time_field) {
+		case 1: cursor->time = cursor->columns->time1; break;
+		case 2: cursor->time = cursor->columns->time2; break;
+		default: cursor->time = cursor->columns->time3; break;
+		}
+	}
+	if (filter && (filter->match & (MBDB_FILTER_DOMAIN | MBDB_FILTER_DOMAIN_PREFIX))) {
+		unsigned int count = mbdb_columns_find_domains(cursor->columns, filter->domain, filter->domain_size,
+			(filter->match & MBDB_FILTER_DOMAIN) ? 0 : 1, &cursor->first_domain);
+		if (count == 0) {
+			// no such domain, nothing to scan
+			cursor->next = cursor->columns->count;
+		}
+		cursor->domain_span = count - 1;
+	}
+	return 0;
+}
+
+static unsigned short mbdb_cursor_size(unsigned short size) {
+	return (size == 0xFFFF) ? 0 : size;
+}
+
+/* The fixed size tests are all evaluated, without a branch to
+   mispredict */
+static int mbdb_cursor_pass(const mbdb_cursor_t* cursor, unsigned int i) {
+	const mbdb_filter_t* filter = cursor->filter;
+	const mbdb_columns_t* columns = cursor->columns;
+	unsigned long long length = columns->length[i];
+	unsigned int time = cursor->time[i];
+
+	return ((columns->mode[i] & filter->type_mask) == filter->type_value)
+		& (length >= filter->min_length) & (length <= filter->max_length)
+		& (time >= filter->min_time) & (time <= filter->max_time)
+		& (columns->domain_id[i] - cursor->first_domain <= cursor->domain_span)
+		& (mbdb_cursor_size(columns->path_size[i]) >= filter->min_path_size);
+}
+
+/* Gathers the next records passing the fixed size tests. Their paths
+   live in the record data, far apart, so they are all requested
+   before the first one is compared. */
+static void mbdb_cursor_fill(mbdb_cursor_t* cursor) {
+	const mbdb_columns_t* columns = cursor->columns;
+	const mbdb_filter_t* filter = cursor->filter;
+	int paths = filter && (filter->match & MBDB_FILTER_PATH_PREFIX) && filter->path_size;
+	unsigned int i = cursor->next;
+	unsigned int count = 0;
+
+	while (i < columns->count && count < MBDB_CURSOR_BATCH) {
+		// branch free, the slot is simply overwritten when the record does not pass
+		cursor->batch[count] = i;
+		count += (filter == NULL || mbdb_cursor_pass(cursor, i));
+		i++;
+	}
+	if (paths) {
+		unsigned int k = 0;
+		for (k = 0; k < count; k++) {
+			__builtin_prefetch(columns->path[cursor->batch[k]]);
+		}
+	}
+	cursor->next = i;
+	cursor->batch_count = count;
+	cursor->batch_next = 0;
+}
+
+/* Moves to the next record that passes the filter. Returns 1 with
+   cursor->entry filled in, 0 at the end. */
+int mbdb_cursor_next(mbdb_cursor_t* cursor) {
+	if (!cursor || !cursor->columns) {
+		return -1;
+	}
+	const mbdb_columns_t* columns = cursor->columns;
+	const mbdb_filter_t* filter = cursor->filter;
+	int paths = filter && (filter->match & MBDB_FILTER_PATH_PREFIX) && filter->path_size;
+	unsigned int i = 0;
+	while (1) {
+		if (cursor->batch_next == cursor->batch_count) {
+			if (cursor->next >= columns->count) {
+				return 0;
+			}
+			mbdb_cursor_fill(cursor);
+			continue;
+		}
+		i = cursor->batch[cursor->batch_next++];
+		if (!paths || !memcmp(columns->path[i], filter->path, filter->path_size)) {
+			break;
+		}
+	}
+
+	mbdb_entry_t* entry = &cursor->entry;
+	entry->index = i;
+	entry->domain = columns->domain[i];
+	entry->domain_size = mbdb_cursor_size(columns->domain_size[i]);
+	entry->path = columns->path[i];
+	entry->path_size = mbdb_cursor_size(columns->path_size[i]);
+	entry->target = columns->target[i];
+	entry->target_size = mbdb_cursor_size(columns->target_size[i]);
+	entry->mode = columns->mode[i];
+	entry->length = columns->length[i];
+	entry->time1 = columns->time1[i];
+	entry->time2 = columns->time2[i];
+	entry->time3 = columns->time3[i];
+	switch (entry->mode & MBDB_MODE_TYPE_MASK) {
+	case MBDB_MODE_FILE: entry->flags = MBDB_ENTRY_FILE; break;
+	case MBDB_MODE_DIRECTORY: entry->flags = MBDB_ENTRY_DIRECTORY; break;
+	case MBDB_MODE_SYMLINK: entry->flags = MBDB_ENTRY_SYMLINK; break;
+	default: entry->flags = 0; break;
+	}
+	if (entry->path_size == 0) {
+		entry->flags |= MBDB_ENTRY_DOMAIN_ROOT;
+	}
+	return 1;
+}
+
+/* the whole record the cursor stands on, decoded if it wasn't yet */
+const mbdb_record_t* mbdb_cursor_record(mbdb_cursor_t* cursor) {
+	if (!cursor || !cursor->mbdb || cursor->entry.index >= cursor->columns->count) {
+		return NULL;
+	}
+	return mbdb_get_record(cursor->mbdb, cursor->entry.index);
+}
+
+/* Calls callback for every record that passes the filter, until it
+   returns non zero. Returns what the callback returned, 0 at the end. */
+int mbdb_foreach(mbdb_t* mbdb, const mbdb_filter_t* filter, mbdb_foreach_callback_t callback, void* ctx) {
+	mbdb_cursor_t cursor;
+	int res = 0;
+
+	if (!callback || mbdb_cursor_init(&cursor, mbdb, filter) < 0) {
+		return -1;
+	}
+	while (mbdb_cursor_next(&cursor) > 0) {
+		res = callback(&cursor.entry, ctx);
+		if (res != 0) {
+			return res;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,223 @@
+/**
+  * libmbdb-1.0 - mbdb_index.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_index.h>
+
+#include <libcrippy-1.0/debug.h>
+
+#define MBDB_INDEX_MIN_SLOTS 64
+
+unsigned int mbdb_index_hash(const char* domain, unsigned short domain_size, const char* path, unsigned short path_size) {
+	// FNV-1a over "domain-path", the name the backup file hash is taken from
+	unsigned int hash = 2166136261u;
+	unsigned short i = 0;
+	for (i = 0; i < domain_size; i++) {
+		hash ^= (unsigned char) domain[i];
+		hash *= 16777619u;
+	}
+	hash ^= '-';
+	hash *= 16777619u;
+	for (i = 0; i < path_size; i++) {
+		hash ^= (unsigned char) path[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int mbdb_index_resize(mbdb_index_t* index, unsigned int size) {
+	unsigned int i = 0;
+	mbdb_index_slot_t* old = index->slots;
+	unsigned int old_size = old ? index->mask + 1 : 0;
+
+	index->slots = (mbdb_index_slot_t*) calloc(size, sizeof(mbdb_index_slot_t));
+	if (index->slots == NULL) {
+		error("Allocation Error!\n");
+		index->slots = old;
+		return -1;
+	}
+	index->mask = size - 1;
+	index->used = index->count;
+
+	// deleted slots are dropped on the way
+	for (i = 0; i < old_size; i++) {
+		if (old[i].record != MBDB_INDEX_EMPTY && old[i].record != MBDB_INDEX_DELETED) {
+			unsigned int slot = old[i].hash & index->mask;
+			while (index->slots[slot].record != MBDB_INDEX_EMPTY) {
+				slot = (slot + 1) & index->mask;
+			}
+			index->slots[slot] = old[i];
+		}
+	}
+	if (!index->borrowed) {
+		free(old);
+	}
+	index->borrowed = 0;
+	return 0;
+}
+
+static int mbdb_index_add(mbdb_index_t* index, unsigned int hash, unsigned int record) {
+	// keep the load, tombstones included, under 3/4
+	if ((index->used + 1) * 4 > (index->mask + 1) * 3) {
+		unsigned int size = index->mask + 1;
+		while ((index->count + 1) * 2 > size) {
+			size *= 2;
+		}
+		if (mbdb_index_resize(index, size) < 0) {
+			return -1;
+		}
+	}
+
+	unsigned int slot = hash & index->mask;
+	while (index->slots[slot].record != MBDB_INDEX_EMPTY && index->slots[slot].record != MBDB_INDEX_DELETED) {
+		slot = (slot + 1) & index->mask;
+	}
+	if (index->slots[slot].record == MBDB_INDEX_EMPTY) {
+		index->used++;
+	}
+	index->slots[slot].hash = hash;
+	index->slots[slot].record = record + 1;
+	index->count++;
+	return 0;
+}
+
+mbdb_index_t* mbdb_index_build(struct mbdb_t* mbdb) {
+	unsigned int i = 0;
+	unsigned int size = MBDB_INDEX_MIN_SLOTS;
+
+	if (!mbdb || mbdb->num_records < 0) {
+		return NULL;
+	}
+
+	mbdb_index_t* index = (mbdb_index_t*) malloc(sizeof(mbdb_index_t));
+	if (index == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(index, '\0', sizeof(mbdb_index_t));
+
+	// sized so the whole manifest fits without growing
+	while (size < (unsigned int) mbdb->num_records * 2) {
+		size *= 2;
+	}
+	if (mbdb_index_resize(index, size) < 0) {
+		free(index);
+		return NULL;
+	}
+
+	for (i = 0; i < (unsigned int) mbdb->num_records; i++) {
+		if (mbdb_index_insert(index, mbdb, i) < 0) {
+			mbdb_index_free(index);
+			return NULL;
+		}
+	}
+	return index;
+}
+
+int mbdb_index_find(mbdb_index_t* index, struct mbdb_t* mbdb, const char* domain, unsigned short domain_size, const char* path, unsigned short path_size) {
+	if (!index || !mbdb) {
+		return -1;
+	}
+
+	unsigned int hash = mbdb_index_hash(domain, domain_size, path, path_size);
+	unsigned int slot = hash & index->mask;
+	while (index->slots[slot].record != MBDB_INDEX_EMPTY) {
+		mbdb_index_slot_t* entry = &index->slots[slot];
+		if (entry->record != MBDB_INDEX_DELETED && entry->hash == hash) {
+			const char* d = NULL;
+			const char* p = NULL;
+			unsigned short dsize = 0;
+			unsigned short psize = 0;
+			mbdb_get_record_key(mbdb, entry->record - 1, &d, &dsize, &p, &psize);
+			if (dsize == domain_size && psize == path_size
+			 && (dsize == 0 || !memcmp(d, domain, dsize))
+			 && (psize == 0 || !memcmp(p, path, psize))) {
+				return (int) entry->record - 1;
+			}
+		}
+		slot = (slot + 1) & index->mask;
+	}
+	return -1;
+}
+
+int mbdb_index_insert(mbdb_index_t* index, struct mbdb_t* mbdb, unsigned int record) {
+	const char* domain = NULL;
+	const char* path = NULL;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+
+	if (!index || !mbdb || record >= (unsigned int) mbdb->num_records) {
+		return -1;
+	}
+	mbdb_get_record_key(mbdb, record, &domain, &domain_size, &path, &path_size);
+	return mbdb_index_add(index, mbdb_index_hash(domain, domain_size, path, path_size), record);
+}
+
+int mbdb_index_remove(mbdb_index_t* index, struct mbdb_t* mbdb, unsigned int record) {
+	const char* domain = NULL;
+	const char* path = NULL;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+
+	if (!index || !mbdb || record >= (unsigned int) mbdb->num_records) {
+		return -1;
+	}
+	mbdb_get_record_key(mbdb, record, &domain, &domain_size, &path, &path_size);
+
+	unsigned int hash = mbdb_index_hash(domain, domain_size, path, path_size);
+	unsigned int slot = hash & index->mask;
+	while (index->slots[slot].record != MBDB_INDEX_EMPTY) {
+		if (index->slots[slot].record == record + 1) {
+			index->slots[slot].record = MBDB_INDEX_DELETED;
+			index->count--;
+			return 0;
+		}
+		slot = (slot + 1) & index->mask;
+	}
+	return -1;
+}
+
+/* records moved, remap gives the new index of each old one
+   (removed records are no longer in the index) */
+void mbdb_index_remap(mbdb_index_t* index, const unsigned int* remap) {
+	unsigned int i = 0;
+
+	if (!index || !remap) {
+		return;
+	}
+	for (i = 0; i <= index->mask; i++) {
+		unsigned int r = index->slots[i].record;
+		if (r != MBDB_INDEX_EMPTY && r != MBDB_INDEX_DELETED) {
+			index->slots[i].record = remap[r - 1] + 1;
+		}
+	}
+}
+
+void mbdb_index_free(mbdb_index_t* index) {
+	if (index) {
+		if (index->slots && !index->borrowed) {
+			free(index->slots);
+		}
+		free(index);
+	}
+}
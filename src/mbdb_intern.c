@@ -0,0 +1,198 @@
+/**
+  * libmbdb-1.0 - mbdb_intern.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb_intern.h>
+#include <libcrippy-1.0/debug.h>
+
+static unsigned int mbdb_intern_hash(const char* str, unsigned short size) {
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	unsigned short i = 0;
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+mbdb_intern_t* mbdb_intern_create() {
+	mbdb_intern_t* intern = (mbdb_intern_t*) malloc(sizeof(mbdb_intern_t));
+	if (intern == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(intern, '\0', sizeof(mbdb_intern_t));
+	pthread_mutex_init(&intern->lock, NULL);
+
+	intern->arena = mbdb_arena_create(0);
+	intern->slots = (unsigned int*) calloc(MBDB_INTERN_MIN_SLOTS, sizeof(unsigned int));
+	if (intern->arena == NULL || intern->slots == NULL) {
+		error("Allocation Error!\n");
+		mbdb_intern_free(intern);
+		return NULL;
+	}
+	intern->mask = MBDB_INTERN_MIN_SLOTS - 1;
+	return intern;
+}
+
+/* slot holding str, or the empty slot it would go into */
+static unsigned int mbdb_intern_slot(mbdb_intern_t* intern, const char* str, unsigned short size, unsigned int hash) {
+	unsigned int slot = hash & intern->mask;
+	while (intern->slots[slot]) {
+		mbdb_intern_entry_t* entry = &intern->entries[intern->slots[slot] - 1];
+		if (entry->hash == hash && entry->size == size && !memcmp(entry->str, str, size)) {
+			break;
+		}
+		slot = (slot + 1) & intern->mask;
+	}
+	return slot;
+}
+
+static int mbdb_intern_grow(mbdb_intern_t* intern) {
+	unsigned int i = 0;
+
+	// keep the table at most half full
+	if ((intern->count + 1) * 2 > intern->mask + 1) {
+		unsigned int size = (intern->mask + 1) * 2;
+		unsigned int* slots = (unsigned int*) calloc(size, sizeof(unsigned int));
+		if (slots == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		free(intern->slots);
+		intern->slots = slots;
+		intern->mask = size - 1;
+		for (i = 0; i < intern->count; i++) {
+			unsigned int slot = intern->entries[i].hash & intern->mask;
+			while (intern->slots[slot]) {
+				slot = (slot + 1) & intern->mask;
+			}
+			intern->slots[slot] = i + 1;
+		}
+	}
+
+	if (intern->count == intern->capacity) {
+		unsigned int capacity = intern->capacity ? intern->capacity * 2 : MBDB_INTERN_MIN_SLOTS / 2;
+		mbdb_intern_entry_t* entries = (mbdb_intern_entry_t*) realloc(intern->entries, capacity * sizeof(mbdb_intern_entry_t));
+		if (entries == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		intern->entries = entries;
+		intern->capacity = capacity;
+	}
+	return 0;
+}
+
+const char* mbdb_intern_string(mbdb_intern_t* intern, const char* str, unsigned short size) {
+	const char* result = NULL;
+
+	if (!intern || !str) {
+		return NULL;
+	}
+	unsigned int hash = mbdb_intern_hash(str, size);
+
+	if (intern->frozen) {
+		// read-only until thawed, a missing string is an error
+		unsigned int slot = mbdb_intern_slot(intern, str, size, hash);
+		return intern->slots[slot] ? intern->entries[intern->slots[slot] - 1].str : NULL;
+	}
+
+	pthread_mutex_lock(&intern->lock);
+	unsigned int slot = mbdb_intern_slot(intern, str, size, hash);
+	if (intern->slots[slot]) {
+		result = intern->entries[intern->slots[slot] - 1].str;
+	} else if (mbdb_intern_grow(intern) == 0) {
+		char* copy = mbdb_arena_memdup(intern->arena, str, size, 1);
+		if (copy) {
+			// growing may have rehashed the slots
+			slot = mbdb_intern_slot(intern, str, size, hash);
+			mbdb_intern_entry_t* entry = &intern->entries[intern->count];
+			entry->str = copy;
+			entry->size = size;
+			entry->hash = hash;
+			intern->slots[slot] = ++intern->count;
+			result = copy;
+		}
+	}
+	pthread_mutex_unlock(&intern->lock);
+
+	return result;
+}
+
+const char* mbdb_intern_find(mbdb_intern_t* intern, const char* str, unsigned short size) {
+	const char* result = NULL;
+
+	if (!intern || !str) {
+		return NULL;
+	}
+	unsigned int hash = mbdb_intern_hash(str, size);
+
+	pthread_mutex_lock(&intern->lock);
+	unsigned int slot = mbdb_intern_slot(intern, str, size, hash);
+	if (intern->slots[slot]) {
+		result = intern->entries[intern->slots[slot] - 1].str;
+	}
+	pthread_mutex_unlock(&intern->lock);
+
+	return result;
+}
+
+unsigned int mbdb_intern_count(mbdb_intern_t* intern) {
+	return intern ? intern->count : 0;
+}
+
+const char* mbdb_intern_get(mbdb_intern_t* intern, unsigned int index, unsigned short* size) {
+	if (!intern || index >= intern->count) {
+		return NULL;
+	}
+	if (size) {
+		*size = intern->entries[index].size;
+	}
+	return intern->entries[index].str;
+}
+
+/* A frozen table takes no new strings, so threads started after this
+   look strings up concurrently without taking the lock. Only call it
+   while no other thread uses the table. */
+void mbdb_intern_freeze(mbdb_intern_t* intern, int frozen) {
+	if (intern) {
+		intern->frozen = frozen;
+	}
+}
+
+void mbdb_intern_free(mbdb_intern_t* intern) {
+	if (intern) {
+		if (intern->slots) {
+			free(intern->slots);
+		}
+		if (intern->entries) {
+			free(intern->entries);
+		}
+		if (intern->arena) {
+			mbdb_arena_free(intern->arena);
+		}
+		pthread_mutex_destroy(&intern->lock);
+		free(intern);
+	}
+}
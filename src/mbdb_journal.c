@@ -0,0 +1,466 @@
+/**
+  * libmbdb-1.0 - mbdb_journal.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_journal.h>
+
+#include <libcrippy-1.0/debug.h>
+#include <libcrippy-1.0/endianness.h>
+
+struct mbdb_journal_t {
+	int fd;                         // -1 once the journal can't be trusted anymore
+	unsigned long long size;        // bytes on disk, header included
+	unsigned char* pending;         // entries not written yet
+	size_t num_pending;
+	size_t pending_capacity;
+	int replaying;
+};
+
+static char* mbdb_journal_path(const char* file) {
+	char* path = (char*) malloc(strlen(file) + strlen(MBDB_JOURNAL_SUFFIX) + 1);
+	if (path == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	strcpy(path, file);
+	strcat(path, MBDB_JOURNAL_SUFFIX);
+	return path;
+}
+
+static void mbdb_journal_checksum(const unsigned char* head, unsigned int head_size, const unsigned char* tail, unsigned int tail_size, unsigned long long length, unsigned char* checksum) {
+	SHA_CTX ctx;
+
+	length = htobe64(length);
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, head, head_size);
+	SHA1_Update(&ctx, tail, tail_size);
+	SHA1_Update(&ctx, &length, sizeof(length));
+	SHA1_Final(checksum, &ctx);
+}
+
+/* head and tail of the manifest, they rarely stay the same when it's rewritten */
+static void mbdb_journal_data_checksum(const unsigned char* data, unsigned int size, unsigned char* checksum) {
+	unsigned int head = (size < MBDB_JOURNAL_SAMPLE) ? size : MBDB_JOURNAL_SAMPLE;
+	unsigned int tail = (size - head < MBDB_JOURNAL_SAMPLE) ? size - head : MBDB_JOURNAL_SAMPLE;
+	mbdb_journal_checksum(data, head, &data[size - tail], tail, size, checksum);
+}
+
+static int mbdb_journal_file_checksum(const char* file, struct stat* st, unsigned char* checksum) {
+	int res = -1;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	unsigned char* buf = (unsigned char*) malloc(MBDB_JOURNAL_SAMPLE * 2);
+	if (buf == NULL) {
+		error("Allocation Error!\n");
+	} else if (fstat(fd, st) == 0) {
+		unsigned long long length = st->st_size;
+		unsigned int head = (length < MBDB_JOURNAL_SAMPLE) ? (unsigned int) length : MBDB_JOURNAL_SAMPLE;
+		unsigned int tail = (length - head < MBDB_JOURNAL_SAMPLE) ? (unsigned int) (length - head) : MBDB_JOURNAL_SAMPLE;
+		if (pread(fd, buf, head, 0) == (ssize_t) head
+		 && pread(fd, &buf[head], tail, length - tail) == (ssize_t) tail) {
+			mbdb_journal_checksum(buf, head, &buf[head], tail, length, checksum);
+			res = 0;
+		}
+	}
+	free(buf);
+	close(fd);
+	return res;
+}
+
+static unsigned int mbdb_journal_check(unsigned char op, const unsigned char* payload, unsigned int size) {
+	// FNV-1a, enough to tell a torn write
+	unsigned int hash = 2166136261u;
+	unsigned int i = 0;
+	hash ^= op;
+	hash *= 16777619u;
+	for (i = 0; i < size; i++) {
+		hash ^= payload[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* a fresh journal for the manifest of the given stat and checksum */
+static int mbdb_journal_start(struct mbdb_journal_t* journal, const struct stat* st, const unsigned char* checksum) {
+	mbdb_journal_header_t header;
+
+	memset(&header, '\0', sizeof(header));
+	memcpy(header.magic, MBDB_JOURNAL_MAGIC, sizeof(MBDB_JOURNAL_MAGIC));
+	header.version = htobe32(MBDB_JOURNAL_VERSION);
+	header.header_size = htobe32(sizeof(header));
+	header.manifest_size = htobe64((unsigned long long) st->st_size);
+	memcpy(header.manifest_checksum, checksum, sizeof(header.manifest_checksum));
+	header.manifest_inode = htobe64((unsigned long long) st->st_ino);
+	header.manifest_mtime = htobe64((unsigned long long) st->st_mtim.tv_sec);
+	header.manifest_mtime_nsec = htobe64((unsigned long long) st->st_mtim.tv_nsec);
+
+	// the new header alone already disowns the old entries
+	if (pwrite(journal->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+	 || ftruncate(journal->fd, sizeof(header)) < 0
+	 || fdatasync(journal->fd) < 0) {
+		return -1;
+	}
+	journal->size = sizeof(header);
+	journal->num_pending = 0;
+	return 0;
+}
+
+static const unsigned char* mbdb_journal_string(const unsigned char* payload, unsigned int size, unsigned int* offset, unsigned short* length) {
+	if (*offset + 2 > size) {
+		return NULL;
+	}
+	*length = be16toh(*((unsigned short*) &payload[*offset]));
+	if (*length == 0xFFFF) {
+		*length = 0;
+	}
+	*offset += 2;
+	if (*offset + *length > size) {
+		return NULL;
+	}
+	*offset += *length;
+	return &payload[*offset - *length];
+}
+
+static int mbdb_journal_apply(mbdb_t* mbdb, unsigned char op, unsigned char* payload, unsigned int size) {
+	unsigned int offset = 0;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+	int index = -1;
+
+	if (op != MBDB_JOURNAL_INSERT) {
+		const unsigned char* domain = mbdb_journal_string(payload, size, &offset, &domain_size);
+		const unsigned char* path = domain ? mbdb_journal_string(payload, size, &offset, &path_size) : NULL;
+		mbdb_index_t* lookup = mbdb_get_index(mbdb);
+		if (path == NULL || lookup == NULL) {
+			return -1;
+		}
+		index = mbdb_index_find(lookup, mbdb, (const char*) domain, domain_size, (const char*) path, path_size);
+	}
+	if (op == MBDB_JOURNAL_REMOVE) {
+		if (offset != size) {
+			return -1;
+		}
+		// already gone is as good as removed
+		return (index >= 0) ? mbdb_remove_record(mbdb, index) : 0;
+	}
+
+	if (mbdb_record_scan(&payload[offset], size - offset) != (int) (size - offset)) {
+		return -1;
+	}
+	mbdb_record_t* record = mbdb_record_parse(&payload[offset]);
+	if (record == NULL) {
+		return -1;
+	}
+	int res = (index >= 0) ? mbdb_replace_record(mbdb, index, record) : mbdb_insert_record(mbdb, record);
+	if (res < 0) {
+		mbdb_record_free(record);
+		return -1;
+	}
+	return 0;
+}
+
+/* applies the entries in order, returns where the good ones end */
+static unsigned long long mbdb_journal_replay(mbdb_t* mbdb, unsigned char* data, unsigned long long size) {
+	unsigned long long offset = sizeof(mbdb_journal_header_t);
+	unsigned int count = 0;
+
+	while (offset + sizeof(mbdb_journal_entry_t) <= size) {
+		const mbdb_journal_entry_t* entry = (const mbdb_journal_entry_t*) &data[offset];
+		unsigned int payload_size = be32toh(entry->size);
+		unsigned char* payload = &data[offset + sizeof(mbdb_journal_entry_t)];
+		if (offset + sizeof(mbdb_journal_entry_t) + payload_size > size
+		 || be32toh(entry->check) != mbdb_journal_check(entry->op, payload, payload_size)) {
+			break;
+		}
+		if (mbdb_journal_apply(mbdb, entry->op, payload, payload_size) < 0) {
+			error("Unable to replay journal entry at offset 0x%llx\n", offset);
+			break;
+		}
+		offset += sizeof(mbdb_journal_entry_t) + payload_size;
+		count++;
+	}
+	debug("Replayed %u journal entries\n", count);
+	return offset;
+}
+
+/* Opens the journal next to the manifest and replays it onto the
+   records, or starts a new one if it belongs to another manifest. */
+int mbdb_journal_open(mbdb_t* mbdb, const char* file) {
+	struct stat st;
+	struct stat manifest;
+	unsigned char checksum[20];
+
+	if (!mbdb || !file || !mbdb->data || mbdb->journal) {
+		return -1;
+	}
+	char* path = mbdb_journal_path(file);
+	if (path == NULL) {
+		return -1;
+	}
+	struct mbdb_journal_t* journal = (struct mbdb_journal_t*) calloc(1, sizeof(struct mbdb_journal_t));
+	if (journal == NULL) {
+		error("Allocation Error!\n");
+		free(path);
+		return -1;
+	}
+	journal->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (journal->fd < 0 || fstat(journal->fd, &st) < 0) {
+		error("Unable to open %s\n", path);
+		mbdb->journal = journal;
+		mbdb_journal_close(mbdb);
+		free(path);
+		return -1;
+	}
+	mbdb->journal = journal;
+	if (stat(file, &manifest) < 0) {
+		error("Unable to stat %s\n", file);
+		free(path);
+		return -1;
+	}
+	mbdb_journal_data_checksum(mbdb->data, mbdb->size, checksum);
+
+	unsigned long long size = st.st_size;
+	unsigned char* data = (size >= sizeof(mbdb_journal_header_t)) ? (unsigned char*) malloc(size) : NULL;
+	if (data && pread(journal->fd, data, size, 0) != (ssize_t) size) {
+		free(data);
+		data = NULL;
+	}
+	const mbdb_journal_header_t* header = (const mbdb_journal_header_t*) data;
+	if (header
+	 && memcmp(header->magic, MBDB_JOURNAL_MAGIC, sizeof(MBDB_JOURNAL_MAGIC)) == 0
+	 && be32toh(header->version) == MBDB_JOURNAL_VERSION
+	 && be32toh(header->header_size) == sizeof(mbdb_journal_header_t)
+	 && be64toh(header->manifest_size) == mbdb->size
+	 && (unsigned long long) manifest.st_size == mbdb->size
+	 && be64toh(header->manifest_inode) == (unsigned long long) manifest.st_ino
+	 && (long long) be64toh(header->manifest_mtime) == (long long) manifest.st_mtim.tv_sec
+	 && (long long) be64toh(header->manifest_mtime_nsec) == (long long) manifest.st_mtim.tv_nsec
+	 && memcmp(header->manifest_checksum, checksum, sizeof(checksum)) == 0) {
+		journal->replaying = 1;
+		journal->size = mbdb_journal_replay(mbdb, data, size);
+		journal->replaying = 0;
+		// the changes are safe in the journal already
+		mbdb->dirty = 0;
+		if (journal->size < size) {
+			debug("Dropping the torn end of %s\n", path);
+			if (ftruncate(journal->fd, journal->size) < 0) {
+				error("Unable to truncate %s\n", path);
+				free(data);
+				free(path);
+				return -1;
+			}
+		}
+	} else {
+		// the manifest was written since, or someone else changed it
+		if (size > 0) {
+			debug("Journal %s is stale\n", path);
+		}
+		if (mbdb_journal_start(journal, &manifest, checksum) < 0) {
+			error("Unable to write %s\n", path);
+			free(data);
+			free(path);
+			return -1;
+		}
+	}
+
+	free(data);
+	free(path);
+	return 0;
+}
+
+/* Logs a change about to be made to the record at index, or the insert
+   of record. Entries stay in memory until mbdb_journal_sync(). */
+int mbdb_journal_log(mbdb_t* mbdb, unsigned char op, unsigned int index, mbdb_record_t* record) {
+	const char* domain = NULL;
+	const char* path = NULL;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	if (journal == NULL || journal->replaying) {
+		return 0;
+	}
+	if (journal->fd < 0) {
+		return -1;
+	}
+
+	unsigned int size = 0;
+	if (op != MBDB_JOURNAL_INSERT) {
+		mbdb_get_record_key(mbdb, index, &domain, &domain_size, &path, &path_size);
+		size += 2 + domain_size + 2 + path_size;
+	}
+	if (op != MBDB_JOURNAL_REMOVE) {
+		if (record == NULL) {
+			return -1;
+		}
+		size += record->this_size;
+	}
+
+	size_t needed = journal->num_pending + sizeof(mbdb_journal_entry_t) + size;
+	if (needed > journal->pending_capacity) {
+		size_t capacity = journal->pending_capacity ? journal->pending_capacity * 2 : 0x10000;
+		while (capacity < needed) {
+			capacity *= 2;
+		}
+		unsigned char* pending = (unsigned char*) realloc(journal->pending, capacity);
+		if (pending == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		journal->pending = pending;
+		journal->pending_capacity = capacity;
+	}
+
+	mbdb_journal_entry_t* entry = (mbdb_journal_entry_t*) &journal->pending[journal->num_pending];
+	unsigned char* payload = (unsigned char*) &entry[1];
+	unsigned char* p = payload;
+	if (op != MBDB_JOURNAL_INSERT) {
+		*((unsigned short*) p) = htobe16(domain_size);
+		memcpy(p + 2, domain, domain_size);
+		p += 2 + domain_size;
+		*((unsigned short*) p) = htobe16(path_size);
+		memcpy(p + 2, path, path_size);
+		p += 2 + path_size;
+	}
+	// serialized right into the entry
+	if (record && op != MBDB_JOURNAL_REMOVE && mbdb_record_serialize_into(record, p, record->this_size) < 0) {
+		return -1;
+	}
+	memset(entry, '\0', sizeof(mbdb_journal_entry_t));
+	entry->op = op;
+	entry->size = htobe32(size);
+	entry->check = htobe32(mbdb_journal_check(op, payload, size));
+	journal->num_pending = needed;
+	return 0;
+}
+
+/* position in the journal, for mbdb_journal_discard() */
+size_t mbdb_journal_mark(mbdb_t* mbdb) {
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	return journal ? (size_t) journal->size + journal->num_pending : 0;
+}
+
+/* drops the entries logged after mark, written ones included */
+void mbdb_journal_discard(mbdb_t* mbdb, size_t mark) {
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	if (journal == NULL || journal->fd < 0 || mark < sizeof(mbdb_journal_header_t)) {
+		return;
+	}
+	if (mark >= journal->size) {
+		if (mark - journal->size < journal->num_pending) {
+			journal->num_pending = mark - journal->size;
+		}
+		return;
+	}
+	journal->num_pending = 0;
+	if (ftruncate(journal->fd, mark) < 0 || fdatasync(journal->fd) < 0) {
+		error("Unable to truncate the journal\n");
+		close(journal->fd);
+		journal->fd = -1;
+		return;
+	}
+	journal->size = mark;
+}
+
+/* Writes the pending entries and waits for them to reach the disk,
+   one fdatasync() for however many there are. */
+int mbdb_journal_sync(mbdb_t* mbdb) {
+	size_t done = 0;
+
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	if (journal == NULL) {
+		return 0;
+	}
+	if (journal->fd < 0) {
+		return -1;
+	}
+	if (journal->num_pending == 0) {
+		return 0;
+	}
+	while (done < journal->num_pending) {
+		ssize_t n = pwrite(journal->fd, &journal->pending[done], journal->num_pending - done, journal->size + done);
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	if (done < journal->num_pending || fdatasync(journal->fd) < 0) {
+		// nothing half written may stay behind the last good entry
+		error("Unable to write the journal\n");
+		if (ftruncate(journal->fd, journal->size) < 0) {
+			close(journal->fd);
+			journal->fd = -1;
+		}
+		return -1;
+	}
+	journal->size += journal->num_pending;
+	journal->num_pending = 0;
+	return 0;
+}
+
+/* bytes of entries, written or not, 0 if there is no journal */
+unsigned long long mbdb_journal_size(mbdb_t* mbdb) {
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	if (journal == NULL) {
+		return 0;
+	}
+	return journal->size - sizeof(mbdb_journal_header_t) + journal->num_pending;
+}
+
+/* Empties the journal once the manifest was written with all of its
+   changes, and ties it to that manifest. */
+int mbdb_journal_reset(mbdb_t* mbdb, const char* file) {
+	struct stat st;
+	unsigned char checksum[20];
+
+	struct mbdb_journal_t* journal = mbdb ? mbdb->journal : NULL;
+	if (journal == NULL || file == NULL || journal->fd < 0) {
+		return -1;
+	}
+	if (mbdb_journal_file_checksum(file, &st, checksum) < 0 || mbdb_journal_start(journal, &st, checksum) < 0) {
+		// entries logged from here on would be replayed onto the wrong manifest
+		error("Unable to reset the journal of %s\n", file);
+		close(journal->fd);
+		journal->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void mbdb_journal_close(mbdb_t* mbdb) {
+	if (mbdb && mbdb->journal) {
+		if (mbdb->journal->fd >= 0) {
+			close(mbdb->journal->fd);
+		}
+		free(mbdb->journal->pending);
+		free(mbdb->journal);
+		mbdb->journal = NULL;
+	}
+}
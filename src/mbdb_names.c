@@ -0,0 +1,641 @@
+/**
+  * libmbdb-1.0 - mbdb_names.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_names.h>
+
+#include <libcrippy-1.0/debug.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MBDB_NAMES_SIMD
+#include <immintrin.h>
+#endif
+
+#define MBDB_NAME_BATCH 16 // names in flight, their blocks are compressed side by side
+
+static const unsigned int mbdb_name_iv[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+static unsigned int mbdb_name_be32(const unsigned char* p) {
+	return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) | ((unsigned int) p[2] << 8) | p[3];
+}
+
+#define MBDB_NAME_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define MBDB_NAME_ROUND(f, k) \
+	if (i >= 16) { \
+		t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15]; \
+		w[i & 15] = MBDB_NAME_ROL(t, 1); \
+	} \
+	t = MBDB_NAME_ROL(a, 5) + (f) + e + (k) + w[i & 15]; \
+	e = d; \
+	d = c; \
+	c = MBDB_NAME_ROL(b, 30); \
+	b = a; \
+	a = t;
+
+static void mbdb_name_compress_block(unsigned int* state, const unsigned char* block) {
+	unsigned int w[16];
+	unsigned int a = state[0];
+	unsigned int b = state[1];
+	unsigned int c = state[2];
+	unsigned int d = state[3];
+	unsigned int e = state[4];
+	unsigned int t = 0;
+	int i = 0;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = mbdb_name_be32(&block[i * 4]);
+	}
+	for (i = 0; i < 20; i++) {
+		MBDB_NAME_ROUND(d ^ (b & (c ^ d)), 0x5A827999)
+	}
+	for (; i < 40; i++) {
+		MBDB_NAME_ROUND(b ^ c ^ d, 0x6ED9EBA1)
+	}
+	for (; i < 60; i++) {
+		MBDB_NAME_ROUND((b & c) | (d & (b | c)), 0x8F1BBCDC)
+	}
+	for (; i < 80; i++) {
+		MBDB_NAME_ROUND(b ^ c ^ d, 0xCA62C1D6)
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void mbdb_name_compress_scalar(unsigned int** state, const unsigned char** block, unsigned int count) {
+	unsigned int i = 0;
+	for (i = 0; i < count; i++) {
+		mbdb_name_compress_block(state[i], block[i]);
+	}
+}
+
+#ifdef MBDB_NAMES_SIMD
+/* Eight names at once, a 32 bit lane each. The blocks are loaded as
+   rows and transposed, so word t of every block ends up in w[t]. */
+#define MBDB_NAME_ROL8(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+__attribute__((target("avx2")))
+static void mbdb_name_load8(__m256i* w, const unsigned char** block, unsigned int offset) {
+	const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i r[8];
+	__m256i t[8];
+	__m256i u[8];
+	int i = 0;
+
+	for (i = 0; i < 8; i++) {
+		r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) (block[i] + offset)), swap);
+	}
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		w[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		w[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+__attribute__((target("avx2")))
+static void mbdb_name_compress8(unsigned int** state, const unsigned char** block) {
+	unsigned int s[5][8] __attribute__((aligned(32)));
+	__m256i h[5];
+	__m256i w[16];
+	__m256i a, b, c, d, e, f, k, t;
+	int i = 0;
+	int j = 0;
+
+	for (i = 0; i < 5; i++) {
+		for (j = 0; j < 8; j++) {
+			s[i][j] = state[j][i];
+		}
+		h[i] = _mm256_load_si256((const __m256i*) s[i]);
+	}
+	mbdb_name_load8(&w[0], block, 0);
+	mbdb_name_load8(&w[8], block, 32);
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+	for (i = 0; i < 80; i++) {
+		if (i >= 16) {
+			t = _mm256_xor_si256(_mm256_xor_si256(w[(i + 13) & 15], w[(i + 8) & 15]),
+					_mm256_xor_si256(w[(i + 2) & 15], w[i & 15]));
+			w[i & 15] = MBDB_NAME_ROL8(t, 1);
+		}
+		if (i < 20) {
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			k = _mm256_set1_epi32(0x5A827999);
+		} else if (i < 40) {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(0x6ED9EBA1);
+		} else if (i < 60) {
+			f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+			k = _mm256_set1_epi32(0x8F1BBCDC);
+		} else {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(0xCA62C1D6);
+		}
+		t = _mm256_add_epi32(_mm256_add_epi32(MBDB_NAME_ROL8(a, 5), f),
+				_mm256_add_epi32(_mm256_add_epi32(e, k), w[i & 15]));
+		e = d;
+		d = c;
+		c = MBDB_NAME_ROL8(b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] = _mm256_add_epi32(h[0], a);
+	h[1] = _mm256_add_epi32(h[1], b);
+	h[2] = _mm256_add_epi32(h[2], c);
+	h[3] = _mm256_add_epi32(h[3], d);
+	h[4] = _mm256_add_epi32(h[4], e);
+
+	for (i = 0; i < 5; i++) {
+		_mm256_store_si256((__m256i*) s[i], h[i]);
+		for (j = 0; j < 8; j++) {
+			state[j][i] = s[i][j];
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void mbdb_name_compress_avx2(unsigned int** state, const unsigned char** block, unsigned int count) {
+	static const unsigned char idle_block[64];
+	unsigned int idle_state[8][5];
+	unsigned int* lane_state[8];
+	const unsigned char* lane_block[8];
+	unsigned int i = 0;
+
+	while (count >= 8) {
+		mbdb_name_compress8(state, block);
+		state += 8;
+		block += 8;
+		count -= 8;
+	}
+	// a few left over are cheaper one at a time than in a mostly idle batch
+	if (count < 3) {
+		mbdb_name_compress_scalar(state, block, count);
+		return;
+	}
+	for (i = 0; i < 8; i++) {
+		lane_state[i] = (i < count) ? state[i] : idle_state[i];
+		lane_block[i] = (i < count) ? block[i] : idle_block;
+	}
+	mbdb_name_compress8(lane_state, lane_block);
+}
+
+/* The SHA extensions, two names interleaved so the rounds of one hide
+   the latency of the other; with more the registers spill. Rounds go
+   four at a time, message words are expanded alongside them. */
+#define MBDB_NAME_NI_ROUNDS(g, f) \
+	_Pragma("GCC unroll 2") \
+	for (l = 0; l < lanes; l++) { \
+		if ((g) < 4) { \
+			w[l][(g) & 3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (block[l] + 16 * (g))), swap); \
+		} \
+		if ((g) == 0) { \
+			e[l][0] = _mm_add_epi32(e[l][0], w[l][0]); \
+		} else { \
+			e[l][(g) & 1] = _mm_sha1nexte_epu32(e[l][(g) & 1], w[l][(g) & 3]); \
+		} \
+		e[l][((g) + 1) & 1] = abcd[l]; \
+		if ((g) >= 3 && (g) <= 18) { \
+			w[l][((g) + 1) & 3] = _mm_sha1msg2_epu32(w[l][((g) + 1) & 3], w[l][(g) & 3]); \
+		} \
+		abcd[l] = _mm_sha1rnds4_epu32(abcd[l], e[l][(g) & 1], f); \
+		if ((g) >= 1 && (g) <= 16) { \
+			w[l][((g) + 3) & 3] = _mm_sha1msg1_epu32(w[l][((g) + 3) & 3], w[l][(g) & 3]); \
+		} \
+		if ((g) >= 2 && (g) <= 17) { \
+			w[l][((g) + 2) & 3] = _mm_xor_si128(w[l][((g) + 2) & 3], w[l][(g) & 3]); \
+		} \
+	}
+
+__attribute__((target("sha,sse4.1")))
+static inline __attribute__((always_inline)) void mbdb_name_compress_ni_lanes(unsigned int** state, const unsigned char** block, const unsigned int lanes) {
+	const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd[2], abcd_save[2], e[2][2], e_save[2], w[2][4];
+	unsigned int l = 0;
+
+	_Pragma("GCC unroll 2")
+	for (l = 0; l < lanes; l++) {
+		abcd[l] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state[l]), 0x1B);
+		e[l][0] = _mm_set_epi32(state[l][4], 0, 0, 0);
+		abcd_save[l] = abcd[l];
+		e_save[l] = e[l][0];
+	}
+	MBDB_NAME_NI_ROUNDS(0, 0) MBDB_NAME_NI_ROUNDS(1, 0) MBDB_NAME_NI_ROUNDS(2, 0)
+	MBDB_NAME_NI_ROUNDS(3, 0) MBDB_NAME_NI_ROUNDS(4, 0) MBDB_NAME_NI_ROUNDS(5, 1)
+	MBDB_NAME_NI_ROUNDS(6, 1) MBDB_NAME_NI_ROUNDS(7, 1) MBDB_NAME_NI_ROUNDS(8, 1)
+	MBDB_NAME_NI_ROUNDS(9, 1) MBDB_NAME_NI_ROUNDS(10, 2) MBDB_NAME_NI_ROUNDS(11, 2)
+	MBDB_NAME_NI_ROUNDS(12, 2) MBDB_NAME_NI_ROUNDS(13, 2) MBDB_NAME_NI_ROUNDS(14, 2)
+	MBDB_NAME_NI_ROUNDS(15, 3) MBDB_NAME_NI_ROUNDS(16, 3) MBDB_NAME_NI_ROUNDS(17, 3)
+	MBDB_NAME_NI_ROUNDS(18, 3) MBDB_NAME_NI_ROUNDS(19, 3)
+	_Pragma("GCC unroll 2")
+	for (l = 0; l < lanes; l++) {
+		// rounds 76 to 79 left their e in e[l][0]
+		e[l][0] = _mm_sha1nexte_epu32(e[l][0], e_save[l]);
+		abcd[l] = _mm_add_epi32(abcd[l], abcd_save[l]);
+		_mm_storeu_si128((__m128i*) state[l], _mm_shuffle_epi32(abcd[l], 0x1B));
+		state[l][4] = (unsigned int) _mm_extract_epi32(e[l][0], 3);
+	}
+}
+
+__attribute__((target("sha,sse4.1")))
+static void mbdb_name_compress_ni(unsigned int** state, const unsigned char** block, unsigned int count) {
+	while (count >= 2) {
+		mbdb_name_compress_ni_lanes(state, block, 2);
+		state += 2;
+		block += 2;
+		count -= 2;
+	}
+	if (count) {
+		mbdb_name_compress_ni_lanes(state, block, 1);
+	}
+}
+#endif
+
+typedef void (*mbdb_name_compress_t)(unsigned int** state, const unsigned char** block, unsigned int count);
+
+typedef struct mbdb_name_impl_t {
+	const char* name;
+	mbdb_name_compress_t compress;
+	int supported;
+} mbdb_name_impl_t;
+
+static mbdb_name_impl_t mbdb_name_impls[] = {
+#ifdef MBDB_NAMES_SIMD
+	{ "sha", mbdb_name_compress_ni, 0 },
+	{ "avx2", mbdb_name_compress_avx2, 0 },
+#endif
+	{ "scalar", mbdb_name_compress_scalar, 1 },
+	{ NULL, NULL, 0 }
+};
+
+static mbdb_name_impl_t* mbdb_name_impl = &mbdb_name_impls[sizeof(mbdb_name_impls) / sizeof(mbdb_name_impls[0]) - 2];
+
+#ifdef MBDB_NAMES_SIMD
+__attribute__((constructor))
+static void mbdb_name_select_impl() {
+	__builtin_cpu_init();
+	mbdb_name_impls[0].supported = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+	mbdb_name_impls[1].supported = __builtin_cpu_supports("avx2");
+	mbdb_name_impl = mbdb_name_impls[0].supported ? &mbdb_name_impls[0]
+		: mbdb_name_impls[1].supported ? &mbdb_name_impls[1] : mbdb_name_impl;
+}
+#endif
+
+const char* mbdb_name_hash_impl() {
+	return mbdb_name_impl->name;
+}
+
+/* picks the compression by name, for benchmarks. Returns -1 if the
+   cpu doesn't have it. */
+int mbdb_name_hash_use(const char* impl) {
+	int i = 0;
+	if (!impl) {
+		return -1;
+	}
+	for (i = 0; mbdb_name_impls[i].name; i++) {
+		if (!strcmp(mbdb_name_impls[i].name, impl)) {
+			if (!mbdb_name_impls[i].supported) {
+				return -1;
+			}
+			mbdb_name_impl = &mbdb_name_impls[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void mbdb_name_hasher_init(mbdb_name_hasher_t* hasher) {
+	if (hasher) {
+		hasher->blocks = 0;
+	}
+}
+
+/* "domain-path" of one name, with the SHA1 padding */
+typedef struct mbdb_name_message_t {
+	const char* domain;
+	unsigned int domain_size;
+	const char* path;
+	unsigned int path_size;
+	unsigned int length;
+	unsigned int blocks;
+	unsigned int shared;            // leading blocks the same as the name before, not compressed again
+	unsigned int state[5];
+	unsigned char block[MBDB_NAME_SHARED_BLOCKS][64];
+	unsigned char tail[64];         // the current block past MBDB_NAME_SHARED_BLOCKS
+} mbdb_name_message_t;
+
+static void mbdb_name_message_init(mbdb_name_message_t* msg, const mbdb_name_key_t* key) {
+	msg->domain = key->domain;
+	msg->domain_size = (key->domain && key->domain_size != 0xFFFF) ? key->domain_size : 0;
+	msg->path = key->path;
+	msg->path_size = (key->path && key->path_size != 0xFFFF) ? key->path_size : 0;
+	msg->length = msg->domain_size + 1 + msg->path_size;
+	msg->blocks = (msg->length + 8) / 64 + 1;
+	msg->shared = 0;
+	memcpy(msg->state, mbdb_name_iv, sizeof(msg->state));
+}
+
+/* copies block n of the padded message out of its three pieces */
+static unsigned char* mbdb_name_message_block(mbdb_name_message_t* msg, unsigned int n) {
+	unsigned char* block = (n < MBDB_NAME_SHARED_BLOCKS) ? msg->block[n] : msg->tail;
+	unsigned int start = n * 64;
+	unsigned int end = start + 64;
+	unsigned int dash = msg->domain_size;
+	unsigned int from = 0;
+	unsigned int to = 0;
+
+	memset(block, '\0', 64);
+	if (start < dash) {
+		to = (end < dash) ? end : dash;
+		memcpy(block, msg->domain + start, to - start);
+	}
+	if (dash >= start && dash < end) {
+		block[dash - start] = '-';
+	}
+	from = (start > dash + 1) ? start : dash + 1;
+	to = (end < msg->length) ? end : msg->length;
+	if (from < to) {
+		memcpy(block + from - start, msg->path + from - dash - 1, to - from);
+	}
+	if (msg->length >= start && msg->length < end) {
+		block[msg->length - start] = 0x80;
+	}
+	if (n == msg->blocks - 1) {
+		unsigned long long bits = (unsigned long long) msg->length * 8;
+		int i = 0;
+		for (i = 0; i < 8; i++) {
+			block[56 + i] = (unsigned char) (bits >> (56 - i * 8));
+		}
+	}
+	return block;
+}
+
+/* Block by block over all names at once. A block that is the same as
+   the one of the name before (or of the last name of the batch before,
+   kept by hasher) takes the state after it instead of being compressed. */
+static void mbdb_name_hash_messages(mbdb_name_hasher_t* hasher, mbdb_name_message_t* msgs, unsigned int count) {
+	unsigned int* state[MBDB_NAME_BATCH];
+	const unsigned char* block[MBDB_NAME_BATCH];
+	unsigned int blocks = 0;
+	unsigned int n = 0;
+	unsigned int m = 0;
+	unsigned int k = 0;
+	mbdb_name_message_t* last = &msgs[count - 1];
+
+	for (m = 0; m < count; m++) {
+		if (msgs[m].blocks > blocks) {
+			blocks = msgs[m].blocks;
+		}
+	}
+	for (k = 0; k < blocks; k++) {
+		n = 0;
+		for (m = 0; m < count; m++) {
+			mbdb_name_message_t* msg = &msgs[m];
+			if (k >= msg->blocks) {
+				continue;
+			}
+			const unsigned char* data = mbdb_name_message_block(msg, k);
+			if (msg->shared == k && k < MBDB_NAME_SHARED_BLOCKS) {
+				if (m == 0) {
+					if (k < hasher->blocks && !memcmp(data, hasher->data[k], 64)) {
+						msg->shared++;
+					}
+				} else if (k < msgs[m - 1].blocks && !memcmp(data, msgs[m - 1].block[k], 64)) {
+					msg->shared++;
+				}
+				if (msg->shared > k) {
+					continue;
+				}
+			}
+			state[n] = msg->state;
+			block[n] = data;
+			n++;
+		}
+		mbdb_name_impl->compress(state, block, n);
+		// in order, so a chain of names sharing block k all get the first one's state
+		for (m = 0; m < count; m++) {
+			if (k < msgs[m].blocks && msgs[m].shared > k) {
+				memcpy(msgs[m].state, (m == 0) ? hasher->state[k] : msgs[m - 1].state, sizeof(msgs[m].state));
+			}
+		}
+		if (k < MBDB_NAME_SHARED_BLOCKS && k < last->blocks) {
+			memcpy(hasher->state[k], last->state, sizeof(hasher->state[k]));
+		}
+	}
+	hasher->blocks = (last->blocks < MBDB_NAME_SHARED_BLOCKS) ? last->blocks : MBDB_NAME_SHARED_BLOCKS;
+	memcpy(hasher->data, last->block, hasher->blocks * 64);
+}
+
+/* Hashes count names into count * MBDB_NAME_HASH_SIZE bytes at hashes */
+void mbdb_name_hash_batch(mbdb_name_hasher_t* hasher, const mbdb_name_key_t* keys, unsigned int count, unsigned char* hashes) {
+	mbdb_name_message_t msgs[MBDB_NAME_BATCH];
+	unsigned int done = 0;
+	unsigned int m = 0;
+	int i = 0;
+
+	if (!hasher || !keys || !hashes) {
+		return;
+	}
+	while (done < count) {
+		unsigned int size = (count - done < MBDB_NAME_BATCH) ? count - done : MBDB_NAME_BATCH;
+		for (m = 0; m < size; m++) {
+			mbdb_name_message_init(&msgs[m], &keys[done + m]);
+		}
+		mbdb_name_hash_messages(hasher, msgs, size);
+		for (m = 0; m < size; m++) {
+			unsigned char* hash = hashes + (done + m) * MBDB_NAME_HASH_SIZE;
+			for (i = 0; i < 5; i++) {
+				hash[i * 4] = (unsigned char) (msgs[m].state[i] >> 24);
+				hash[i * 4 + 1] = (unsigned char) (msgs[m].state[i] >> 16);
+				hash[i * 4 + 2] = (unsigned char) (msgs[m].state[i] >> 8);
+				hash[i * 4 + 3] = (unsigned char) msgs[m].state[i];
+			}
+		}
+		done += size;
+	}
+}
+
+void mbdb_name_hash(const char* domain, unsigned short domain_size, const char* path, unsigned short path_size, unsigned char* hash) {
+	mbdb_name_hasher_t hasher;
+	mbdb_name_key_t key;
+
+	key.domain = domain;
+	key.domain_size = domain_size;
+	key.path = path;
+	key.path_size = path_size;
+	mbdb_name_hasher_init(&hasher);
+	mbdb_name_hash_batch(&hasher, &key, 1, hash);
+}
+
+static const char mbdb_name_digits[] = "0123456789abcdef";
+
+/* MBDB_NAME_SIZE hex digits and a NUL into name */
+void mbdb_name_format(const unsigned char* hash, char* name) {
+	int i = 0;
+	for (i = 0; i < MBDB_NAME_HASH_SIZE; i++) {
+		name[i * 2] = mbdb_name_digits[hash[i] >> 4];
+		name[i * 2 + 1] = mbdb_name_digits[hash[i] & 0x0F];
+	}
+	name[MBDB_NAME_SIZE] = '\0';
+}
+
+static int mbdb_name_hex(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/* hash of a backup file name, leading directories are ignored */
+int mbdb_name_parse(const char* name, unsigned char* hash) {
+	int i = 0;
+
+	if (!name || !hash) {
+		return -1;
+	}
+	const char* base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	if (strlen(base) != MBDB_NAME_HASH_SIZE * 2) {
+		return -1;
+	}
+	for (i = 0; i < MBDB_NAME_HASH_SIZE; i++) {
+		int hi = mbdb_name_hex(base[i * 2]);
+		int lo = mbdb_name_hex(base[i * 2 + 1]);
+		if (hi < 0 || lo < 0) {
+			return -1;
+		}
+		hash[i] = (unsigned char) ((hi << 4) | lo);
+	}
+	return 0;
+}
+
+static int mbdb_names_compare(const void* p1, const void* p2) {
+	const mbdb_names_entry_t* e1 = (const mbdb_names_entry_t*) p1;
+	const mbdb_names_entry_t* e2 = (const mbdb_names_entry_t*) p2;
+	int res = memcmp(e1->hash, e2->hash, MBDB_NAME_HASH_SIZE);
+	if (res == 0) {
+		// duplicates resolve to the first record
+		res = (e1->record < e2->record) ? -1 : (e1->record > e2->record);
+	}
+	return res;
+}
+
+#define MBDB_NAMES_CHUNK 256 // keys gathered for one mbdb_name_hash_batch()
+
+mbdb_names_t* mbdb_names_build(struct mbdb_t* mbdb) {
+	mbdb_name_key_t keys[MBDB_NAMES_CHUNK];
+	unsigned char hashes[MBDB_NAMES_CHUNK * MBDB_NAME_HASH_SIZE];
+	mbdb_name_hasher_t hasher;
+	unsigned int count = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	if (!mbdb || mbdb->num_records < 0) {
+		return NULL;
+	}
+
+	mbdb_names_t* names = (mbdb_names_t*) malloc(sizeof(mbdb_names_t));
+	if (names == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(names, '\0', sizeof(mbdb_names_t));
+	names->count = (unsigned int) mbdb->num_records;
+	names->entries = (mbdb_names_entry_t*) malloc(names->count * sizeof(mbdb_names_entry_t) + 1);
+	if (names->entries == NULL) {
+		error("Allocation Error!\n");
+		free(names);
+		return NULL;
+	}
+
+	mbdb_name_hasher_init(&hasher);
+	for (i = 0; i < names->count; i += count) {
+		count = (names->count - i < MBDB_NAMES_CHUNK) ? names->count - i : MBDB_NAMES_CHUNK;
+		for (j = 0; j < count; j++) {
+			mbdb_name_key_t* key = &keys[j];
+			mbdb_get_record_key(mbdb, i + j, &key->domain, &key->domain_size, &key->path, &key->path_size);
+		}
+		mbdb_name_hash_batch(&hasher, keys, count, hashes);
+		for (j = 0; j < count; j++) {
+			memcpy(names->entries[i + j].hash, &hashes[j * MBDB_NAME_HASH_SIZE], MBDB_NAME_HASH_SIZE);
+			names->entries[i + j].record = i + j;
+		}
+	}
+	qsort(names->entries, names->count, sizeof(mbdb_names_entry_t), mbdb_names_compare);
+
+	return names;
+}
+
+int mbdb_names_find(const mbdb_names_t* names, const unsigned char* hash) {
+	if (!names || !hash) {
+		return -1;
+	}
+
+	// lower bound, so duplicates give the first record
+	unsigned int lo = 0;
+	unsigned int hi = names->count;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (memcmp(names->entries[mid].hash, hash, MBDB_NAME_HASH_SIZE) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < names->count && !memcmp(names->entries[lo].hash, hash, MBDB_NAME_HASH_SIZE)) {
+		return (int) names->entries[lo].record;
+	}
+	return -1;
+}
+
+void mbdb_names_free(mbdb_names_t* names) {
+	if (names) {
+		if (names->entries && !names->borrowed) {
+			free(names->entries);
+		}
+		free(names);
+	}
+}
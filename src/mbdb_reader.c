@@ -0,0 +1,208 @@
+/**
+  * libmbdb-1.0 - mbdb_reader.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_reader.h>
+
+#include <libcrippy-1.0/debug.h>
+
+static mbdb_reader_t* mbdb_reader_create() {
+	mbdb_reader_t* reader = (mbdb_reader_t*) malloc(sizeof(mbdb_reader_t));
+	if (reader == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(reader, '\0', sizeof(mbdb_reader_t));
+	reader->fd = -1;
+
+	reader->capacity = MBDB_READER_BUFFER_SIZE;
+	reader->buffer = (unsigned char*) malloc(reader->capacity);
+	reader->arena = mbdb_arena_create(0);
+	if (reader->buffer == NULL || reader->arena == NULL) {
+		error("Allocation Error!\n");
+		mbdb_reader_close(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+/* Moves the unconsumed bytes to the front of the buffer and reads more,
+   growing the buffer when a single record does not fit into it. */
+static int mbdb_reader_fill(mbdb_reader_t* reader) {
+	unsigned int pending = reader->end - reader->start;
+	ssize_t bytes = 0;
+
+	if (reader->eof) {
+		return 0;
+	}
+	if (reader->start > 0) {
+		memmove(reader->buffer, &reader->buffer[reader->start], pending);
+		reader->start = 0;
+		reader->end = pending;
+	}
+	if (reader->end == reader->capacity) {
+		unsigned char* buffer = (unsigned char*) realloc(reader->buffer, reader->capacity * 2);
+		if (buffer == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		reader->buffer = buffer;
+		reader->capacity *= 2;
+	}
+
+	if (reader->file) {
+		bytes = fread(&reader->buffer[reader->end], 1, reader->capacity - reader->end, reader->file);
+		if (bytes == 0 && ferror(reader->file)) {
+			error("Unable to read mbdb stream\n");
+			return -1;
+		}
+	} else {
+		do {
+			bytes = read(reader->fd, &reader->buffer[reader->end], reader->capacity - reader->end);
+		} while (bytes < 0 && errno == EINTR);
+		if (bytes < 0) {
+			error("Unable to read mbdb stream\n");
+			return -1;
+		}
+	}
+	if (bytes == 0) {
+		reader->eof = 1;
+	}
+	reader->end += bytes;
+	return (int) bytes;
+}
+
+static mbdb_reader_t* mbdb_reader_start(mbdb_reader_t* reader) {
+	while (reader->end < sizeof(mbdb_header_t)) {
+		if (mbdb_reader_fill(reader) <= 0) {
+			break;
+		}
+	}
+	if (reader->end < sizeof(mbdb_header_t)
+	 || memcmp(reader->buffer, MBDB_MAGIC, sizeof(mbdb_header_t)) != 0) {
+		error("Unable to identify this filetype\n");
+		mbdb_reader_close(reader);
+		return NULL;
+	}
+	reader->start = sizeof(mbdb_header_t);
+	reader->offset = sizeof(mbdb_header_t);
+	return reader;
+}
+
+mbdb_reader_t* mbdb_reader_open(const char* file) {
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		error("Unable to open mbdb file\n");
+		return NULL;
+	}
+	mbdb_reader_t* reader = mbdb_reader_open_fd(fd);
+	if (reader == NULL) {
+		close(fd);
+		return NULL;
+	}
+	reader->close_fd = 1;
+	return reader;
+}
+
+mbdb_reader_t* mbdb_reader_open_fd(int fd) {
+	mbdb_reader_t* reader = mbdb_reader_create();
+	if (reader == NULL) {
+		return NULL;
+	}
+	reader->fd = fd;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return mbdb_reader_start(reader);
+}
+
+mbdb_reader_t* mbdb_reader_open_file(FILE* file) {
+	mbdb_reader_t* reader = mbdb_reader_create();
+	if (reader == NULL) {
+		return NULL;
+	}
+	reader->file = file;
+	return mbdb_reader_start(reader);
+}
+
+int mbdb_reader_next(mbdb_reader_t* reader, const mbdb_record_t** record) {
+	int size = 0;
+
+	if (!reader || !record) {
+		return -1;
+	}
+	*record = NULL;
+
+	while (1) {
+		if (reader->end > reader->start) {
+			size = mbdb_record_scan(&reader->buffer[reader->start], reader->end - reader->start);
+			if (size > 0) {
+				break;
+			}
+		}
+		// the record is incomplete, pull in more data
+		int bytes = mbdb_reader_fill(reader);
+		if (bytes < 0) {
+			return -1;
+		}
+		if (bytes == 0) {
+			if (reader->end > reader->start) {
+				error("Truncated record at offset 0x%llx!\n", reader->offset);
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	// the previous record is not needed anymore
+	mbdb_arena_reset(reader->arena);
+	mbdb_record_t* rec = mbdb_record_parse_arena(reader->arena, &reader->buffer[reader->start], size, 1);
+	if (rec == NULL) {
+		error("Unable to parse record at offset 0x%llx!\n", reader->offset);
+		return -1;
+	}
+	reader->start += size;
+	reader->offset += size;
+	reader->index++;
+
+	*record = rec;
+	return 1;
+}
+
+void mbdb_reader_close(mbdb_reader_t* reader) {
+	if (reader) {
+		if (reader->close_fd && reader->fd >= 0) {
+			close(reader->fd);
+		}
+		if (reader->buffer) {
+			free(reader->buffer);
+		}
+		if (reader->arena) {
+			mbdb_arena_free(reader->arena);
+		}
+		free(reader);
+	}
+}
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include <libmbdb-1.0/mbdb.h>
 #include <libmbdb-1.0/mbdb_record.h>
@@ -38,102 +39,8 @@ mbdb_record_t* mbdb_record_create() {
 	return record;
 }
 
-mbdb_record_t* mbdb_record_parse(unsigned char* data) {
+void mbdb_record_decode_tail(mbdb_record_t* record, const unsigned char* data) {
 	unsigned int offset = 0;
-	mbdb_record_t* record = mbdb_record_create();
-	if (record == NULL) {
-		error("Unable to parse mbdb record\n");
-		return NULL;
-	}
-
-	// Parse Domain
-	unsigned short strsize = be16toh(*((unsigned short*)&data[offset]));
-	if (strsize > 0 && strsize < 0xFFFF) {
-		record->domain = (char*) malloc(strsize+1);
-		if (record->domain == NULL) {
-			error("Allocation Error!\n");
-			return NULL;
-		}
-		offset += 2;
-		memcpy(record->domain, &data[offset], strsize);
-		record->domain[strsize] = 0;
-		offset += strsize;
-	} else {
-		record->domain = NULL;
-		offset+=2;
-	}
-	record->domain_size = strsize;
-
-	// Parse Path
-	strsize = be16toh(*((unsigned short*)&data[offset]));
-	if (strsize > 0 && strsize < 0xFFFF) {
-		record->path = (char*) malloc(strsize+1);
-		if (record->path == NULL) {
-			error("Allocation Error!\n");
-			return NULL;
-		}
-		offset+=2;
-		memcpy(record->path, &data[offset], strsize);
-		record->path[strsize] = 0;
-		offset += strsize;
-	} else {
-		record->path = NULL;
-		offset+=2;
-	}
-	record->path_size = strsize;
-
-	// Parse Target
-	strsize = be16toh(*((unsigned short*) &data[offset]));
-	if (strsize > 0 && strsize < 0xFFFF) {
-		record->target = (char*) malloc(strsize+1);
-		if (record->target == NULL) {
-			error("Allocation Error!\n");
-			return NULL;
-		}
-		offset+=2;
-		memcpy(record->target, &data[offset], strsize);
-		record->target[strsize] = 0;
-		offset += strsize;
-	} else {
-		record->target = NULL;
-		offset+=2;
-	}
-	record->target_size = strsize;
-
-	// parse DataHash
-	strsize = be16toh(*((unsigned short*) &data[offset]));
-	if (strsize > 0 && strsize < 0xFFFF) {
-		record->datahash = (char*) malloc(strsize);
-		if (record->datahash == NULL) {
-			error("Allocation Error!\n");
-			return NULL;
-		}
-		offset+=2;
-		memcpy(record->datahash, &data[offset], strsize);
-		offset += strsize;
-	} else {
-		record->datahash = NULL;
-		offset+=2;
-	}
-	record->datahash_size = strsize;
-
-	// parse unknown1
-	strsize = be16toh(*((unsigned short*) &data[offset]));
-	if (strsize > 0 && strsize < 0xFFFF) {
-		record->unknown1 = (char*) malloc(strsize+1);
-		if (record->unknown1 == NULL) {
-			error("Allocation Error!\n");
-			return NULL;
-		}
-		offset+=2;
-		memcpy(record->unknown1, &data[offset], strsize);
-		record->unknown1[strsize] = 0;
-		offset += strsize;
-	} else {
-		record->unknown1 = NULL;
-		offset+=2;
-	}
-	record->unknown1_size = strsize;
 
 	record->mode = be16toh(*((unsigned short*) &data[offset]));
 	offset += 2;
@@ -166,34 +73,228 @@ mbdb_record_t* mbdb_record_parse(unsigned char* data) {
 	offset += 1;
 
 	record->property_count = *((unsigned char*) &data[offset]);
-	offset += 1;
+}
+
+static int mbdb_record_read_string(const unsigned char* data, unsigned int size, unsigned int* offset, char** str, unsigned short* str_size, int borrow, int terminate, mbdb_arena_t* arena) {
+	unsigned short strsize = 0;
+
+	if (size - *offset < 2) {
+		return -1;
+	}
+	strsize = be16toh(*((unsigned short*)&data[*offset]));
+	*offset += 2;
+	*str_size = strsize;
+	*str = NULL;
+	if (strsize == 0 || strsize == 0xFFFF) {
+		return 0;
+	}
+	if (size - *offset < strsize) {
+		return -1;
+	}
+	if (borrow) {
+		*str = (char*) &data[*offset];
+	} else if (arena) {
+		*str = mbdb_arena_memdup(arena, &data[*offset], strsize, terminate);
+		if (*str == NULL) {
+			return -1;
+		}
+	} else {
+		*str = (char*) malloc(strsize + (terminate ? 1 : 0));
+		if (*str == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		memcpy(*str, &data[*offset], strsize);
+		if (terminate) {
+			(*str)[strsize] = 0;
+		}
+	}
+	*offset += strsize;
+	return 0;
+}
+
+static int mbdb_record_decode(mbdb_record_t* record, const unsigned char* data, unsigned int size, int borrow, mbdb_arena_t* arena, mbdb_intern_t* domains) {
+	unsigned int offset = 0;
+
+	if (borrow || arena) {
+		record->flags |= MBDB_RECORD_BORROWED;
+	}
+	if (arena) {
+		record->flags |= MBDB_RECORD_ARENA;
+	}
+
+	char* str = NULL;
+	unsigned short strsize = 0;
+
+	// Parse Domain, interned domains are shared by every record of the manifest
+	if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow || domains, 1, arena) < 0) {
+		return -1;
+	}
+	if (domains && str) {
+		str = (char*) mbdb_intern_string(domains, str, strsize);
+		if (str == NULL) {
+			return -1;
+		}
+		record->flags |= MBDB_RECORD_INTERNED;
+	}
+	record->domain = str;
+	record->domain_size = strsize;
+
+	// Parse Path
+	if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 1, arena) < 0) {
+		return -1;
+	}
+	record->path = str;
+	record->path_size = strsize;
+
+	// Parse Target
+	if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 1, arena) < 0) {
+		return -1;
+	}
+	record->target = str;
+	record->target_size = strsize;
+
+	// parse DataHash
+	if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 0, arena) < 0) {
+		return -1;
+	}
+	record->datahash = str;
+	record->datahash_size = strsize;
+
+	// parse unknown1
+	if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 1, arena) < 0) {
+		return -1;
+	}
+	record->unknown1 = str;
+	record->unknown1_size = strsize;
+
+	if (size - offset < MBDB_RECORD_TAIL_SIZE) {
+		return -1;
+	}
+	mbdb_record_decode_tail(record, &data[offset]);
+	offset += MBDB_RECORD_TAIL_SIZE;
 
 	if (record->property_count > 0) {
-		record->properties = (mbdb_record_property_t**)malloc(sizeof(mbdb_record_property_t*) * record->property_count);
+		if (arena) {
+			record->properties = (mbdb_record_property_t**)mbdb_arena_alloc(arena, sizeof(mbdb_record_property_t*) * record->property_count);
+		} else {
+			record->properties = (mbdb_record_property_t**)malloc(sizeof(mbdb_record_property_t*) * record->property_count);
+		}
+		if (record->properties == NULL) {
+			error("Allocation Error!\n");
+			record->property_count = 0;
+			return -1;
+		}
+		memset(record->properties, '\0', sizeof(mbdb_record_property_t*) * record->property_count);
 		int i;
 		for (i = 0; i < record->property_count; i++) {
-			mbdb_record_property_t* prop = malloc(sizeof(mbdb_record_property_t));
-			prop->name_size = be16toh(*((unsigned short*)&data[offset]));
-			prop->name = (char*)malloc(prop->name_size+1);
-			offset+=2;
-			memcpy(prop->name, &data[offset], prop->name_size);
-			prop->name[prop->name_size] = 0;	
-			offset+=prop->name_size;
-
-			prop->value_size = be16toh(*((unsigned short*)&data[offset]));
-			prop->value = (char*)malloc(prop->value_size+1);
-			offset+=2;
-			memcpy(prop->value, &data[offset], prop->value_size);
-			prop->value[prop->value_size] = 0;
-			offset+=prop->value_size;
-
+			mbdb_record_property_t* prop = NULL;
+			if (arena) {
+				prop = (mbdb_record_property_t*)mbdb_arena_alloc(arena, sizeof(mbdb_record_property_t));
+			} else {
+				prop = (mbdb_record_property_t*)malloc(sizeof(mbdb_record_property_t));
+			}
+			if (prop == NULL) {
+				error("Allocation Error!\n");
+				return -1;
+			}
+			memset(prop, '\0', sizeof(mbdb_record_property_t));
 			record->properties[i] = prop;
+
+			if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 1, arena) < 0) {
+				return -1;
+			}
+			prop->name = str;
+			prop->name_size = strsize;
+
+			if (mbdb_record_read_string(data, size, &offset, &str, &strsize, borrow, 1, arena) < 0) {
+				return -1;
+			}
+			prop->value = str;
+			prop->value_size = strsize;
 		}
 	}
 	record->this_size = offset;
 
 	//mbdb_record_debug(record);
 
+	return 0;
+}
+
+int mbdb_record_scan(const unsigned char* data, unsigned int size) {
+	unsigned int offset = 0;
+	unsigned short strsize = 0;
+	int i;
+
+	// skip domain, path, target, datahash and unknown1
+	for (i = 0; i < 5; i++) {
+		if (size - offset < 2) {
+			return -1;
+		}
+		strsize = be16toh(*((unsigned short*)&data[offset]));
+		offset += 2;
+		if (strsize != 0xFFFF) {
+			if (size - offset < strsize) {
+				return -1;
+			}
+			offset += strsize;
+		}
+	}
+
+	// fixed size fields, the last byte is the property count
+	if (size - offset < MBDB_RECORD_TAIL_SIZE) {
+		return -1;
+	}
+	unsigned char property_count = data[offset + MBDB_RECORD_TAIL_SIZE - 1];
+	offset += MBDB_RECORD_TAIL_SIZE;
+
+	// property names and values
+	for (i = 0; i < property_count * 2; i++) {
+		if (size - offset < 2) {
+			return -1;
+		}
+		strsize = be16toh(*((unsigned short*)&data[offset]));
+		offset += 2;
+		if (strsize != 0xFFFF) {
+			if (size - offset < strsize) {
+				return -1;
+			}
+			offset += strsize;
+		}
+	}
+
+	return (int) offset;
+}
+
+mbdb_record_t* mbdb_record_parse(unsigned char* data) {
+	mbdb_record_t* record = mbdb_record_create();
+	if (record == NULL) {
+		error("Unable to parse mbdb record\n");
+		return NULL;
+	}
+
+	if (mbdb_record_decode(record, data, 0xFFFFFFFF, 0, NULL, NULL) < 0) {
+		error("Unable to parse mbdb record\n");
+		mbdb_record_free(record);
+		return NULL;
+	}
+
+	return record;
+}
+
+mbdb_record_t* mbdb_record_parse_view(const unsigned char* data, unsigned int size) {
+	mbdb_record_t* record = mbdb_record_create();
+	if (record == NULL) {
+		error("Unable to parse mbdb record\n");
+		return NULL;
+	}
+
+	if (mbdb_record_decode(record, data, size, 1, NULL, NULL) < 0) {
+		error("Unable to parse mbdb record\n");
+		mbdb_record_free(record);
+		return NULL;
+	}
+
 	return record;
 }
 
@@ -218,38 +319,206 @@ mbdb_record_t* mbdb_record_parse(unsigned char* data) {
  } __attribute__((__packed__));
  */
 
+mbdb_record_t* mbdb_record_parse_arena(mbdb_arena_t* arena, const unsigned char* data, unsigned int size, int borrow) {
+	return mbdb_record_parse_interned(arena, NULL, data, size, borrow);
+}
+
+mbdb_record_t* mbdb_record_parse_interned(mbdb_arena_t* arena, mbdb_intern_t* domains, const unsigned char* data, unsigned int size, int borrow) {
+	mbdb_record_t* record = (mbdb_record_t*) mbdb_arena_alloc(arena, sizeof(mbdb_record_t));
+	if (record == NULL) {
+		error("Unable to parse mbdb record\n");
+		return NULL;
+	}
+	memset(record, '\0', sizeof(mbdb_record_t));
+
+	// strings and properties come from the arena too,
+	// mbdb_record_free() leaves all of it to mbdb_arena_free()
+	if (mbdb_record_decode(record, data, size, borrow, arena, domains) < 0) {
+		error("Unable to parse mbdb record\n");
+		return NULL;
+	}
+
+	return record;
+}
+
 void mbdb_record_free(mbdb_record_t* record) {
 	if (record) {
-		if (record->domain) {
-			free(record->domain);
-		}
-		if (record->path) {
-			free(record->path);
-		}
-		if (record->target) {
-			free(record->target);
-		}
-		if (record->datahash) {
-			free(record->datahash);
-		}
-		if (record->unknown1) {
-			free(record->unknown1);
+		int owned = !(record->flags & MBDB_RECORD_BORROWED);
+		if (owned) {
+			if (record->domain && !(record->flags & MBDB_RECORD_INTERNED)) {
+				free(record->domain);
+			}
+			if (record->path) {
+				free(record->path);
+			}
+			if (record->target) {
+				free(record->target);
+			}
+			if (record->datahash) {
+				free(record->datahash);
+			}
+			if (record->unknown1) {
+				free(record->unknown1);
+			}
 		}
-		if (record->property_count > 0) {
+		if (record->property_count > 0 && record->properties) {
 			int i;
 			for (i = 0; i < record->property_count; i++) {
-				if (record->properties[i]->name) {
+				if (!record->properties[i]) {
+					continue;
+				}
+				if (owned && record->properties[i]->name) {
 					free(record->properties[i]->name);
 				}
-				if (record->properties[i]->value) {
+				if (owned && record->properties[i]->value) {
 					free(record->properties[i]->value);
 				}
-				free(record->properties[i]);
+				if (!(record->flags & MBDB_RECORD_ARENA)) {
+					free(record->properties[i]);
+				}
+			}
+			if (!(record->flags & MBDB_RECORD_ARENA)) {
+				free(record->properties);
+			}
+		}
+		if (!(record->flags & MBDB_RECORD_ARENA)) {
+			free(record);
+		}
+	}
+}
+
+static char* mbdb_record_copy_string(const char* str, unsigned short size, int terminate) {
+	char* copy = NULL;
+
+	if (str == NULL || size == 0 || size == 0xFFFF) {
+		return NULL;
+	}
+	copy = (char*) malloc(size + (terminate ? 1 : 0));
+	if (copy == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memcpy(copy, str, size);
+	if (terminate) {
+		copy[size] = 0;
+	}
+	return copy;
+}
+
+int mbdb_record_own(mbdb_record_t* record) {
+	if (!record) {
+		return -1;
+	}
+	if (!(record->flags & MBDB_RECORD_BORROWED)) {
+		return 0;
+	}
+
+	// the views point into the mbdb data or arena, swap them for private copies
+	record->domain = mbdb_record_copy_string(record->domain, record->domain_size, 1);
+	record->path = mbdb_record_copy_string(record->path, record->path_size, 1);
+	record->target = mbdb_record_copy_string(record->target, record->target_size, 1);
+	record->datahash = mbdb_record_copy_string(record->datahash, record->datahash_size, 0);
+	record->unknown1 = mbdb_record_copy_string(record->unknown1, record->unknown1_size, 1);
+	int i;
+	for (i = 0; i < record->property_count; i++) {
+		mbdb_record_property_t* prop = record->properties[i];
+		prop->name = mbdb_record_copy_string(prop->name, prop->name_size, 1);
+		prop->value = mbdb_record_copy_string(prop->value, prop->value_size, 1);
+	}
+	record->flags &= ~(MBDB_RECORD_BORROWED | MBDB_RECORD_INTERNED);
+
+	return 0;
+}
+
+mbdb_record_t* mbdb_record_copy(const mbdb_record_t* record) {
+	if (!record) {
+		return NULL;
+	}
+	mbdb_record_t* copy = mbdb_record_create();
+	if (copy == NULL) {
+		return NULL;
+	}
+
+	// the name cache may be half written by another thread, it's taken over once done
+	memcpy(copy, record, offsetof(mbdb_record_t, name_state));
+	if (__atomic_load_n(&record->name_state, __ATOMIC_ACQUIRE) == MBDB_RECORD_NAME_VALID) {
+		memcpy(copy->name_hash, record->name_hash, MBDB_NAME_HASH_SIZE);
+		copy->name_state = MBDB_RECORD_NAME_VALID;
+	}
+	copy->flags = 0;
+	copy->properties = NULL;
+	copy->domain = mbdb_record_copy_string(record->domain, record->domain_size, 1);
+	copy->path = mbdb_record_copy_string(record->path, record->path_size, 1);
+	copy->target = mbdb_record_copy_string(record->target, record->target_size, 1);
+	copy->datahash = mbdb_record_copy_string(record->datahash, record->datahash_size, 0);
+	copy->unknown1 = mbdb_record_copy_string(record->unknown1, record->unknown1_size, 1);
+	if (record->property_count > 0) {
+		copy->properties = (mbdb_record_property_t**)malloc(sizeof(mbdb_record_property_t*) * record->property_count);
+		if (copy->properties == NULL) {
+			error("Allocation Error!\n");
+			copy->property_count = 0;
+			mbdb_record_free(copy);
+			return NULL;
+		}
+		int i;
+		for (i = 0; i < record->property_count; i++) {
+			mbdb_record_property_t* prop = (mbdb_record_property_t*)malloc(sizeof(mbdb_record_property_t));
+			if (prop == NULL) {
+				error("Allocation Error!\n");
+				copy->property_count = i;
+				mbdb_record_free(copy);
+				return NULL;
 			}
-			free(record->properties);
+			prop->name_size = record->properties[i]->name_size;
+			prop->name = mbdb_record_copy_string(record->properties[i]->name, prop->name_size, 1);
+			prop->value_size = record->properties[i]->value_size;
+			prop->value = mbdb_record_copy_string(record->properties[i]->value, prop->value_size, 1);
+			copy->properties[i] = prop;
 		}
-		free(record);
 	}
+
+	return copy;
+}
+
+static int mbdb_record_string_equals(const char* str, unsigned short size, const char* other) {
+	if (size == 0xFFFF) {
+		size = 0;
+	}
+	if (other == NULL) {
+		return size == 0;
+	}
+	return strlen(other) == size && (size == 0 || memcmp(str, other, size) == 0);
+}
+
+/* The SHA1 of "domain-path", the name of the backup file with the data
+   of record. Hashed the first time and kept until mbdb_record_set_domain()
+   or mbdb_record_set_path(). Records shared by readers are fine: the
+   first one to get there stores the hash, the others don't wait. */
+void mbdb_record_get_name_hash(const mbdb_record_t* record, unsigned char* hash) {
+	// the cache doesn't change what the record is
+	mbdb_record_t* cache = (mbdb_record_t*) record;
+	unsigned char state = MBDB_RECORD_NAME_NONE;
+
+	if (!record || !hash) {
+		return;
+	}
+	if (__atomic_load_n(&cache->name_state, __ATOMIC_ACQUIRE) == MBDB_RECORD_NAME_VALID) {
+		memcpy(hash, cache->name_hash, MBDB_NAME_HASH_SIZE);
+		return;
+	}
+	mbdb_name_hash(record->domain, record->domain_size, record->path, record->path_size, hash);
+	if (__atomic_compare_exchange_n(&cache->name_state, &state, MBDB_RECORD_NAME_WRITING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		memcpy(cache->name_hash, hash, MBDB_NAME_HASH_SIZE);
+		__atomic_store_n(&cache->name_state, MBDB_RECORD_NAME_VALID, __ATOMIC_RELEASE);
+	}
+}
+
+int mbdb_record_matches(const mbdb_record_t* record, const char* domain, const char* path) {
+	if (!record) {
+		return 0;
+	}
+	return mbdb_record_string_equals(record->domain, record->domain_size, domain)
+		&& mbdb_record_string_equals(record->path, record->path_size, path);
 }
 
 void mbdb_record_debug(mbdb_record_t* record) {
@@ -287,6 +556,8 @@ void mbdb_record_init(mbdb_record_t* record)
 void mbdb_record_set_domain(mbdb_record_t* record, const char* domain)
 {
 	if (!record) return;
+	mbdb_record_own(record);
+	record->name_state = MBDB_RECORD_NAME_NONE;
 	unsigned short old_size = record->domain_size;
 	if (record->domain) {
 		free(record->domain);
@@ -307,6 +578,8 @@ void mbdb_record_set_domain(mbdb_record_t* record, const char* domain)
 void mbdb_record_set_path(mbdb_record_t* record, const char* path)
 {
 	if (!record) return;
+	mbdb_record_own(record);
+	record->name_state = MBDB_RECORD_NAME_NONE;
 	unsigned short old_size = record->path_size;
 	if (record->path) {
 		free(record->path);
@@ -327,6 +600,7 @@ void mbdb_record_set_path(mbdb_record_t* record, const char* path)
 void mbdb_record_set_target(mbdb_record_t* record, const char* target)
 {
 	if (!record) return;
+	mbdb_record_own(record);
 	unsigned short old_size = record->target_size;
 	if (record->target) {
 		free(record->target);
@@ -347,6 +621,7 @@ void mbdb_record_set_target(mbdb_record_t* record, const char* target)
 void mbdb_record_set_datahash(mbdb_record_t* record, const char* hash, unsigned short hash_size)
 {
 	if (!record) return;
+	mbdb_record_own(record);
 	unsigned short old_size = record->datahash_size;
 	if (record->datahash) {
 		free(record->datahash);
@@ -368,6 +643,7 @@ void mbdb_record_set_datahash(mbdb_record_t* record, const char* hash, unsigned
 void mbdb_record_set_unknown1(mbdb_record_t* record, const char* data, unsigned short size)
 {
 	if (!record) return;
+	mbdb_record_own(record);
 	unsigned short old_size = record->unknown1_size;
 	if (record->unknown1) {
 		free(record->unknown1);
@@ -446,138 +722,115 @@ void mbdb_record_set_flag(mbdb_record_t* record, unsigned char flag)
 	record->flag = flag;
 }
 
-int mbdb_record_build(mbdb_record_t* record, unsigned char** data, unsigned int* size) {
-	unsigned int offset = 0;
-	unsigned char* data_buf = NULL;
+/* bytes the record takes serialized, counted from its fields */
+static unsigned int mbdb_record_serialized_size(const mbdb_record_t* record) {
+	unsigned int size = 2+2+2+2+2+2+4+4+4+4+4+4+4+8+1+1;
+	int i;
 
-	if (!record) {
-		return -1;
+	size += record->domain ? record->domain_size : 0;
+	size += record->path ? record->path_size : 0;
+	size += record->target ? record->target_size : 0;
+	size += record->datahash ? record->datahash_size : 0;
+	size += record->unknown1 ? record->unknown1_size : 0;
+	for (i = 0; i < (int)record->property_count; i++) {
+		size += 2 + record->properties[i]->name_size + 2 + record->properties[i]->value_size;
 	}
+	return size;
+}
 
-	data_buf = (unsigned char*)malloc(record->this_size);
-	if (!data_buf) {
-		error("Allocation Error!\n");
-		return -1;
+static unsigned char* mbdb_record_put_string(unsigned char* cursor, const char* str, unsigned short size) {
+	unsigned short strsize = htobe16(size);
+	memcpy(cursor, &strsize, 2);
+	cursor += 2;
+	if (str != NULL) {
+		memcpy(cursor, str, size);
+		cursor += size;
 	}
+	return cursor;
+}
 
-	unsigned short strsize;
+static unsigned char* mbdb_record_put_int(unsigned char* cursor, unsigned int value) {
+	value = htobe32(value);
+	memcpy(cursor, &value, 4);
+	return cursor + 4;
+}
 
-	// append Domain
-	strsize = htobe16(record->domain_size);
-	memcpy(&data_buf[offset], &strsize, 2);
-	offset+=2;
-	if (record->domain != NULL) {
-		memcpy(&data_buf[offset], record->domain, record->domain_size);
-		offset+=record->domain_size;
-	}
+/* Serializes the record at cursor, which has room for size bytes.
+   Returns the number of bytes written, record->this_size. */
+int mbdb_record_serialize_into(const mbdb_record_t* record, unsigned char* cursor, unsigned int size) {
+	unsigned char* p = cursor;
+	int i;
 
-	// append Path
-	strsize = htobe16(record->path_size);
-	memcpy(&data_buf[offset], &strsize, 2);
-	offset+=2;
-	if (record->path != NULL) {
-		memcpy(&data_buf[offset], record->path, record->path_size);
-		offset+=record->path_size;
+	if (!record || !cursor) {
+		return -1;
 	}
-
-	// append Target
-	strsize = htobe16(record->target_size);
-	memcpy(&data_buf[offset], &strsize, 2);
-	offset+=2;
-	if (record->target != NULL) {
-		memcpy(&data_buf[offset], record->target, record->target_size);
-		offset+=record->target_size;
+	unsigned int needed = mbdb_record_serialized_size(record);
+	if (record->this_size != needed) {
+		error("%s: ERROR: inconsistent record size (present %d != created %d)\n", __func__, record->this_size, needed);
+		return -1;
 	}
-
-	// append DataHash
-	strsize = htobe16(record->datahash_size);
-	memcpy(&data_buf[offset], &strsize, 2);
-	offset+=2;
-	if (record->datahash != NULL) {
-		memcpy(&data_buf[offset], record->datahash, record->datahash_size);
-		offset+=record->datahash_size;
+	if (needed > size) {
+		return -1;
 	}
 
-	// append unknown1
-	strsize = htobe16(record->unknown1_size);
-	memcpy(&data_buf[offset], &strsize, 2);
-	offset+=2;
-	if (record->unknown1 != NULL) {
-		memcpy(&data_buf[offset], record->unknown1, record->unknown1_size);
-		offset+=record->unknown1_size;
-	}
+	p = mbdb_record_put_string(p, record->domain, record->domain_size);
+	p = mbdb_record_put_string(p, record->path, record->path_size);
+	p = mbdb_record_put_string(p, record->target, record->target_size);
+	p = mbdb_record_put_string(p, record->datahash, record->datahash_size);
+	p = mbdb_record_put_string(p, record->unknown1, record->unknown1_size);
 
 	unsigned short mode = htobe16(record->mode);
-	memcpy(&data_buf[offset], &mode, 2);
-	offset += 2;
-
-	int unknown2 = htobe32(record->unknown2);
-	memcpy(&data_buf[offset], &unknown2, 4);
-	offset += 4;
-
-	int inode = htobe32(record->inode);
-	memcpy(&data_buf[offset], &inode, 4);
-	offset += 4;
-
-	int uid = htobe32(record->uid);
-	memcpy(&data_buf[offset], &uid, 4);
-	offset += 4;
-
-	int gid = htobe32(record->gid);
-	memcpy(&data_buf[offset], &gid, 4);
-	offset += 4;
-
-	int time1 = htobe32(record->time1);
-	memcpy(&data_buf[offset], &time1, 4);
-	offset += 4;
-
-	int time2 = htobe32(record->time2);
-	memcpy(&data_buf[offset], &time2, 4);
-	offset += 4;
-
-	int time3 = htobe32(record->time3);
-	memcpy(&data_buf[offset], &time3, 4);
-	offset += 4;
-
+	memcpy(p, &mode, 2);
+	p += 2;
+	p = mbdb_record_put_int(p, record->unknown2);
+	p = mbdb_record_put_int(p, record->inode);
+	p = mbdb_record_put_int(p, record->uid);
+	p = mbdb_record_put_int(p, record->gid);
+	p = mbdb_record_put_int(p, record->time1);
+	p = mbdb_record_put_int(p, record->time2);
+	p = mbdb_record_put_int(p, record->time3);
 	unsigned long long length = htobe64(record->length);
-	memcpy(&data_buf[offset], &length, 8);
-	offset += 8;
-
-	unsigned char flag = record->flag;
-	memcpy(&data_buf[offset], &flag, 1);
-	offset++;
-
-	unsigned char prop = record->property_count;
-	memcpy(&data_buf[offset], &prop, 1);
-	offset++;
+	memcpy(p, &length, 8);
+	p += 8;
+	*p++ = record->flag;
+	*p++ = record->property_count;
 
-	// add properties
-	int i;
-	for (i = 0; i < (int)prop; i++) {
+	for (i = 0; i < (int)record->property_count; i++) {
 		mbdb_record_property_t* property = record->properties[i];
-
 		unsigned short pnsize = htobe16(property->name_size);
-		memcpy(&data_buf[offset], &pnsize, 2);
-		offset+=2;
-		memcpy(&data_buf[offset], property->name, property->name_size);
-		offset+=property->name_size;
-
+		memcpy(p, &pnsize, 2);
+		memcpy(p + 2, property->name, property->name_size);
+		p += 2 + property->name_size;
 		unsigned short pvsize = htobe16(property->value_size);
-		memcpy(&data_buf[offset], &pvsize, 2);
-		offset+=2;
-		memcpy(&data_buf[offset], property->value, property->value_size);
-		offset+=property->value_size;
+		memcpy(p, &pvsize, 2);
+		memcpy(p + 2, property->value, property->value_size);
+		p += 2 + property->value_size;
+	}
+
+	return (int)(p - cursor);
+}
+
+int mbdb_record_build(mbdb_record_t* record, unsigned char** data, unsigned int* size) {
+	if (!record) {
+		return -1;
+	}
+
+	unsigned char* data_buf = (unsigned char*)malloc(record->this_size);
+	if (!data_buf) {
+		error("Allocation Error!\n");
+		return -1;
 	}
 
-	if (record->this_size != offset) {
+	int written = mbdb_record_serialize_into(record, data_buf, record->this_size);
+	if (written < 0) {
+		free(data_buf);
 		*data = NULL;
 		*size = 0;
-		error("%s: ERROR: inconsistent record size (present %d != created %d)\n", __func__, record->this_size, offset);
 		return -1;
 	}
 
 	*data = data_buf;
-	*size = offset;
+	*size = (unsigned int)written;
 
 	return 0;
 }
@@ -0,0 +1,416 @@
+/**
+  * libmbdb-1.0 - mbdb_sidecar.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_sidecar.h>
+
+#include <libcrippy-1.0/debug.h>
+
+#define MBDB_SIDECAR_ALIGN(x) (((x) + 7) & ~7ULL)
+
+struct mbdb_sidecar_job_t {
+	mbdb_t snapshot;                // data and a copy of the offsets, nothing decoded
+	int reopen;                     // describe file as it is on the disk, not the snapshot
+	char* file;
+	pthread_t thread;
+	int started;
+};
+
+static char* mbdb_sidecar_path(const char* file) {
+	char* path = (char*) malloc(strlen(file) + strlen(MBDB_SIDECAR_SUFFIX) + 1);
+	if (path == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	strcpy(path, file);
+	strcat(path, MBDB_SIDECAR_SUFFIX);
+	return path;
+}
+
+/* cheap enough to check on every open, inode, size and mtime catch the rest */
+static void mbdb_sidecar_checksum(const unsigned char* data, unsigned int size, unsigned char* checksum) {
+	SHA_CTX ctx;
+	unsigned long long length = size;
+
+	unsigned int head = (size < MBDB_SIDECAR_SAMPLE) ? size : MBDB_SIDECAR_SAMPLE;
+	unsigned int tail = (size - head < MBDB_SIDECAR_SAMPLE) ? head : size - MBDB_SIDECAR_SAMPLE;
+
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, data, head);
+	SHA1_Update(&ctx, &data[tail], size - tail);
+	SHA1_Update(&ctx, &length, sizeof(length));
+	SHA1_Final(checksum, &ctx);
+}
+
+static int mbdb_sidecar_write_section(FILE* fd, unsigned long long* position, unsigned long long start, const void* data, size_t size) {
+	static const unsigned char padding[8];
+
+	if (start > *position && fwrite(padding, 1, start - *position, fd) != start - *position) {
+		return -1;
+	}
+	if (size > 0 && fwrite(data, 1, size, fd) != size) {
+		return -1;
+	}
+	*position = start + size;
+	return 0;
+}
+
+int mbdb_sidecar_write(struct mbdb_t* mbdb, const char* file) {
+	struct stat st;
+	mbdb_t raw;
+	mbdb_sidecar_header_t header;
+
+	if (!mbdb || !file || !mbdb->data || !mbdb->offsets || mbdb->edits) {
+		return -1;
+	}
+	// don't describe a manifest that changed since it was read
+	if (stat(file, &st) < 0 || (unsigned long long) st.st_size != mbdb->size) {
+		return -1;
+	}
+
+	// the index and names are built from the data alone, records that
+	// were changed in memory don't belong in a file describing the manifest
+	memset(&raw, '\0', sizeof(mbdb_t));
+	raw.data = mbdb->data;
+	raw.size = mbdb->size;
+	raw.offsets = mbdb->offsets;
+	raw.num_records = mbdb->num_records;
+
+	mbdb_index_t* index = mbdb_index_build(&raw);
+	mbdb_names_t* names = mbdb_names_build(&raw);
+	if (index == NULL || names == NULL) {
+		mbdb_index_free(index);
+		mbdb_names_free(names);
+		return -1;
+	}
+
+	memset(&header, '\0', sizeof(header));
+	memcpy(header.magic, MBDB_SIDECAR_MAGIC, sizeof(MBDB_SIDECAR_MAGIC));
+	header.version = MBDB_SIDECAR_VERSION;
+	header.byte_order = MBDB_SIDECAR_BYTE_ORDER;
+	header.header_size = sizeof(header);
+	header.num_records = (unsigned int) mbdb->num_records;
+	header.manifest_size = mbdb->size;
+	header.manifest_mtime = (long long) st.st_mtim.tv_sec;
+	header.manifest_mtime_nsec = (long long) st.st_mtim.tv_nsec;
+	header.manifest_inode = (unsigned long long) st.st_ino;
+	mbdb_sidecar_checksum(mbdb->data, mbdb->size, header.manifest_checksum);
+	header.index_slots = index->mask + 1;
+	header.index_count = index->count;
+	header.offsets_start = MBDB_SIDECAR_ALIGN(sizeof(header));
+	header.index_start = MBDB_SIDECAR_ALIGN(header.offsets_start + header.num_records * sizeof(unsigned int));
+	header.names_start = MBDB_SIDECAR_ALIGN(header.index_start + header.index_slots * sizeof(mbdb_index_slot_t));
+	header.total_size = header.names_start + header.num_records * sizeof(mbdb_names_entry_t);
+
+	// written aside and renamed, readers never see half a file
+	int res = -1;
+	char* path = mbdb_sidecar_path(file);
+	char* temp = path ? (char*) malloc(strlen(path) + 8) : NULL;
+	if (temp) {
+		strcpy(temp, path);
+		strcat(temp, ".XXXXXX");
+		int fd = mkstemp(temp);
+		if (fd >= 0) {
+			fchmod(fd, 0644);
+		}
+		FILE* out = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+		if (out) {
+			unsigned long long position = 0;
+			if (mbdb_sidecar_write_section(out, &position, 0, &header, sizeof(header)) == 0
+			 && mbdb_sidecar_write_section(out, &position, header.offsets_start, mbdb->offsets, header.num_records * sizeof(unsigned int)) == 0
+			 && mbdb_sidecar_write_section(out, &position, header.index_start, index->slots, header.index_slots * sizeof(mbdb_index_slot_t)) == 0
+			 && mbdb_sidecar_write_section(out, &position, header.names_start, names->entries, header.num_records * sizeof(mbdb_names_entry_t)) == 0
+			 && fflush(out) == 0 && fsync(fd) == 0) {
+				res = 0;
+			}
+			if (fclose(out) != 0) {
+				res = -1;
+			}
+		} else if (fd >= 0) {
+			close(fd);
+		}
+		if (res == 0 && rename(temp, path) < 0) {
+			res = -1;
+		}
+		if (res < 0 && fd >= 0) {
+			error("Unable to write %s\n", path);
+			unlink(temp);
+		}
+	}
+
+	free(temp);
+	free(path);
+	mbdb_index_free(index);
+	mbdb_names_free(names);
+	return res;
+}
+
+static int mbdb_sidecar_validate(struct mbdb_t* mbdb, const char* file, const unsigned char* map, size_t size) {
+	struct stat st;
+	unsigned int i = 0;
+	unsigned char checksum[20];
+	const mbdb_sidecar_header_t* header = (const mbdb_sidecar_header_t*) map;
+
+	if (size < sizeof(mbdb_sidecar_header_t)
+	 || memcmp(header->magic, MBDB_SIDECAR_MAGIC, sizeof(MBDB_SIDECAR_MAGIC)) != 0
+	 || header->version != MBDB_SIDECAR_VERSION
+	 || header->byte_order != MBDB_SIDECAR_BYTE_ORDER
+	 || header->header_size != sizeof(mbdb_sidecar_header_t)
+	 || header->total_size != size) {
+		return -1;
+	}
+
+	// does it still describe the manifest?
+	if (stat(file, &st) < 0
+	 || (unsigned long long) st.st_size != header->manifest_size
+	 || header->manifest_size != mbdb->size
+	 || (unsigned long long) st.st_ino != header->manifest_inode
+	 || (long long) st.st_mtim.tv_sec != header->manifest_mtime
+	 || (long long) st.st_mtim.tv_nsec != header->manifest_mtime_nsec) {
+		return -1;
+	}
+	mbdb_sidecar_checksum(mbdb->data, mbdb->size, checksum);
+	if (memcmp(checksum, header->manifest_checksum, sizeof(checksum)) != 0) {
+		return -1;
+	}
+
+	// sections in bounds, and values the lookups can trust
+	unsigned long long num_records = header->num_records;
+	unsigned long long slots = header->index_slots;
+	if (slots == 0 || (slots & (slots - 1)) != 0 || header->index_count > num_records
+	 || header->offsets_start < sizeof(mbdb_sidecar_header_t) || (header->offsets_start & 7)
+	 || header->offsets_start + num_records * sizeof(unsigned int) > header->index_start || (header->index_start & 7)
+	 || header->index_start + slots * sizeof(mbdb_index_slot_t) > header->names_start || (header->names_start & 7)
+	 || header->names_start + num_records * sizeof(mbdb_names_entry_t) > size) {
+		return -1;
+	}
+	// the columns and keys trust the record bounds the parse would have
+	// checked, each record has to end where the next one starts
+	const unsigned int* offsets = (const unsigned int*) &map[header->offsets_start];
+	unsigned int end = sizeof(mbdb_header_t);
+	for (i = 0; i < header->num_records; i++) {
+		if (offsets[i] != end) {
+			return -1;
+		}
+		int rec_size = mbdb_record_scan(&(mbdb->data)[end], mbdb->size - end);
+		if (rec_size <= 0) {
+			return -1;
+		}
+		end += (unsigned int) rec_size;
+	}
+	if (end != mbdb->size) {
+		return -1;
+	}
+	const mbdb_index_slot_t* index = (const mbdb_index_slot_t*) &map[header->index_start];
+	for (i = 0; i < header->index_slots; i++) {
+		if (index[i].record != MBDB_INDEX_DELETED && index[i].record > header->num_records) {
+			return -1;
+		}
+	}
+	const mbdb_names_entry_t* names = (const mbdb_names_entry_t*) &map[header->names_start];
+	for (i = 0; i < header->num_records; i++) {
+		if (names[i].record >= header->num_records) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Takes the record offsets, the (domain, path) index and the name hashes
+   from the sidecar of the manifest, if there is one and it's current. */
+int mbdb_sidecar_load(struct mbdb_t* mbdb, const char* file) {
+	struct stat st;
+
+	if (!mbdb || !file || !mbdb->data) {
+		return -1;
+	}
+	char* path = mbdb_sidecar_path(file);
+	if (path == NULL) {
+		return -1;
+	}
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(mbdb_sidecar_header_t)) {
+		close(fd);
+		return -1;
+	}
+	// private and writable, the index may still be updated in memory
+	void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	if (mbdb_sidecar_validate(mbdb, file, (const unsigned char*) map, st.st_size) < 0) {
+		debug("Sidecar index of %s is stale\n", file);
+		munmap(map, st.st_size);
+		return -1;
+	}
+	const mbdb_sidecar_header_t* header = (const mbdb_sidecar_header_t*) map;
+
+	mbdb->offsets = (unsigned int*) malloc(header->num_records * sizeof(unsigned int) + 1);
+	mbdb_index_t* index = (mbdb_index_t*) malloc(sizeof(mbdb_index_t));
+	mbdb_names_t* names = (mbdb_names_t*) malloc(sizeof(mbdb_names_t));
+	if (mbdb->offsets == NULL || index == NULL || names == NULL) {
+		error("Allocation Error!\n");
+		free(mbdb->offsets);
+		mbdb->offsets = NULL;
+		free(index);
+		free(names);
+		munmap(map, st.st_size);
+		return -1;
+	}
+	memcpy(mbdb->offsets, (unsigned char*) map + header->offsets_start, header->num_records * sizeof(unsigned int));
+	mbdb->num_records = (int) header->num_records;
+
+	memset(index, '\0', sizeof(mbdb_index_t));
+	index->slots = (mbdb_index_slot_t*) ((unsigned char*) map + header->index_start);
+	index->mask = header->index_slots - 1;
+	index->count = header->index_count;
+	index->used = header->index_count;
+	index->borrowed = 1;
+	mbdb->index = index;
+
+	memset(names, '\0', sizeof(mbdb_names_t));
+	names->entries = (mbdb_names_entry_t*) ((unsigned char*) map + header->names_start);
+	names->count = header->num_records;
+	names->borrowed = 1;
+	mbdb->names = names;
+
+	mbdb->sidecar = map;
+	mbdb->sidecar_size = st.st_size;
+	return 0;
+}
+
+static void* mbdb_sidecar_worker(void* arg) {
+	struct mbdb_sidecar_job_t* job = (struct mbdb_sidecar_job_t*) arg;
+	int res = -1;
+	if (job->reopen) {
+		// only the boundaries are needed, nothing gets decoded
+		mbdb_t* mbdb = mbdb_open_ex(job->file, MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY);
+		if (mbdb) {
+			res = mbdb_sidecar_write(mbdb, job->file);
+			mbdb_free(mbdb);
+		}
+	} else {
+		res = mbdb_sidecar_write(&job->snapshot, job->file);
+	}
+	if (res == 0) {
+		debug("Wrote sidecar index of %s\n", job->file);
+	}
+	return NULL;
+}
+
+static struct mbdb_sidecar_job_t* mbdb_sidecar_job_create(const char* file, unsigned int num_records) {
+	struct mbdb_sidecar_job_t* job = (struct mbdb_sidecar_job_t*) calloc(1, sizeof(struct mbdb_sidecar_job_t));
+	if (job == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	job->file = strdup(file);
+	job->snapshot.offsets = (unsigned int*) malloc(num_records * sizeof(unsigned int) + 1);
+	if (job->file == NULL || job->snapshot.offsets == NULL) {
+		error("Allocation Error!\n");
+		free(job->file);
+		free(job->snapshot.offsets);
+		free(job);
+		return NULL;
+	}
+	return job;
+}
+
+static void mbdb_sidecar_job_run(struct mbdb_t* mbdb, struct mbdb_sidecar_job_t* job) {
+	mbdb->sidecar_job = job;
+	job->started = (pthread_create(&job->thread, NULL, mbdb_sidecar_worker, job) == 0);
+	if (!job->started) {
+		mbdb_sidecar_worker(job);
+	}
+}
+
+/* regenerates the sidecar on a background thread, mbdb_free() waits for it */
+int mbdb_sidecar_start(struct mbdb_t* mbdb, const char* file) {
+	if (!mbdb || !file || mbdb->sidecar_job || mbdb->edits) {
+		return -1;
+	}
+
+	struct mbdb_sidecar_job_t* job = mbdb_sidecar_job_create(file, mbdb->num_records);
+	if (job == NULL) {
+		return -1;
+	}
+	// the data stays put until mbdb_free(), the offsets may not
+	memcpy(job->snapshot.offsets, mbdb->offsets, mbdb->num_records * sizeof(unsigned int));
+	job->snapshot.num_records = mbdb->num_records;
+	job->snapshot.data = mbdb->data;
+	job->snapshot.size = mbdb->size;
+	mbdb_sidecar_job_run(mbdb, job);
+	return 0;
+}
+
+/* Like mbdb_sidecar_start(), for a file that mbdb was just written to.
+   The records in memory no longer match their offsets in the data,
+   the worker maps the new file and scans it instead. */
+int mbdb_sidecar_refresh(struct mbdb_t* mbdb, const char* file) {
+	if (!mbdb || !file) {
+		return -1;
+	}
+	mbdb_sidecar_wait(mbdb);
+
+	struct mbdb_sidecar_job_t* job = mbdb_sidecar_job_create(file, 0);
+	if (job == NULL) {
+		return -1;
+	}
+	job->reopen = 1;
+	mbdb_sidecar_job_run(mbdb, job);
+	return 0;
+}
+
+void mbdb_sidecar_wait(struct mbdb_t* mbdb) {
+	if (mbdb && mbdb->sidecar_job) {
+		struct mbdb_sidecar_job_t* job = mbdb->sidecar_job;
+		if (job->started) {
+			pthread_join(job->thread, NULL);
+		}
+		free(job->snapshot.offsets);
+		free(job->file);
+		free(job);
+		mbdb->sidecar_job = NULL;
+	}
+}
+
+/* the index and names borrowed from the sidecar must be gone by now */
+void mbdb_sidecar_close(struct mbdb_t* mbdb) {
+	if (mbdb && mbdb->sidecar) {
+		munmap(mbdb->sidecar, mbdb->sidecar_size);
+		mbdb->sidecar = NULL;
+		mbdb->sidecar_size = 0;
+	}
+}
@@ -0,0 +1,450 @@
+/**
+  * libmbdb-1.0 - mbdb_snapshot.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_snapshot.h>
+
+#include <libcrippy-1.0/debug.h>
+
+#define MBDB_SNAPSHOT_MIN_SLOTS 16
+
+/* Versions from the oldest one still read to the current one. A version
+   is reclaimed once it has no readers and every older one is gone, with
+   it go the pages, shards and records no newer version has. */
+struct mbdb_snapshots_t {
+	pthread_mutex_t lock;
+	mbdb_snapshot_t* oldest;
+	mbdb_snapshot_t* current;
+	mbdb_record_t** retired;        // dropped from the table since the last publish
+	unsigned int num_retired;
+};
+
+/* appends to a list that doubles whenever its count hits a power of two */
+static int mbdb_snapshot_push(void*** list, unsigned int* count, void* item) {
+	if ((*count & (*count - 1)) == 0) {
+		void** grown = (void**) realloc(*list, (*count ? *count * 2 : 1) * sizeof(void*));
+		if (grown == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		*list = grown;
+	}
+	(*list)[(*count)++] = item;
+	return 0;
+}
+
+static unsigned int mbdb_snapshot_hash(const mbdb_record_t* record) {
+	unsigned short domain_size = (record->domain_size == 0xFFFF) ? 0 : record->domain_size;
+	unsigned short path_size = (record->path_size == 0xFFFF) ? 0 : record->path_size;
+	return mbdb_index_hash(record->domain, domain_size, record->path, path_size);
+}
+
+/* a private copy of shard with room for count entries, deleted ones dropped */
+static mbdb_snapshot_shard_t* mbdb_snapshot_shard_copy(const mbdb_snapshot_shard_t* shard, unsigned int count) {
+	unsigned int i = 0;
+	unsigned int size = MBDB_SNAPSHOT_MIN_SLOTS;
+	while (size < count * 2) {
+		size *= 2;
+	}
+	mbdb_snapshot_shard_t* copy = (mbdb_snapshot_shard_t*) calloc(1, sizeof(mbdb_snapshot_shard_t) + (size - 1) * sizeof(mbdb_snapshot_slot_t));
+	if (copy == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	copy->mask = size - 1;
+	for (i = 0; shard && i <= shard->mask; i++) {
+		const mbdb_snapshot_slot_t* slot = &shard->slots[i];
+		if (slot->record && slot->record != MBDB_SNAPSHOT_DELETED) {
+			unsigned int pos = slot->hash & copy->mask;
+			while (copy->slots[pos].record) {
+				pos = (pos + 1) & copy->mask;
+			}
+			copy->slots[pos] = *slot;
+			copy->count++;
+		}
+	}
+	copy->used = copy->count;
+	return copy;
+}
+
+/* the shard of hash in next, copied from prev on first touch */
+static mbdb_snapshot_shard_t* mbdb_snapshot_touch(mbdb_snapshot_t* next, mbdb_snapshot_t* prev, unsigned int hash, void*** garbage, unsigned int* num_garbage) {
+	unsigned int k = hash >> 24;
+	mbdb_snapshot_shard_t* shared = prev ? prev->shards[k] : NULL;
+	if (next->shards[k] && next->shards[k] != shared) {
+		return next->shards[k];
+	}
+	mbdb_snapshot_shard_t* copy = mbdb_snapshot_shard_copy(shared, shared ? shared->count + 1 : 1);
+	if (copy == NULL) {
+		return NULL;
+	}
+	if (shared && mbdb_snapshot_push(garbage, num_garbage, shared) < 0) {
+		free(copy);
+		return NULL;
+	}
+	next->shards[k] = copy;
+	return copy;
+}
+
+static int mbdb_snapshot_insert(mbdb_snapshot_t* next, mbdb_snapshot_t* prev, const mbdb_record_t* record, void*** garbage, unsigned int* num_garbage) {
+	unsigned int hash = mbdb_snapshot_hash(record);
+	mbdb_snapshot_shard_t* shard = mbdb_snapshot_touch(next, prev, hash, garbage, num_garbage);
+	if (shard == NULL) {
+		return -1;
+	}
+	if ((shard->used + 1) * 2 > shard->mask + 1) {
+		// private to next already, nobody else holds the old one
+		mbdb_snapshot_shard_t* grown = mbdb_snapshot_shard_copy(shard, shard->count + 1);
+		if (grown == NULL) {
+			return -1;
+		}
+		free(shard);
+		next->shards[hash >> 24] = shard = grown;
+	}
+	unsigned int pos = hash & shard->mask;
+	while (shard->slots[pos].record && shard->slots[pos].record != MBDB_SNAPSHOT_DELETED) {
+		pos = (pos + 1) & shard->mask;
+	}
+	if (shard->slots[pos].record == NULL) {
+		shard->used++;
+	}
+	shard->slots[pos].hash = hash;
+	shard->slots[pos].record = record;
+	shard->count++;
+	return 0;
+}
+
+static int mbdb_snapshot_remove(mbdb_snapshot_t* next, mbdb_snapshot_t* prev, const mbdb_record_t* record, void*** garbage, unsigned int* num_garbage) {
+	unsigned int hash = mbdb_snapshot_hash(record);
+	mbdb_snapshot_shard_t* shard = mbdb_snapshot_touch(next, prev, hash, garbage, num_garbage);
+	if (shard == NULL) {
+		return -1;
+	}
+	unsigned int pos = hash & shard->mask;
+	while (shard->slots[pos].record) {
+		if (shard->slots[pos].record == record) {
+			shard->slots[pos].record = MBDB_SNAPSHOT_DELETED;
+			shard->count--;
+			break;
+		}
+		pos = (pos + 1) & shard->mask;
+	}
+	return 0;
+}
+
+static unsigned int mbdb_snapshot_page_count(unsigned int num_records, unsigned int page) {
+	unsigned int first = page * MBDB_SNAPSHOT_PAGE;
+	return (num_records - first < MBDB_SNAPSHOT_PAGE) ? num_records - first : MBDB_SNAPSHOT_PAGE;
+}
+
+/* frees what only this version had, the pages and shards it shares with newer ones stay */
+static void mbdb_snapshot_destroy(mbdb_snapshot_t* snapshot) {
+	unsigned int i = 0;
+	for (i = 0; i < snapshot->num_garbage; i++) {
+		free(snapshot->garbage[i]);
+	}
+	for (i = 0; i < snapshot->num_retired; i++) {
+		mbdb_record_free(snapshot->retired[i]);
+	}
+	free(snapshot->garbage);
+	free(snapshot->retired);
+	free(snapshot->pages);
+	free(snapshot);
+}
+
+/* with the lock held */
+static void mbdb_snapshot_reclaim(struct mbdb_snapshots_t* owner) {
+	while (owner->oldest && owner->oldest != owner->current && owner->oldest->refs == 0) {
+		mbdb_snapshot_t* snapshot = owner->oldest;
+		owner->oldest = snapshot->next;
+		mbdb_snapshot_destroy(snapshot);
+	}
+}
+
+/* drops the pages and shards next made for itself, when publishing fails */
+static void mbdb_snapshot_discard(mbdb_snapshot_t* next, mbdb_snapshot_t* prev) {
+	unsigned int i = 0;
+	for (i = 0; i < next->num_pages; i++) {
+		if (next->pages[i] && !(prev && i < prev->num_pages && prev->pages[i] == next->pages[i])) {
+			free(next->pages[i]);
+		}
+	}
+	for (i = 0; i < MBDB_SNAPSHOT_SHARDS; i++) {
+		if (next->shards[i] && !(prev && prev->shards[i] == next->shards[i])) {
+			free(next->shards[i]);
+		}
+	}
+	free(next->garbage);
+	free(next->pages);
+	free(next);
+}
+
+/* Publishes the records as they are now as the next version, for
+   mbdb_snapshot_acquire(). Only pages that changed since the version
+   before are copied, and only the lookup shards of their records.
+   The first publish has to happen before readers start; records in a
+   published version must be replaced, never changed in place. */
+int mbdb_snapshot_publish(mbdb_t* mbdb) {
+	unsigned int i = 0;
+	unsigned int p = 0;
+	void** garbage = NULL;
+	unsigned int num_garbage = 0;
+	int changed = 0;
+
+	if (!mbdb || !mbdb->records || mbdb->batch) {
+		return -1;
+	}
+	if (mbdb_compact(mbdb) < 0) {
+		return -1;
+	}
+	// readers never decode, everything they can reach is decoded here
+	for (i = 0; i < (unsigned int) mbdb->num_records; i++) {
+		if (mbdb->records[i] == NULL && mbdb_get_record(mbdb, i) == NULL) {
+			return -1;
+		}
+	}
+
+	struct mbdb_snapshots_t* owner = mbdb->snapshots;
+	if (owner == NULL) {
+		owner = (struct mbdb_snapshots_t*) calloc(1, sizeof(struct mbdb_snapshots_t));
+		if (owner == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		pthread_mutex_init(&owner->lock, NULL);
+		mbdb->snapshots = owner;
+	}
+	// only the writer ever changes current, no lock needed to read it
+	mbdb_snapshot_t* prev = owner->current;
+
+	mbdb_snapshot_t* next = (mbdb_snapshot_t*) calloc(1, sizeof(mbdb_snapshot_t));
+	unsigned int num_records = (unsigned int) mbdb->num_records;
+	unsigned int num_pages = (num_records + MBDB_SNAPSHOT_PAGE - 1) / MBDB_SNAPSHOT_PAGE;
+	if (next) {
+		next->pages = (mbdb_snapshot_page_t**) calloc(num_pages + 1, sizeof(mbdb_snapshot_page_t*));
+	}
+	if (next == NULL || next->pages == NULL) {
+		error("Allocation Error!\n");
+		free(next);
+		return -1;
+	}
+	next->version = prev ? prev->version + 1 : 1;
+	next->num_records = num_records;
+	next->num_pages = num_pages;
+	next->owner = owner;
+	if (prev) {
+		memcpy(next->shards, prev->shards, sizeof(next->shards));
+	}
+
+	// pages that changed, and the records they no longer have
+	for (p = 0; p < num_pages; p++) {
+		mbdb_snapshot_page_t* old = (prev && p < prev->num_pages) ? prev->pages[p] : NULL;
+		unsigned int count = mbdb_snapshot_page_count(num_records, p);
+		unsigned int old_count = old ? mbdb_snapshot_page_count(prev->num_records, p) : 0;
+		mbdb_record_t** records = &mbdb->records[p * MBDB_SNAPSHOT_PAGE];
+		if (old && count == old_count && !memcmp(old->records, records, count * sizeof(mbdb_record_t*))) {
+			next->pages[p] = old;
+			continue;
+		}
+		mbdb_snapshot_page_t* page = (mbdb_snapshot_page_t*) calloc(1, sizeof(mbdb_snapshot_page_t));
+		next->pages[p] = page;
+		if (page == NULL || (old && mbdb_snapshot_push(&garbage, &num_garbage, old) < 0)) {
+			goto failed;
+		}
+		memcpy(page->records, records, count * sizeof(mbdb_record_t*));
+		changed = 1;
+		for (i = 0; i < old_count; i++) {
+			if (old->records[i] != page->records[i]
+			 && mbdb_snapshot_remove(next, prev, old->records[i], &garbage, &num_garbage) < 0) {
+				goto failed;
+			}
+		}
+	}
+	for (p = num_pages; prev && p < prev->num_pages; p++) {
+		mbdb_snapshot_page_t* old = prev->pages[p];
+		unsigned int old_count = mbdb_snapshot_page_count(prev->num_records, p);
+		if (mbdb_snapshot_push(&garbage, &num_garbage, old) < 0) {
+			goto failed;
+		}
+		changed = 1;
+		for (i = 0; i < old_count; i++) {
+			if (mbdb_snapshot_remove(next, prev, old->records[i], &garbage, &num_garbage) < 0) {
+				goto failed;
+			}
+		}
+	}
+	// records that moved are removed above and inserted again here
+	for (p = 0; p < num_pages; p++) {
+		mbdb_snapshot_page_t* old = (prev && p < prev->num_pages) ? prev->pages[p] : NULL;
+		if (old == next->pages[p]) {
+			continue;
+		}
+		unsigned int count = mbdb_snapshot_page_count(num_records, p);
+		unsigned int old_count = old ? mbdb_snapshot_page_count(prev->num_records, p) : 0;
+		for (i = 0; i < count; i++) {
+			if ((i >= old_count || old->records[i] != next->pages[p]->records[i])
+			 && mbdb_snapshot_insert(next, prev, next->pages[p]->records[i], &garbage, &num_garbage) < 0) {
+				goto failed;
+			}
+		}
+	}
+
+	if (prev && !changed && owner->num_retired == 0) {
+		// nothing new to publish
+		free(garbage);
+		free(next->pages);
+		free(next);
+		return 0;
+	}
+
+	pthread_mutex_lock(&owner->lock);
+	if (prev) {
+		// prev and older versions may still read all of these
+		prev->garbage = garbage;
+		prev->num_garbage = num_garbage;
+		prev->retired = owner->retired;
+		prev->num_retired = owner->num_retired;
+		prev->next = next;
+	} else {
+		owner->oldest = next;
+	}
+	owner->retired = NULL;
+	owner->num_retired = 0;
+	owner->current = next;
+	mbdb_snapshot_reclaim(owner);
+	pthread_mutex_unlock(&owner->lock);
+	return 0;
+
+failed:
+	error("Unable to publish snapshot\n");
+	next->garbage = NULL;
+	free(garbage);
+	mbdb_snapshot_discard(next, prev);
+	return -1;
+}
+
+/* the current version, NULL if none was published; give it back with mbdb_snapshot_release() */
+mbdb_snapshot_t* mbdb_snapshot_acquire(mbdb_t* mbdb) {
+	struct mbdb_snapshots_t* owner = mbdb ? mbdb->snapshots : NULL;
+	if (owner == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&owner->lock);
+	mbdb_snapshot_t* snapshot = owner->current;
+	if (snapshot) {
+		snapshot->refs++;
+	}
+	pthread_mutex_unlock(&owner->lock);
+	return snapshot;
+}
+
+void mbdb_snapshot_release(mbdb_snapshot_t* snapshot) {
+	if (snapshot) {
+		struct mbdb_snapshots_t* owner = snapshot->owner;
+		pthread_mutex_lock(&owner->lock);
+		snapshot->refs--;
+		mbdb_snapshot_reclaim(owner);
+		pthread_mutex_unlock(&owner->lock);
+	}
+}
+
+const mbdb_record_t* mbdb_snapshot_get_record(mbdb_snapshot_t* snapshot, unsigned int index) {
+	if (!snapshot || index >= snapshot->num_records) {
+		return NULL;
+	}
+	return snapshot->pages[index / MBDB_SNAPSHOT_PAGE]->records[index % MBDB_SNAPSHOT_PAGE];
+}
+
+const mbdb_record_t* mbdb_snapshot_find_record(mbdb_snapshot_t* snapshot, const char* domain, const char* path) {
+	if (!snapshot) {
+		return NULL;
+	}
+	unsigned short domain_size = domain ? strlen(domain) : 0;
+	unsigned short path_size = path ? strlen(path) : 0;
+	unsigned int hash = mbdb_index_hash(domain, domain_size, path, path_size);
+	const mbdb_snapshot_shard_t* shard = snapshot->shards[hash >> 24];
+	if (shard == NULL) {
+		return NULL;
+	}
+	unsigned int pos = hash & shard->mask;
+	while (shard->slots[pos].record) {
+		const mbdb_record_t* record = shard->slots[pos].record;
+		if (record != MBDB_SNAPSHOT_DELETED && shard->slots[pos].hash == hash) {
+			unsigned short dsize = (record->domain_size == 0xFFFF) ? 0 : record->domain_size;
+			unsigned short psize = (record->path_size == 0xFFFF) ? 0 : record->path_size;
+			if (dsize == domain_size && psize == path_size
+			 && (dsize == 0 || !memcmp(record->domain, domain, dsize))
+			 && (psize == 0 || !memcmp(record->path, path, psize))) {
+				return record;
+			}
+		}
+		pos = (pos + 1) & shard->mask;
+	}
+	return NULL;
+}
+
+/* Takes a record the table dropped, it is freed once no version can
+   reach it anymore. Returns -1 if there are no snapshots. */
+int mbdb_snapshot_retire(mbdb_t* mbdb, mbdb_record_t* record) {
+	struct mbdb_snapshots_t* owner = mbdb ? mbdb->snapshots : NULL;
+	if (owner == NULL) {
+		return -1;
+	}
+	// only the writer touches the list; a record that doesn't fit leaks rather than being freed under a reader
+	mbdb_snapshot_push((void***) &owner->retired, &owner->num_retired, record);
+	return 0;
+}
+
+/* for mbdb_free(), readers must have released their snapshots by then */
+void mbdb_snapshot_free_all(mbdb_t* mbdb) {
+	unsigned int i = 0;
+	struct mbdb_snapshots_t* owner = mbdb ? mbdb->snapshots : NULL;
+	if (owner == NULL) {
+		return;
+	}
+	mbdb_snapshot_t* current = owner->current;
+	if (current) {
+		for (i = 0; i < current->num_pages; i++) {
+			free(current->pages[i]);
+		}
+		for (i = 0; i < MBDB_SNAPSHOT_SHARDS; i++) {
+			free(current->shards[i]);
+		}
+	}
+	while (owner->oldest) {
+		mbdb_snapshot_t* snapshot = owner->oldest;
+		owner->oldest = snapshot->next;
+		if (snapshot->refs) {
+			error("Snapshot %u still has %d readers\n", snapshot->version, snapshot->refs);
+		}
+		mbdb_snapshot_destroy(snapshot);
+	}
+	for (i = 0; i < owner->num_retired; i++) {
+		mbdb_record_free(owner->retired[i]);
+	}
+	free(owner->retired);
+	pthread_mutex_destroy(&owner->lock);
+	free(owner);
+	mbdb->snapshots = NULL;
+}
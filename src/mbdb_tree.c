@@ -0,0 +1,437 @@
+/**
+  * libmbdb-1.0 - mbdb_tree.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  * Copyright (C) 2010-2013 Joshua Hill
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_tree.h>
+
+#include <libcrippy-1.0/debug.h>
+
+typedef struct mbdb_tree_builder_t {
+	mbdb_tree_t* tree;
+	unsigned int capacity;
+	unsigned int* slots;            // node index, 0 if empty (the root is never a child)
+	unsigned int mask;
+} mbdb_tree_builder_t;
+
+typedef struct mbdb_tree_sort_key_t {
+	unsigned int parent;
+	unsigned int node;
+	const char* name;
+	unsigned short name_size;
+} mbdb_tree_sort_key_t;
+
+static int mbdb_tree_compare_names(const char* a, unsigned short a_size, const char* b, unsigned short b_size) {
+	int res = memcmp(a, b, (a_size < b_size) ? a_size : b_size);
+	if (res == 0) {
+		res = (int) a_size - (int) b_size;
+	}
+	return res;
+}
+
+static int mbdb_tree_compare_keys(const void* p1, const void* p2) {
+	const mbdb_tree_sort_key_t* k1 = (const mbdb_tree_sort_key_t*) p1;
+	const mbdb_tree_sort_key_t* k2 = (const mbdb_tree_sort_key_t*) p2;
+	if (k1->parent != k2->parent) {
+		return (k1->parent < k2->parent) ? -1 : 1;
+	}
+	return mbdb_tree_compare_names(k1->name, k1->name_size, k2->name, k2->name_size);
+}
+
+static unsigned int mbdb_tree_hash(unsigned int parent, const char* name, unsigned short size) {
+	// FNV-1a over the name, seeded with the parent
+	unsigned int hash = 2166136261u ^ (parent * 0x9E3779B1u);
+	unsigned short i = 0;
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int mbdb_tree_rehash(mbdb_tree_builder_t* builder, unsigned int size) {
+	unsigned int i = 0;
+	mbdb_tree_t* tree = builder->tree;
+
+	unsigned int* slots = (unsigned int*) calloc(size, sizeof(unsigned int));
+	if (slots == NULL) {
+		error("Allocation Error!\n");
+		return -1;
+	}
+	free(builder->slots);
+	builder->slots = slots;
+	builder->mask = size - 1;
+	for (i = 1; i < tree->num_nodes; i++) {
+		mbdb_tree_node_t* node = &tree->nodes[i];
+		unsigned int slot = mbdb_tree_hash(node->parent, node->name, node->name_size) & builder->mask;
+		while (builder->slots[slot]) {
+			slot = (slot + 1) & builder->mask;
+		}
+		builder->slots[slot] = i;
+	}
+	return 0;
+}
+
+/* child of parent with the given name, created if it doesn't exist yet */
+static int mbdb_tree_add_child(mbdb_tree_builder_t* builder, unsigned int parent, const char* name, unsigned short size) {
+	mbdb_tree_t* tree = builder->tree;
+
+	unsigned int hash = mbdb_tree_hash(parent, name, size);
+	unsigned int slot = hash & builder->mask;
+	while (builder->slots[slot]) {
+		mbdb_tree_node_t* node = &tree->nodes[builder->slots[slot]];
+		if (node->parent == parent && node->name_size == size && !memcmp(node->name, name, size)) {
+			return (int) builder->slots[slot];
+		}
+		slot = (slot + 1) & builder->mask;
+	}
+
+	if (tree->num_nodes == builder->capacity) {
+		unsigned int capacity = builder->capacity * 2;
+		mbdb_tree_node_t* nodes = (mbdb_tree_node_t*) realloc(tree->nodes, capacity * sizeof(mbdb_tree_node_t));
+		if (nodes == NULL) {
+			error("Allocation Error!\n");
+			return -1;
+		}
+		tree->nodes = nodes;
+		builder->capacity = capacity;
+	}
+
+	unsigned int index = tree->num_nodes++;
+	mbdb_tree_node_t* node = &tree->nodes[index];
+	memset(node, '\0', sizeof(mbdb_tree_node_t));
+	node->name = name;
+	node->name_size = size;
+	node->record = -1;
+	node->parent = parent;
+	builder->slots[slot] = index;
+
+	// keep the table at most half full
+	if (tree->num_nodes * 2 > builder->mask + 1) {
+		if (mbdb_tree_rehash(builder, (builder->mask + 1) * 2) < 0) {
+			return -1;
+		}
+	}
+	return (int) index;
+}
+
+static int mbdb_tree_add_record(mbdb_tree_builder_t* builder, struct mbdb_t* mbdb, unsigned int record) {
+	const char* domain = NULL;
+	const char* path = NULL;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+	unsigned int start = 0;
+	unsigned int i = 0;
+
+	mbdb_get_record_key(mbdb, record, &domain, &domain_size, &path, &path_size);
+	int node = mbdb_tree_add_child(builder, MBDB_TREE_ROOT, domain, domain_size);
+
+	// one node per component, empty ones from leading or doubled slashes are skipped
+	while (node >= 0 && start < path_size) {
+		for (i = start; i < path_size && path[i] != '/'; i++);
+		if (i > start) {
+			node = mbdb_tree_add_child(builder, (unsigned int) node, &path[start], i - start);
+		}
+		start = i + 1;
+	}
+	if (node < 0) {
+		return -1;
+	}
+	// duplicates keep the first record, like the linear lookups did
+	if (builder->tree->nodes[node].record < 0) {
+		builder->tree->nodes[node].record = (int) record;
+	}
+	return 0;
+}
+
+/* turns the parent links into sorted child ranges */
+static int mbdb_tree_link(mbdb_tree_t* tree) {
+	unsigned int i = 0;
+	unsigned int count = tree->num_nodes - 1;
+
+	tree->children = (unsigned int*) malloc(count * sizeof(unsigned int) + 1);
+	mbdb_tree_sort_key_t* keys = (mbdb_tree_sort_key_t*) malloc(count * sizeof(mbdb_tree_sort_key_t) + 1);
+	if (tree->children == NULL || keys == NULL) {
+		error("Allocation Error!\n");
+		free(keys);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		mbdb_tree_node_t* node = &tree->nodes[i + 1];
+		keys[i].parent = node->parent;
+		keys[i].node = i + 1;
+		keys[i].name = node->name;
+		keys[i].name_size = node->name_size;
+	}
+	qsort(keys, count, sizeof(mbdb_tree_sort_key_t), mbdb_tree_compare_keys);
+
+	for (i = 0; i < count; i++) {
+		mbdb_tree_node_t* parent = &tree->nodes[keys[i].parent];
+		if (parent->num_children == 0) {
+			parent->first_child = i;
+		}
+		parent->num_children++;
+		tree->children[i] = keys[i].node;
+	}
+	free(keys);
+	return 0;
+}
+
+mbdb_tree_t* mbdb_tree_build(struct mbdb_t* mbdb) {
+	unsigned int i = 0;
+	mbdb_tree_builder_t builder;
+
+	if (!mbdb || mbdb->num_records < 0) {
+		return NULL;
+	}
+
+	mbdb_tree_t* tree = (mbdb_tree_t*) malloc(sizeof(mbdb_tree_t));
+	if (tree == NULL) {
+		error("Allocation Error!\n");
+		return NULL;
+	}
+	memset(tree, '\0', sizeof(mbdb_tree_t));
+
+	// backups have a record for nearly every directory, so this rarely grows
+	memset(&builder, '\0', sizeof(mbdb_tree_builder_t));
+	builder.tree = tree;
+	builder.capacity = mbdb->num_records + 64;
+	tree->nodes = (mbdb_tree_node_t*) malloc(builder.capacity * sizeof(mbdb_tree_node_t));
+	if (tree->nodes == NULL) {
+		error("Allocation Error!\n");
+		mbdb_tree_free(tree);
+		return NULL;
+	}
+	memset(&tree->nodes[MBDB_TREE_ROOT], '\0', sizeof(mbdb_tree_node_t));
+	tree->nodes[MBDB_TREE_ROOT].record = -1;
+	tree->num_nodes = 1;
+
+	unsigned int size = 64;
+	while (size < builder.capacity * 2) {
+		size *= 2;
+	}
+	if (mbdb_tree_rehash(&builder, size) < 0) {
+		mbdb_tree_free(tree);
+		return NULL;
+	}
+
+	for (i = 0; i < (unsigned int) mbdb->num_records; i++) {
+		if (mbdb_tree_add_record(&builder, mbdb, i) < 0) {
+			free(builder.slots);
+			mbdb_tree_free(tree);
+			return NULL;
+		}
+	}
+	free(builder.slots);
+
+	if (mbdb_tree_link(tree) < 0) {
+		mbdb_tree_free(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+int mbdb_tree_child(mbdb_tree_t* tree, unsigned int node, const char* name, unsigned short name_size) {
+	if (!tree || node >= tree->num_nodes || !name) {
+		return -1;
+	}
+
+	// binary search of the sorted children
+	unsigned int lo = tree->nodes[node].first_child;
+	unsigned int hi = lo + tree->nodes[node].num_children;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		mbdb_tree_node_t* child = &tree->nodes[tree->children[mid]];
+		int res = mbdb_tree_compare_names(child->name, child->name_size, name, name_size);
+		if (res == 0) {
+			return (int) tree->children[mid];
+		}
+		if (res < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return -1;
+}
+
+int mbdb_tree_lookup(mbdb_tree_t* tree, const char* domain, const char* path) {
+	if (!tree || !domain) {
+		return -1;
+	}
+
+	int node = mbdb_tree_child(tree, MBDB_TREE_ROOT, domain, strlen(domain));
+	while (node >= 0 && path && *path) {
+		const char* end = strchr(path, '/');
+		size_t size = end ? (size_t) (end - path) : strlen(path);
+		if (size > 0) {
+			node = mbdb_tree_child(tree, (unsigned int) node, path, size);
+		}
+		path += size;
+		if (*path == '/') {
+			path++;
+		}
+	}
+	return node;
+}
+
+int mbdb_tree_list(mbdb_tree_t* tree, unsigned int node, mbdb_tree_callback_t callback, void* ctx) {
+	unsigned int i = 0;
+
+	if (!tree || node >= tree->num_nodes || !callback) {
+		return -1;
+	}
+	mbdb_tree_node_t* parent = &tree->nodes[node];
+	for (i = 0; i < parent->num_children; i++) {
+		if (callback(tree, tree->children[parent->first_child + i], ctx)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int mbdb_tree_walk(mbdb_tree_t* tree, unsigned int node, mbdb_tree_callback_t callback, void* ctx) {
+	unsigned int i = 0;
+
+	if (!tree || node >= tree->num_nodes || !callback) {
+		return -1;
+	}
+	// pre-order, the node itself comes first
+	if (callback(tree, node, ctx)) {
+		return 1;
+	}
+	mbdb_tree_node_t* parent = &tree->nodes[node];
+	for (i = 0; i < parent->num_children; i++) {
+		int res = mbdb_tree_walk(tree, tree->children[parent->first_child + i], callback, ctx);
+		if (res != 0) {
+			return res;
+		}
+	}
+	return 0;
+}
+
+static int mbdb_tree_glob_node(mbdb_tree_t* tree, unsigned int node, char** components, unsigned int count, char* name, mbdb_tree_callback_t callback, void* ctx) {
+	unsigned int i = 0;
+
+	if (count == 0) {
+		return callback(tree, node, ctx);
+	}
+	// components without wildcards are a plain child lookup
+	if (strpbrk(components[0], "*?[\\") == NULL) {
+		int child = mbdb_tree_child(tree, node, components[0], strlen(components[0]));
+		if (child < 0) {
+			return 0;
+		}
+		return mbdb_tree_glob_node(tree, (unsigned int) child, &components[1], count - 1, name, callback, ctx);
+	}
+
+	mbdb_tree_node_t* parent = &tree->nodes[node];
+	for (i = 0; i < parent->num_children; i++) {
+		unsigned int child = tree->children[parent->first_child + i];
+		memcpy(name, tree->nodes[child].name, tree->nodes[child].name_size);
+		name[tree->nodes[child].name_size] = '\0';
+		if (fnmatch(components[0], name, 0) == 0) {
+			int res = mbdb_tree_glob_node(tree, child, &components[1], count - 1, name, callback, ctx);
+			if (res != 0) {
+				return res;
+			}
+		}
+	}
+	return 0;
+}
+
+/* calls back for every node below the domain whose path matches the
+   fnmatch(3) pattern, one pattern component per path component */
+int mbdb_tree_glob(mbdb_tree_t* tree, const char* domain, const char* pattern, mbdb_tree_callback_t callback, void* ctx) {
+	unsigned int count = 0;
+	char* p = NULL;
+	char* saveptr = NULL;
+
+	if (!tree || !domain || !pattern || !callback) {
+		return -1;
+	}
+	int node = mbdb_tree_child(tree, MBDB_TREE_ROOT, domain, strlen(domain));
+	if (node < 0) {
+		return 0;
+	}
+
+	char* copy = strdup(pattern);
+	char** components = (char**) malloc((strlen(pattern) / 2 + 2) * sizeof(char*));
+	char* name = (char*) malloc(0x10000);
+	if (copy == NULL || components == NULL || name == NULL) {
+		error("Allocation Error!\n");
+		free(copy);
+		free(components);
+		free(name);
+		return -1;
+	}
+	for (p = strtok_r(copy, "/", &saveptr); p; p = strtok_r(NULL, "/", &saveptr)) {
+		components[count++] = p;
+	}
+
+	int res = mbdb_tree_glob_node(tree, (unsigned int) node, components, count, name, callback, ctx);
+
+	free(name);
+	free(components);
+	free(copy);
+	return res;
+}
+
+/* path of the node below its domain, "" for the domain itself */
+int mbdb_tree_path(mbdb_tree_t* tree, unsigned int node, char* buf, unsigned int size) {
+	unsigned int n = 0;
+	unsigned int length = 0;
+
+	if (!tree || node >= tree->num_nodes || node == MBDB_TREE_ROOT || !buf || size == 0) {
+		return -1;
+	}
+	for (n = node; tree->nodes[n].parent != MBDB_TREE_ROOT; n = tree->nodes[n].parent) {
+		length += tree->nodes[n].name_size + ((length > 0) ? 1 : 0);
+	}
+	if (length + 1 > size) {
+		return -1;
+	}
+
+	buf[length] = '\0';
+	unsigned int end = length;
+	for (n = node; tree->nodes[n].parent != MBDB_TREE_ROOT; n = tree->nodes[n].parent) {
+		if (end < length) {
+			buf[--end] = '/';
+		}
+		end -= tree->nodes[n].name_size;
+		memcpy(&buf[end], tree->nodes[n].name, tree->nodes[n].name_size);
+	}
+	return (int) length;
+}
+
+void mbdb_tree_free(mbdb_tree_t* tree) {
+	if (tree) {
+		if (tree->nodes) {
+			free(tree->nodes);
+		}
+		if (tree->children) {
+			free(tree->children);
+		}
+		free(tree);
+	}
+}
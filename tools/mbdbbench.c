@@ -0,0 +1,1245 @@
+/**
+  * libmbdb-1.0 - mbdbbench.c
+  * Copyright (C) 2013 Crippy-Dev Team
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <openssl/sha.h>
+
+#include <libmbdb-1.0/backup.h>
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_record.h>
+#include <libmbdb-1.0/mbdb_copy.h>
+#include <libcrippy-1.0/endianness.h>
+#include <libcrippy-1.0/file.h>
+
+static const char* manifest = NULL;
+
+typedef struct bench_command_t {
+	const char* name;
+	const char* help;
+	int (*run)(mbdb_t* mbdb, int iterations);
+} bench_command_t;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+static void report(const char* what, double seconds, unsigned long long count) {
+	printf("%-24s %10.3f ms %12.1f ns/op\n", what, seconds * 1000.0,
+			count ? (seconds * 1000000000.0) / (double) count : 0.0);
+}
+
+/* offset of the fixed size tail of the record at data, past its five strings */
+static unsigned int tail_offset(const unsigned char* data) {
+	unsigned int offset = 0;
+	int i = 0;
+	for (i = 0; i < 5; i++) {
+		unsigned short strsize = be16toh(*((unsigned short*) &data[offset]));
+		offset += 2;
+		if (strsize != 0xFFFF) {
+			offset += strsize;
+		}
+	}
+	return offset;
+}
+
+static int bench_decode(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int n = 0;
+	double start = 0;
+	mbdb_record_t record;
+
+	const unsigned char** tails = (const unsigned char**) malloc(mbdb->num_records * sizeof(unsigned char*));
+	if (tails == NULL) {
+		fprintf(stderr, "Allocation Error!\n");
+		return -1;
+	}
+	for (i = 0; i < mbdb->num_records; i++) {
+		const unsigned char* data = &mbdb->data[mbdb->offsets[i]];
+		tails[i] = &data[tail_offset(data)];
+	}
+
+	memset(&record, '\0', sizeof(record));
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < mbdb->num_records; i++) {
+			mbdb_record_decode_tail(&record, tails[i]);
+		}
+	}
+	report("tail", now() - start, (unsigned long long) iterations * mbdb->num_records);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		unsigned int offset = 6;
+		for (i = 0; i < mbdb->num_records; i++) {
+			int size = mbdb_record_scan(&mbdb->data[offset], mbdb->size - offset);
+			if (size < 0) {
+				break;
+			}
+			offset += size;
+		}
+	}
+	report("scan", now() - start, (unsigned long long) iterations * mbdb->num_records);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		mbdb_t* parsed = mbdb_parse(mbdb->data, mbdb->size);
+		if (parsed == NULL) {
+			break;
+		}
+		mbdb_free(parsed);
+	}
+	report("parse", now() - start, (unsigned long long) iterations * mbdb->num_records);
+
+	free(tails);
+	return 0;
+}
+
+/* linear scan, the way backup_get_file_index() used to look records up */
+static int linear_find(mbdb_t* mbdb, const char* domain, const char* path) {
+	int i = 0;
+	for (i = 0; i < mbdb->num_records; i++) {
+		if (mbdb_record_matches(mbdb_get_record(mbdb, i), domain, path)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int bench_lookup(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int n = 0;
+	int failed = 0;
+	double start = 0;
+	int count = (mbdb->num_records < 1000) ? mbdb->num_records : 1000;
+
+	if (count == 0) {
+		return 0;
+	}
+	char** domains = (char**) calloc(count, sizeof(char*));
+	char** paths = (char**) calloc(count, sizeof(char*));
+	if (domains == NULL || paths == NULL) {
+		fprintf(stderr, "Allocation Error!\n");
+		return -1;
+	}
+	// sample keys spread over the whole manifest
+	for (i = 0; i < count; i++) {
+		mbdb_record_t* rec = mbdb_get_record(mbdb, (int) (((long long) mbdb->num_records * i) / count));
+		domains[i] = strndup(rec->domain ? rec->domain : "", (rec->domain_size == 0xFFFF) ? 0 : rec->domain_size);
+		paths[i] = strndup(rec->path ? rec->path : "", (rec->path_size == 0xFFFF) ? 0 : rec->path_size);
+	}
+
+	start = now();
+	if (mbdb_get_index(mbdb) == NULL) {
+		failed = 1;
+	}
+	report("index build", now() - start, mbdb->num_records);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		if (linear_find(mbdb, domains[i], paths[i]) < 0) {
+			failed = 1;
+		}
+	}
+	report("linear lookup", now() - start, count);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < count; i++) {
+			int idx = mbdb_find_record(mbdb, domains[i], paths[i]);
+			if (idx < 0 || !mbdb_record_matches(mbdb_get_record(mbdb, idx), domains[i], paths[i])) {
+				failed = 1;
+			}
+		}
+	}
+	report("hashed lookup", now() - start, (unsigned long long) iterations * count);
+
+	for (i = 0; i < count; i++) {
+		free(domains[i]);
+		free(paths[i]);
+	}
+	free(domains);
+	free(paths);
+	return failed ? -1 : 0;
+}
+
+/* cold open that scans and indexes the manifest, against a warm one from its sidecar */
+static int bench_reopen(mbdb_t* mbdb, int iterations) {
+	int n = 0;
+	int failed = 0;
+	double start = 0;
+	const char* domain = NULL;
+	const char* path = NULL;
+	unsigned short domain_size = 0;
+	unsigned short path_size = 0;
+
+	if (mbdb->num_records == 0) {
+		return 0;
+	}
+	mbdb_get_record_key(mbdb, mbdb->num_records - 1, &domain, &domain_size, &path, &path_size);
+	char* last_domain = strndup(domain ? domain : "", domain_size);
+	char* last_path = strndup(path ? path : "", path_size);
+
+	start = now();
+	if (mbdb_sidecar_write(mbdb, manifest) < 0) {
+		fprintf(stderr, "Unable to write the sidecar of %s\n", manifest);
+		failed = 1;
+	}
+	report("sidecar write", now() - start, mbdb->num_records);
+
+	start = now();
+	for (n = 0; n < iterations && !failed; n++) {
+		mbdb_t* cold = mbdb_open_ex(manifest, MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY | MBDB_OPEN_INDEX);
+		if (cold == NULL || mbdb_find_record(cold, last_domain, last_path) != mbdb->num_records - 1) {
+			failed = 1;
+		}
+		mbdb_free(cold);
+	}
+	report("cold open", now() - start, iterations);
+
+	start = now();
+	for (n = 0; n < iterations && !failed; n++) {
+		mbdb_t* warm = mbdb_open_ex(manifest, MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY | MBDB_OPEN_SIDECAR);
+		if (warm == NULL || warm->sidecar == NULL
+		 || mbdb_find_record(warm, last_domain, last_path) != mbdb->num_records - 1) {
+			failed = 1;
+		}
+		mbdb_free(warm);
+	}
+	report("sidecar open", now() - start, iterations);
+
+	free(last_domain);
+	free(last_path);
+	return failed ? -1 : 0;
+}
+
+/* one edit the way backup_update_file() used to apply it:
+   rebuild every record, free the mbdb and parse the result */
+static mbdb_t* rebuild_edit(mbdb_t* mbdb, unsigned int idx, mbdb_record_t* rec) {
+	unsigned int i = 0;
+	unsigned int size = sizeof(mbdb_header_t);
+	for (i = 0; i < (unsigned int) mbdb->num_records; i++) {
+		size += (i == idx) ? rec->this_size : mbdb_get_record(mbdb, i)->this_size;
+	}
+	unsigned char* data = (unsigned char*) malloc(size);
+	unsigned char* p = data + sizeof(mbdb_header_t);
+	memcpy(data, MBDB_MAGIC, sizeof(mbdb_header_t));
+	for (i = 0; i < (unsigned int) mbdb->num_records; i++) {
+		unsigned char* rd = NULL;
+		unsigned int rs = 0;
+		mbdb_record_build((i == idx) ? rec : mbdb_get_record(mbdb, i), &rd, &rs);
+		memcpy(p, rd, rs);
+		free(rd);
+		p += rs;
+	}
+	mbdb_free(mbdb);
+	mbdb = mbdb_parse(data, size);
+	free(data);
+	return mbdb;
+}
+
+static int bench_edit(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int failed = 0;
+	double start = 0;
+	int count = (mbdb->num_records < 10000) ? mbdb->num_records : 10000;
+	int rebuilds = (iterations < count) ? iterations : count;
+
+	mbdb_t* edited = mbdb_parse(mbdb->data, mbdb->size);
+	if (edited == NULL || count == 0) {
+		mbdb_free(edited);
+		return edited ? 0 : -1;
+	}
+
+	start = now();
+	for (i = 0; i < rebuilds && edited; i++) {
+		unsigned int idx = (unsigned int) (((long long) mbdb->num_records * i) / count);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		edited = rebuild_edit(edited, idx, rec);
+		mbdb_record_free(rec);
+	}
+	report("rebuild and reparse", now() - start, rebuilds);
+	mbdb_free(edited);
+
+	edited = mbdb_parse(mbdb->data, mbdb->size);
+	if (edited == NULL) {
+		return -1;
+	}
+	start = now();
+	for (i = 0; i < count; i++) {
+		unsigned int idx = (unsigned int) (((long long) mbdb->num_records * i) / count);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		if (mbdb_replace_record(edited, idx, rec) < 0) {
+			failed = 1;
+		}
+	}
+	report("replace in place", now() - start, count);
+
+	unsigned char* data = NULL;
+	unsigned int size = 0;
+	start = now();
+	if (mbdb_build(edited, &data, &size) < 0 || size != mbdb->size) {
+		failed = 1;
+	}
+	report("serialize once", now() - start, mbdb->num_records);
+
+	free(data);
+	mbdb_free(edited);
+	return failed ? -1 : 0;
+}
+
+/* writes data to file and waits for it to reach the disk */
+static int write_synced(const char* file, const unsigned char* data, unsigned int size) {
+	int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	int res = (write(fd, data, size) == (ssize_t) size && fsync(fd) == 0) ? 0 : -1;
+	close(fd);
+	return res;
+}
+
+/* durable edits, each one rewriting the manifest against one journal entry each,
+   done on a copy of the manifest */
+static int bench_journal(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned char* data = NULL;
+	unsigned int size = 0;
+
+	if (mbdb->num_records == 0) {
+		return 0;
+	}
+	char* copy = (char*) malloc(strlen(manifest) + 16);
+	char* journal = (char*) malloc(strlen(manifest) + 16 + strlen(MBDB_JOURNAL_SUFFIX));
+	sprintf(copy, "%s.bench-%d", manifest, (int) getpid());
+	sprintf(journal, "%s%s", copy, MBDB_JOURNAL_SUFFIX);
+	if (write_synced(copy, mbdb->data, mbdb->size) < 0) {
+		fprintf(stderr, "Unable to write %s\n", copy);
+		free(copy);
+		free(journal);
+		return -1;
+	}
+
+	mbdb_t* edited = mbdb_open_ex(copy, MBDB_OPEN_LAZY);
+	start = now();
+	for (i = 0; i < iterations && edited && !failed; i++) {
+		unsigned int idx = (unsigned int) (((long long) mbdb->num_records * i) / iterations);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		if (mbdb_replace_record(edited, idx, rec) < 0 || mbdb_build(edited, &data, &size) < 0
+		 || write_synced(copy, data, size) < 0) {
+			failed = 1;
+		}
+		free(data);
+		data = NULL;
+	}
+	report("rewrite manifest", now() - start, iterations);
+	mbdb_free(edited);
+
+	// start over from the original manifest, with a journal
+	if (write_synced(copy, mbdb->data, mbdb->size) < 0) {
+		failed = 1;
+	}
+	unlink(journal);
+	edited = failed ? NULL : mbdb_open_ex(copy, MBDB_OPEN_LAZY | MBDB_OPEN_JOURNAL);
+	start = now();
+	for (i = 0; i < iterations && edited && !failed; i++) {
+		unsigned int idx = (unsigned int) (((long long) mbdb->num_records * i) / iterations);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		if (mbdb_replace_record(edited, idx, rec) < 0 || mbdb_journal_sync(edited) < 0) {
+			failed = 1;
+		}
+	}
+	report("journal append", now() - start, iterations);
+	mbdb_free(edited);
+
+	start = now();
+	edited = failed ? NULL : mbdb_open_ex(copy, MBDB_OPEN_LAZY | MBDB_OPEN_JOURNAL);
+	if (edited == NULL || mbdb_get_record(edited, 0)->inode != mbdb_get_record(mbdb, 0)->inode + 1) {
+		failed = 1;
+	}
+	report("open and replay", now() - start, iterations);
+	mbdb_free(edited);
+
+	unlink(journal);
+	unlink(copy);
+	free(copy);
+	free(journal);
+	return failed ? -1 : 0;
+}
+
+/* peak resident size so far, in kB */
+static long peak_rss() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/* saving the manifest after editing 1% of the records, streamed against
+   serialized into one buffer first. Streaming goes first, the peak only grows. */
+static int bench_write(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned char* data = NULL;
+	unsigned int size = 0;
+
+	char* copy = (char*) malloc(strlen(manifest) + 16);
+	sprintf(copy, "%s.bench-%d", manifest, (int) getpid());
+	mbdb_t* edited = mbdb_open_ex(manifest, MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY);
+	if (edited == NULL) {
+		free(copy);
+		return -1;
+	}
+	int count = edited->num_records / 100;
+	for (i = 0; i < count; i++) {
+		unsigned int idx = (unsigned int) (((long long) edited->num_records * i) / count);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		mbdb_replace_record(edited, idx, rec);
+	}
+
+	long rss = peak_rss();
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		if (mbdb_write(edited, copy) < 0) {
+			failed = 1;
+		}
+	}
+	report("stream write", (now() - start) / iterations, edited->num_records);
+	printf("%-24s %10ld kB\n", "peak grew by", peak_rss() - rss);
+
+	rss = peak_rss();
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		if (mbdb_build(edited, &data, &size) < 0 || write_synced(copy, data, size) < 0) {
+			failed = 1;
+		}
+		free(data);
+		data = NULL;
+	}
+	report("build and write", (now() - start) / iterations, edited->num_records);
+	printf("%-24s %10ld kB\n", "peak grew by", peak_rss() - rss);
+
+	mbdb_free(edited);
+	unlink(copy);
+	free(copy);
+	return failed ? -1 : 0;
+}
+
+/* every record serialized from its fields, one malloc per record against
+   serialized in place, on one thread and on all of them */
+static int bench_serialize(mbdb_t* mbdb, int iterations) {
+	int n = 0;
+	unsigned int i = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned char* data = NULL;
+	unsigned int size = 0;
+
+	mbdb_t* decoded = mbdb_parse(mbdb->data, mbdb->size);
+	if (decoded == NULL) {
+		return -1;
+	}
+	// as if every record was changed, nothing gets copied from the data
+	for (i = 0; i < (unsigned int) decoded->num_records; i++) {
+		decoded->offsets[i] = MBDB_OFFSET_NONE;
+	}
+
+	start = now();
+	for (n = 0; n < iterations && !failed; n++) {
+		data = (unsigned char*) malloc(mbdb->size);
+		unsigned char* p = data + sizeof(mbdb_header_t);
+		for (i = 0; i < (unsigned int) decoded->num_records; i++) {
+			unsigned char* rd = NULL;
+			unsigned int rs = 0;
+			if (mbdb_record_build(decoded->records[i], &rd, &rs) < 0) {
+				failed = 1;
+				break;
+			}
+			memcpy(p, rd, rs);
+			free(rd);
+			p += rs;
+		}
+		free(data);
+	}
+	report("build per record", (now() - start) / iterations, decoded->num_records);
+
+	start = now();
+	for (n = 0; n < iterations && !failed; n++) {
+		if (mbdb_serialize(decoded, &data, &size, 1) < 0 || size != mbdb->size
+		 || memcmp(data, mbdb->data, size) != 0) {
+			failed = 1;
+		}
+		free(data);
+	}
+	report("serialize", (now() - start) / iterations, decoded->num_records);
+
+	start = now();
+	for (n = 0; n < iterations && !failed; n++) {
+		if (mbdb_serialize(decoded, &data, &size, 0) < 0 || size != mbdb->size) {
+			failed = 1;
+		}
+		free(data);
+	}
+	report("serialize threaded", (now() - start) / iterations, decoded->num_records);
+
+	mbdb_free(decoded);
+	return failed ? -1 : 0;
+}
+
+#define BENCH_READERS 2
+#define BENCH_KEYS    1024
+
+typedef struct bench_reader_t {
+	mbdb_t* mbdb;
+	char** domains;
+	char** paths;
+	int* stop;
+	unsigned long long lookups;
+	unsigned long long misses;
+	pthread_t thread;
+} bench_reader_t;
+
+static void* bench_reader(void* arg) {
+	bench_reader_t* reader = (bench_reader_t*) arg;
+	unsigned int i = 0;
+	while (!__atomic_load_n(reader->stop, __ATOMIC_ACQUIRE)) {
+		mbdb_snapshot_t* snapshot = mbdb_snapshot_acquire(reader->mbdb);
+		for (i = 0; i < 64; i++) {
+			unsigned int k = (unsigned int) (reader->lookups + i) % BENCH_KEYS;
+			if (mbdb_snapshot_find_record(snapshot, reader->domains[k], reader->paths[k]) == NULL) {
+				reader->misses++;
+			}
+		}
+		mbdb_snapshot_release(snapshot);
+		reader->lookups += 64;
+	}
+	return NULL;
+}
+
+/* readers look records up in snapshots while the writer replaces
+   records and publishes a new version after each one */
+static int bench_snapshot(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int failed = 0;
+	double start = 0;
+	int stop = 0;
+	char* domains[BENCH_KEYS];
+	char* paths[BENCH_KEYS];
+	bench_reader_t readers[BENCH_READERS];
+
+	mbdb_t* edited = mbdb_parse(mbdb->data, mbdb->size);
+	if (edited == NULL || edited->num_records == 0) {
+		mbdb_free(edited);
+		return edited ? 0 : -1;
+	}
+	for (i = 0; i < BENCH_KEYS; i++) {
+		mbdb_record_t* rec = mbdb_get_record(edited, (unsigned int) (((long long) edited->num_records * i) / BENCH_KEYS));
+		domains[i] = strndup(rec->domain ? rec->domain : "", rec->domain_size == 0xFFFF ? 0 : rec->domain_size);
+		paths[i] = strndup(rec->path ? rec->path : "", rec->path_size == 0xFFFF ? 0 : rec->path_size);
+	}
+
+	start = now();
+	if (mbdb_snapshot_publish(edited) < 0) {
+		failed = 1;
+	}
+	report("first publish", now() - start, edited->num_records);
+
+	for (i = 0; i < BENCH_READERS; i++) {
+		memset(&readers[i], '\0', sizeof(bench_reader_t));
+		readers[i].mbdb = edited;
+		readers[i].domains = domains;
+		readers[i].paths = paths;
+		readers[i].stop = &stop;
+		pthread_create(&readers[i].thread, NULL, bench_reader, &readers[i]);
+	}
+
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		unsigned int idx = (unsigned int) (((long long) edited->num_records * i) / iterations);
+		mbdb_record_t* rec = mbdb_record_copy(mbdb_get_record(edited, idx));
+		mbdb_record_set_inode(rec, rec->inode + 1);
+		if (mbdb_replace_record(edited, idx, rec) < 0 || mbdb_snapshot_publish(edited) < 0) {
+			failed = 1;
+		}
+	}
+	double seconds = now() - start;
+	report("replace and publish", seconds, iterations);
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	unsigned long long lookups = 0;
+	unsigned long long misses = 0;
+	for (i = 0; i < BENCH_READERS; i++) {
+		pthread_join(readers[i].thread, NULL);
+		lookups += readers[i].lookups;
+		misses += readers[i].misses;
+	}
+	printf("%-24s %10.0f /s %12llu missed\n", "reader lookups", lookups / seconds, misses);
+	if (misses) {
+		failed = 1;
+	}
+
+	for (i = 0; i < BENCH_KEYS; i++) {
+		free(domains[i]);
+		free(paths[i]);
+	}
+	mbdb_free(edited);
+	return failed ? -1 : 0;
+}
+
+#define BENCH_THREADS 4
+
+typedef struct bench_worker_t {
+	backup_t* backup;
+	char** domains;
+	char** paths;
+	unsigned int first;
+	unsigned long long count;       // lookups to do, 0 to change files until stop
+	int* stop;
+	unsigned long long done;
+	unsigned long long misses;
+	unsigned long long errors;
+	pthread_t thread;
+} bench_worker_t;
+
+/* adds a file, updates one of the files the readers look up, then
+   removes it and puts it back, until stopped */
+static void bench_writer(bench_worker_t* worker) {
+	char path[64];
+	while (!__atomic_load_n(worker->stop, __ATOMIC_ACQUIRE)) {
+		unsigned int k = (unsigned int) (worker->first + worker->done) % BENCH_KEYS;
+		sprintf(path, "Library/bench/%llu", worker->done);
+		if (backup_add_file_from_data(worker->backup, "HomeDomain", "bench", 5, path, 0644, 0, 0, 4) < 0) {
+			worker->errors++;
+		}
+		backup_file_t* file = backup_get_file(worker->backup, worker->domains[k], worker->paths[k]);
+		if (file == NULL) {
+			worker->errors++;
+		} else {
+			backup_file_set_time1(file, (unsigned int) worker->done);
+			if (backup_update_file(worker->backup, file) < 0
+			 || backup_remove_file(worker->backup, file) < 0
+			 || backup_update_file(worker->backup, file) < 0) {
+				worker->errors++;
+			}
+			backup_file_free(file);
+		}
+		worker->done++;
+	}
+}
+
+static void* bench_worker(void* arg) {
+	bench_worker_t* worker = (bench_worker_t*) arg;
+	if (worker->count == 0) {
+		bench_writer(worker);
+		return NULL;
+	}
+	for (worker->done = 0; worker->done < worker->count; worker->done++) {
+		unsigned int k = (unsigned int) (worker->first + worker->done) % BENCH_KEYS;
+		backup_file_t* file = backup_get_file(worker->backup, worker->domains[k], worker->paths[k]);
+		if (file == NULL) {
+			worker->misses++;
+		}
+		backup_file_free(file);
+	}
+	return NULL;
+}
+
+/* runs threads readers, and a writer changing their files if writer is set */
+static double bench_workers(backup_t* backup, char** domains, char** paths, int threads, int writer,
+		unsigned long long count, unsigned long long* changed, unsigned long long* misses, unsigned long long* errors) {
+	int i = 0;
+	int stop = 0;
+	bench_worker_t workers[BENCH_THREADS + 1];
+
+	memset(workers, '\0', sizeof(workers));
+	double start = now();
+	for (i = 0; i < threads + writer; i++) {
+		workers[i].backup = backup;
+		workers[i].domains = domains;
+		workers[i].paths = paths;
+		workers[i].first = (unsigned int) i * 97;
+		workers[i].count = (i < threads) ? count : 0;
+		workers[i].stop = &stop;
+		pthread_create(&workers[i].thread, NULL, bench_worker, &workers[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		*misses += workers[i].misses;
+	}
+	double seconds = now() - start;
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	if (writer) {
+		pthread_join(workers[threads].thread, NULL);
+		*changed = workers[threads].done;
+		*errors += workers[threads].errors;
+	}
+	return seconds;
+}
+
+/* a backup named "backup" under root, with a copy of the manifest */
+static backup_t* open_backup_copy(mbdb_t* mbdb, const char* root, unsigned int flags) {
+	char directory[4096];
+	char path[4096];
+	snprintf(directory, sizeof(directory), "%s/backup", root);
+	snprintf(path, sizeof(path), "%s/backup/Manifest.mbdb", root);
+	if (mkdir(root, 0755) < 0 || mkdir(directory, 0755) < 0 || write_synced(path, mbdb->data, mbdb->size) < 0) {
+		fprintf(stderr, "Unable to write %s\n", path);
+		return NULL;
+	}
+	return backup_open_ex(root, "backup", flags);
+}
+
+/* removes what open_backup_copy() made, and the files added since */
+static void remove_backup_copy(const char* root) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/backup", root);
+	DIR* dir = opendir(path);
+	struct dirent* entry = NULL;
+	while (dir && (entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/backup/%s", root, entry->d_name);
+			unlink(path);
+		}
+	}
+	if (dir) {
+		closedir(dir);
+	}
+	snprintf(path, sizeof(path), "%s/backup", root);
+	rmdir(path);
+	rmdir(root);
+}
+
+/* backup_get_file() on 1 to BENCH_THREADS threads, then with another
+   thread adding, updating and removing files, on a copy of the manifest
+   in a new backup */
+static int bench_threads(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int threads = 0;
+	int failed = 0;
+	char* domains[BENCH_KEYS];
+	char* paths[BENCH_KEYS];
+	unsigned long long changed = 0;
+	unsigned long long misses = 0;
+	unsigned long long errors = 0;
+	unsigned long long count = (unsigned long long) iterations * 10000;
+	char label[32];
+
+	if (mbdb->num_records == 0) {
+		return 0;
+	}
+	char* root = (char*) malloc(strlen(manifest) + 32);
+	sprintf(root, "%s.bench-%d", manifest, (int) getpid());
+	backup_t* backup = open_backup_copy(mbdb, root, MBDB_OPEN_LAZY | MBDB_OPEN_JOURNAL);
+	if (backup == NULL) {
+		failed = 1;
+	}
+	for (i = 0; i < BENCH_KEYS && !failed; i++) {
+		mbdb_record_t* rec = mbdb_get_record(mbdb, (unsigned int) (((long long) mbdb->num_records * i) / BENCH_KEYS));
+		domains[i] = strndup(rec->domain ? rec->domain : "", rec->domain_size == 0xFFFF ? 0 : rec->domain_size);
+		paths[i] = strndup(rec->path ? rec->path : "", rec->path_size == 0xFFFF ? 0 : rec->path_size);
+	}
+
+	for (threads = 1; threads <= BENCH_THREADS && !failed; threads *= 2) {
+		double seconds = bench_workers(backup, domains, paths, threads, 0, count, &changed, &misses, &errors);
+		sprintf(label, "get_file, %d threads", threads);
+		printf("%-24s %10.3f ms %12.0f /s\n", label, seconds * 1000.0, (double) count * threads / seconds);
+	}
+	if (!failed) {
+		printf("%-24s %10llu\n", "missed", misses);
+		if (misses) {
+			failed = 1;
+		}
+	}
+	if (!failed) {
+		// lookups may miss a file while it is removed, each one has to be back at the end
+		misses = 0;
+		double seconds = bench_workers(backup, domains, paths, BENCH_THREADS, 1, count, &changed, &misses, &errors);
+		sprintf(label, "get_file, %d and writer", BENCH_THREADS);
+		printf("%-24s %10.3f ms %12.0f /s %6llu changed\n", label, seconds * 1000.0,
+				(double) count * BENCH_THREADS / seconds, changed);
+		printf("%-24s %10llu\n", "missed while removed", misses);
+		for (i = 0; i < BENCH_KEYS; i++) {
+			if (backup_get_file_index(backup, domains[i], paths[i]) < 0) {
+				errors++;
+			}
+		}
+		printf("%-24s %10llu\n", "errors", errors);
+		if (errors) {
+			failed = 1;
+		}
+	}
+
+	if (backup) {
+		for (i = 0; i < BENCH_KEYS; i++) {
+			free(domains[i]);
+			free(paths[i]);
+		}
+		backup_free(backup);
+	}
+	remove_backup_copy(root);
+	free(root);
+	return failed ? -1 : 0;
+}
+
+/* every file of a backup by index, copied against borrowed */
+static int bench_views(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int j = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned long long total = 0;
+	backup_file_view_t view;
+
+	char* root = (char*) malloc(strlen(manifest) + 32);
+	sprintf(root, "%s.bench-%d", manifest, (int) getpid());
+	backup_t* backup = open_backup_copy(mbdb, root, 0);
+	int count = backup ? backup_get_num_files(backup) : 0;
+	if (backup == NULL) {
+		failed = 1;
+	}
+
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		for (j = 0; j < count; j++) {
+			backup_file_t* file = backup_get_file_by_index(backup, j);
+			if (file == NULL) {
+				failed = 1;
+				break;
+			}
+			total += file->mbdb_record->length;
+			backup_file_free(file);
+		}
+	}
+	report("copied", now() - start, (unsigned long long) iterations * count);
+
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		for (j = 0; j < count; j++) {
+			if (backup_get_file_view_by_index(backup, j, &view) < 0) {
+				failed = 1;
+				break;
+			}
+			total -= view.mbdb_record->length;
+		}
+	}
+	report("borrowed", now() - start, (unsigned long long) iterations * count);
+	if (total != 0) {
+		failed = 1;
+	}
+
+	backup_free(backup);
+	remove_backup_copy(root);
+	free(root);
+	return failed ? -1 : 0;
+}
+
+static int count_entry(const mbdb_entry_t* entry, void* ctx) {
+	(*(unsigned int*) ctx)++;
+	return 0;
+}
+
+/* files of one domain under a path with a minimum length,
+   strcmp on every decoded record against a compiled filter */
+static int bench_scan(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int j = 0;
+	double start = 0;
+	unsigned int found = 0;
+	unsigned int matched = 0;
+	mbdb_filter_t filter;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		found = 0;
+		for (j = 0; j < mbdb->num_records; j++) {
+			const mbdb_record_t* rec = mbdb_get_record(mbdb, j);
+			if (rec && (rec->mode & MBDB_MODE_TYPE_MASK) == MBDB_MODE_FILE && rec->length >= 100
+			 && rec->domain && !strcmp(rec->domain, "CameraRollDomain")
+			 && rec->path && !strncmp(rec->path, "Library/dir1", 12)) {
+				found++;
+			}
+		}
+	}
+	report("strcmp per record", (now() - start) / iterations, mbdb->num_records);
+
+	start = now();
+	mbdb_get_columns(mbdb);
+	report("columns", now() - start, mbdb->num_records);
+
+	memset(&filter, '\0', sizeof(filter));
+	filter.match = MBDB_FILTER_DOMAIN | MBDB_FILTER_PATH_PREFIX | MBDB_FILTER_TYPE | MBDB_FILTER_LENGTH;
+	filter.domain = "CameraRollDomain";
+	filter.path = "Library/dir1";
+	filter.type = MBDB_MODE_FILE;
+	filter.min_length = 100;
+	filter.max_length = ~0ULL;
+	mbdb_filter_compile(&filter);
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		matched = 0;
+		mbdb_foreach(mbdb, &filter, count_entry, &matched);
+	}
+	report("compiled filter", (now() - start) / iterations, mbdb->num_records);
+	printf("%-24s %10u\n", "matched", matched);
+
+	return (matched == found) ? 0 : -1;
+}
+
+#define BENCH_NAMES_CHUNK 256
+
+/* the backup file name of every record: a buffer, SHA1() and sprintf per
+   name as backup.c did, against batches on each compression the cpu has */
+static int bench_names(mbdb_t* mbdb, int iterations) {
+	static const char* impls[] = { "scalar", "avx2", "sha", NULL };
+	mbdb_name_key_t keys[BENCH_NAMES_CHUNK];
+	unsigned char hashes[BENCH_NAMES_CHUNK * MBDB_NAME_HASH_SIZE];
+	mbdb_name_hasher_t hasher;
+	const char* impl = mbdb_name_hash_impl();
+	char what[32];
+	unsigned int count = (unsigned int) mbdb->num_records;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	unsigned int size = 0;
+	int n = 0;
+	int k = 0;
+	int failed = 0;
+	double start = 0;
+
+	char* expected = (char*) malloc((size_t) count * (MBDB_NAME_SIZE + 1) + 1);
+	char* names = (char*) malloc((size_t) count * (MBDB_NAME_SIZE + 1) + 1);
+	if (expected == NULL || names == NULL) {
+		free(expected);
+		free(names);
+		return -1;
+	}
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < count; i++) {
+			mbdb_name_key_t* key = &keys[0];
+			mbdb_get_record_key(mbdb, i, &key->domain, &key->domain_size, &key->path, &key->path_size);
+			unsigned short dsize = (key->domain_size == 0xFFFF) ? 0 : key->domain_size;
+			unsigned short psize = (key->path_size == 0xFFFF) ? 0 : key->path_size;
+			char* name = (char*) malloc(dsize + 1 + psize + 1);
+			memcpy(name, key->domain, dsize);
+			name[dsize] = '-';
+			memcpy(name + dsize + 1, key->path, psize);
+			name[dsize + 1 + psize] = '\0';
+			SHA1((const unsigned char*) name, strlen(name), hashes);
+			free(name);
+			char* p = expected + (size_t) i * (MBDB_NAME_SIZE + 1);
+			for (j = 0; j < MBDB_NAME_HASH_SIZE; j++) {
+				sprintf(p + j * 2, "%02x", hashes[j]);
+			}
+		}
+	}
+	report("buffer, SHA1, sprintf", (now() - start) / iterations, count);
+
+	for (k = 0; impls[k]; k++) {
+		if (mbdb_name_hash_use(impls[k]) < 0) {
+			continue;
+		}
+		start = now();
+		for (n = 0; n < iterations; n++) {
+			for (i = 0; i < count; i++) {
+				mbdb_name_key_t* key = &keys[0];
+				mbdb_get_record_key(mbdb, i, &key->domain, &key->domain_size, &key->path, &key->path_size);
+				mbdb_name_hash(key->domain, key->domain_size, key->path, key->path_size, hashes);
+				mbdb_name_format(hashes, names + (size_t) i * (MBDB_NAME_SIZE + 1));
+			}
+		}
+		snprintf(what, sizeof(what), "%s, one at a time", impls[k]);
+		report(what, (now() - start) / iterations, count);
+		failed |= memcmp(names, expected, (size_t) count * (MBDB_NAME_SIZE + 1)) != 0;
+
+		memset(names, '\0', (size_t) count * (MBDB_NAME_SIZE + 1));
+		start = now();
+		for (n = 0; n < iterations; n++) {
+			mbdb_name_hasher_init(&hasher);
+			for (i = 0; i < count; i += size) {
+				size = (count - i < BENCH_NAMES_CHUNK) ? count - i : BENCH_NAMES_CHUNK;
+				for (j = 0; j < size; j++) {
+					mbdb_name_key_t* key = &keys[j];
+					mbdb_get_record_key(mbdb, i + j, &key->domain, &key->domain_size, &key->path, &key->path_size);
+				}
+				mbdb_name_hash_batch(&hasher, keys, size, hashes);
+				for (j = 0; j < size; j++) {
+					mbdb_name_format(&hashes[j * MBDB_NAME_HASH_SIZE], names + (size_t) (i + j) * (MBDB_NAME_SIZE + 1));
+				}
+			}
+		}
+		snprintf(what, sizeof(what), "%s, batched", impls[k]);
+		report(what, (now() - start) / iterations, count);
+		failed |= memcmp(names, expected, (size_t) count * (MBDB_NAME_SIZE + 1)) != 0;
+	}
+	mbdb_name_hash_use(impl);
+	printf("%-24s %10s\n", "names", failed ? "DIFFER" : "match");
+
+	free(expected);
+	free(names);
+	return failed ? -1 : 0;
+}
+
+/* the data file of every file of a backup: backup_get_file_path() on a
+   copy, then into a buffer from a view, hashing and from the cache */
+static int bench_paths(mbdb_t* mbdb, int iterations) {
+	int i = 0;
+	int j = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned long long total = 0;
+	unsigned long long check = 0;
+	backup_file_view_t view;
+	char path[4096];
+
+	char* root = (char*) malloc(strlen(manifest) + 32);
+	sprintf(root, "%s.bench-%d", manifest, (int) getpid());
+	backup_t* backup = open_backup_copy(mbdb, root, 0);
+	int count = backup ? backup_get_num_files(backup) : 0;
+	if (backup == NULL) {
+		failed = 1;
+	}
+
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		total = 0;
+		for (j = 0; j < count; j++) {
+			backup_file_t* file = backup_get_file_by_index(backup, j);
+			char* filename = file ? backup_get_file_path(backup, file) : NULL;
+			if (filename == NULL) {
+				failed = 1;
+				break;
+			}
+			total += filename[strlen(filename) - 1];
+			free(filename);
+			backup_file_free(file);
+		}
+	}
+	report("copy, get_file_path", (now() - start) / iterations, count);
+
+	for (i = 0; i < 2 && !failed; i++) {
+		check = 0;
+		start = now();
+		for (j = 0; j < count; j++) {
+			int length = -1;
+			if (backup_get_file_view_by_index(backup, j, &view) == 0) {
+				length = backup_get_file_view_path_into(backup, &view, path, sizeof(path));
+			}
+			if (length <= 0) {
+				failed = 1;
+				break;
+			}
+			check += path[length - 1];
+		}
+		report(i ? "view, into, cached" : "view, into, hashed", now() - start, count);
+		if (check != total) {
+			failed = 1;
+		}
+	}
+
+	backup_free(backup);
+	remove_backup_copy(root);
+	free(root);
+	return failed ? -1 : 0;
+}
+
+#define BENCH_COPY_SIZE (256U << 20)
+
+/* 1 if the files have the same contents */
+static int same_contents(const char* file1, const char* file2) {
+	unsigned char* b1 = (unsigned char*) malloc(1 << 20);
+	unsigned char* b2 = (unsigned char*) malloc(1 << 20);
+	int fd1 = open(file1, O_RDONLY);
+	int fd2 = open(file2, O_RDONLY);
+	int same = (b1 && b2 && fd1 >= 0 && fd2 >= 0);
+	while (same) {
+		ssize_t n1 = read(fd1, b1, 1 << 20);
+		ssize_t n2 = read(fd2, b2, 1 << 20);
+		same = (n1 == n2 && n1 >= 0 && memcmp(b1, b2, (size_t) n1) == 0);
+		if (n1 <= 0) {
+			break;
+		}
+	}
+	if (fd1 >= 0) {
+		close(fd1);
+	}
+	if (fd2 >= 0) {
+		close(fd2);
+	}
+	free(b1);
+	free(b2);
+	return same;
+}
+
+/* a 256M file copied by each way mbdb_copy_file() has, then read into
+   memory and written out again as mbdbtool get and put did. The file
+   sits next to the manifest, on the filesystem being measured. */
+static int bench_copy(mbdb_t* mbdb, int iterations) {
+	static const unsigned int methods[] = { MBDB_COPY_RANGE, MBDB_COPY_CLONE, MBDB_COPY_SENDFILE, MBDB_COPY_BUFFER, 0 };
+	int i = 0;
+	int k = 0;
+	int failed = 0;
+	double start = 0;
+	unsigned int used = 0;
+	unsigned char* data = NULL;
+	unsigned int size = 0;
+
+	char* from = (char*) malloc(strlen(manifest) + 32);
+	char* to = (char*) malloc(strlen(manifest) + 32);
+	sprintf(from, "%s.bench-%d.from", manifest, (int) getpid());
+	sprintf(to, "%s.bench-%d.to", manifest, (int) getpid());
+	unsigned char* chunk = (unsigned char*) malloc(1 << 20);
+	int fd = open(from, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	for (i = 0; fd >= 0 && i < (int) (BENCH_COPY_SIZE >> 20); i++) {
+		memset(chunk, i, 1 << 20);
+		if (write(fd, chunk, 1 << 20) != (1 << 20)) {
+			failed = 1;
+		}
+	}
+	free(chunk);
+	if (fd < 0 || close(fd) < 0 || failed) {
+		fprintf(stderr, "Unable to write %s\n", from);
+		unlink(from);
+		free(from);
+		free(to);
+		return -1;
+	}
+
+	for (k = 0; methods[k] && !failed; k++) {
+		long rss = peak_rss();
+		start = now();
+		for (i = 0; i < iterations; i++) {
+			if (mbdb_copy_file(from, to, methods[k], &used) < 0) {
+				break;
+			}
+		}
+		if (i < iterations) {
+			printf("%-24s %10s\n", mbdb_copy_method_name(methods[k]), "unavailable");
+			continue;
+		}
+		double seconds = (now() - start) / iterations;
+		printf("%-24s %10.3f ms %9.0f MB/s %6ld kB peak grew\n", mbdb_copy_method_name(used), seconds * 1000.0,
+				(BENCH_COPY_SIZE >> 20) / seconds, peak_rss() - rss);
+		if (!same_contents(from, to)) {
+			failed = 1;
+		}
+	}
+
+	long rss = peak_rss();
+	start = now();
+	for (i = 0; i < iterations && !failed; i++) {
+		if (file_read(from, &data, &size) < 0 || file_write(to, data, size) < 0) {
+			failed = 1;
+		}
+		free(data);
+		data = NULL;
+	}
+	double seconds = (now() - start) / iterations;
+	printf("%-24s %10.3f ms %9.0f MB/s %6ld kB peak grew\n", "file_read, file_write", seconds * 1000.0,
+			(BENCH_COPY_SIZE >> 20) / seconds, peak_rss() - rss);
+
+	unlink(from);
+	unlink(to);
+	free(from);
+	free(to);
+	return failed ? -1 : 0;
+}
+
+static bench_command_t commands[] = {
+	{ "copy", "copy a 256M file each way the kernel has, against read into memory and written", bench_copy },
+	{ "decode", "decode the fixed size record fields, scan and parse", bench_decode },
+	{ "lookup", "find records by domain and path, linear scan against the index", bench_lookup },
+	{ "edit", "update 10k records one at a time, rebuilt and reparsed against in place", bench_edit },
+	{ "names", "backup file name of every record, one-shot SHA1 against batched", bench_names },
+	{ "paths", "data file of every file, allocated per call against into a buffer, cached", bench_paths },
+	{ "reopen", "open and look up a record, with and without the sidecar index", bench_reopen },
+	{ "journal", "durable edits, manifest rewritten against journaled, on a copy", bench_journal },
+	{ "scan", "filter the records, strcmp on each against a compiled filter", bench_scan },
+	{ "serialize", "serialize every record, a buffer per record against in place", bench_serialize },
+	{ "snapshot", "look records up in snapshots while another thread publishes edits", bench_snapshot },
+	{ "threads", "backup_get_file() on 1 to 4 threads, then beside a writer, on a copy", bench_threads },
+	{ "views", "walk the files of a backup, copied against borrowed views", bench_views },
+	{ "write", "save 1% edited records, streamed against built in memory first", bench_write },
+	{ NULL, NULL, NULL }
+};
+
+static void usage(const char* name) {
+	int i = 0;
+	printf("Usage: %s COMMAND MANIFEST [ITERATIONS]\n\n", name);
+	printf("Commands:\n");
+	for (i = 0; commands[i].name; i++) {
+		printf("  %-10s %s\n", commands[i].name, commands[i].help);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int i = 0;
+	int res = 0;
+	int iterations = 10;
+
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (argc > 3) {
+		iterations = atoi(argv[3]);
+		if (iterations <= 0) {
+			iterations = 1;
+		}
+	}
+
+	for (i = 0; commands[i].name; i++) {
+		if (!strcmp(commands[i].name, argv[1])) {
+			break;
+		}
+	}
+	if (commands[i].name == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	manifest = argv[2];
+	mbdb_t* mbdb = mbdb_open_ex(manifest, MBDB_OPEN_LAZY);
+	if (mbdb == NULL) {
+		fprintf(stderr, "Unable to open %s\n", argv[2]);
+		return 1;
+	}
+	printf("%s: %d records, %d iterations\n", argv[2], mbdb->num_records, iterations);
+
+	res = commands[i].run(mbdb, iterations);
+
+	mbdb_free(mbdb);
+	return res < 0 ? 1 : 0;
+}
@@ -21,10 +21,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <libmbdb-1.0/backup.h>
+#include <libmbdb-1.0/mbdb.h>
+#include <libmbdb-1.0/mbdb_copy.h>
 #include <libcrippy-1.0/libcrippy.h>
 
+typedef struct ls_context_t {
+	backup_t* backup;
+	int full_path;
+} ls_context_t;
+
+static int ls_print_node(mbdb_tree_t* tree, unsigned int node, void* arg) {
+	ls_context_t* ctx = (ls_context_t*) arg;
+	mbdb_tree_node_t* n = &tree->nodes[node];
+	mbdb_record_t* rec = (n->record >= 0) ? mbdb_get_record(ctx->backup->mbdb, n->record) : NULL;
+
+	// directories without a record of their own are implied by their children
+	char type = 'd';
+	unsigned short mode = 0;
+	unsigned long long length = 0;
+	if (rec) {
+		mode = rec->mode;
+		length = rec->length;
+		switch (rec->mode & MBDB_MODE_TYPE_MASK) {
+		case MBDB_MODE_FILE: type = '-'; break;
+		case MBDB_MODE_SYMLINK: type = 'l'; break;
+		case MBDB_MODE_DIRECTORY: type = 'd'; break;
+		default: type = '?'; break;
+		}
+	}
+	printf("%c %06o %10llu ", type, mode & 07777, length);
+
+	if (ctx->full_path) {
+		char path[0x10000];
+		if (mbdb_tree_path(tree, node, path, sizeof(path)) >= 0) {
+			printf("%s", path);
+		}
+	} else {
+		printf("%.*s", n->name_size, n->name);
+	}
+	if (type == 'l' && rec->target && rec->target_size != 0xFFFF) {
+		printf(" -> %.*s", rec->target_size, rec->target);
+	} else if (type == 'd') {
+		printf("/");
+	}
+	printf("\n");
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
 	if (argc < 5) {
 		printf("usage: mbdbtool <dir> <uuid> <domain> <cmd> [args]\n");
@@ -47,9 +93,28 @@ int main(int argc, char* argv[]) {
 			free(dom);
 			return 0;
 		}
-		backup_t* backup = backup_open(dir, udid);
-
-		// List the directory
+		// the tree only needs the names, records are decoded as they get printed
+		backup_t* backup = backup_open_ex(dir, udid, MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY | MBDB_OPEN_SIDECAR);
+		mbdb_tree_t* tree = backup ? mbdb_get_tree(backup->mbdb) : NULL;
+		if (tree) {
+			ls_context_t ctx;
+			ctx.backup = backup;
+			ctx.full_path = 0;
+			if (strpbrk(argv[5], "*?[") != NULL) {
+				// print whatever matches, with its full path
+				ctx.full_path = 1;
+				mbdb_tree_glob(tree, dom, argv[5], ls_print_node, &ctx);
+			} else {
+				int node = mbdb_tree_lookup(tree, dom, argv[5]);
+				if (node < 0) {
+					printf("%s: No such file or directory\n", argv[5]);
+				} else if (tree->nodes[node].num_children > 0) {
+					mbdb_tree_list(tree, node, ls_print_node, &ctx);
+				} else {
+					ls_print_node(tree, node, &ctx);
+				}
+			}
+		}
 		backup_free(backup);
 	} else if (strcmp(cmd, "get") == 0) {
 		if (argc != 7) {
@@ -67,11 +132,13 @@ int main(int argc, char* argv[]) {
 			if (file) {
 				char* path = backup_get_file_path(backup, file);
 				printf("Got file %s\n", path);
-				unsigned int size = 0;
-				unsigned char* data = NULL;
-				file_read(path, &data, &size);
-				file_write(argv[6], data, size);
-				free(data);
+				unsigned int method = 0;
+				if (path && mbdb_copy_file(path, argv[6], MBDB_COPY_ANY, &method) == 0) {
+					printf("Copied to %s (%s)\n", argv[6], mbdb_copy_method_name(method));
+				} else {
+					printf("Error, unable to copy file to %s\n", argv[6]);
+				}
+				free(path);
 				backup_file_free(file);
 			}
 			backup_free(backup);
@@ -88,21 +155,30 @@ int main(int argc, char* argv[]) {
 		backup_t* backup = backup_open(dir, udid);
 		if (backup) {
 			printf("Backup opened\n");
-			unsigned int size = 0;
-			unsigned char* data = NULL;
-			file_read(argv[5], &data, &size);
+			// backup_update_file() copies the data from argv[5] itself
+			struct stat st;
+			if (stat(argv[5], &st) < 0) {
+				printf("Error, unable to open %s\n", argv[5]);
+				backup_free(backup);
+				free(udid);
+				free(cmd);
+				free(dir);
+				free(dom);
+				return 0;
+			}
+			unsigned long long size = (unsigned long long) st.st_size;
 			backup_file_t* file = backup_get_file(backup, dom, argv[6]);
 			if (file) {
 				printf("Found file, replacing it\n");
 				char* fn = backup_get_file_path(backup, file);
 				if (fn != NULL ) {
-					file_write(fn, &data, &size);
-					backup_file_assign_file_data(file, data, size, 1);
+					backup_file_assign_file_path(file, (unsigned char*) argv[5]);
 					backup_file_set_length(file, size);
 					backup_file_update_hash(file);
 					backup_update_file(backup, file);
 					backup_write_mbdb(backup);
 					backup_file_free(file);
+					free(fn);
 				} else {
 					printf("Error, unable to find file in backup\n");
 				}
@@ -110,7 +186,7 @@ int main(int argc, char* argv[]) {
 				printf("File not found, creating new file\n");
 
 				unsigned int tm = (unsigned int) (time(NULL ));
-				file = backup_file_create_with_data(data, size, 0);
+				file = backup_file_create(argv[5]);
 				backup_file_set_domain(file, dom);
 				backup_file_set_path(file, argv[6]);
 				backup_file_set_mode(file, 0100777);
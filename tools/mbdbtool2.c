@@ -31,10 +31,10 @@
 #include <stdarg.h>
 #include <dirent.h>
 #include <time.h>
-
-#include <openssl/sha.h>
+#include <unistd.h>
 
 #include <libmbdb-1.0/backup.h>
+#include <libmbdb-1.0/mbdb_reader.h>
 #include <libcrippy-1.0/libcrippy.h>
 
 enum DOMAIN_TYPE
@@ -52,7 +52,9 @@ enum MBDB_COMMANDS
 	CMD_LIST_DOMAINS,
 	CMD_LIST_APPS,
 	CMD_LIST_CAMERA_ROLL,
-	CMD_MBDB_INFO
+	CMD_MBDB_INFO,
+	CMD_RESOLVE,
+	CMD_LIST_DUPLICATES
 };
 
 struct {
@@ -65,6 +67,9 @@ struct {
 	{CMD_LIST_DOMAINS,"doms",  "list MBDB system domains"},
 	{CMD_LIST_APPS,   "apps",  "list MBDB applications"},
 	{CMD_LIST_CAMERA_ROLL,"cam",   "list Camera Roll images"},
+	{CMD_MBDB_INFO,   "info",  "show MBDB summary (record counts, total size)"},
+	{CMD_RESOLVE,     "resolve", "map backup file names (SHA1) back to their records"},
+	{CMD_LIST_DUPLICATES,"dups", "list files with identical contents, and the bytes they waste"},
 	{CMD_UNKNOWN,     NULL,    NULL}
 };
 
@@ -76,11 +81,15 @@ struct {
 char *backup_parent_directory = NULL ;
 char *backup_directory = NULL ;
 char *udid = NULL ;
+char *manifest_file = NULL ;
 enum MBDB_COMMANDS command;
+char **command_args = NULL ;
+int command_args_count = 0 ;
 
 /* Command line options */
 const struct option mbdb_options[] = {
 	{"help",	no_argument,	0,	'h'},
+	{"manifest",	required_argument,	0,	'm'},
 	{0,		0,		0,	0}
 };
 
@@ -100,20 +109,21 @@ void usage_error(const char *error_message,...)
 }
 
 
-/* Given a domain (e.g. "CameraRollDomain")
-   and a file path, calculates the SHA1 hash of the filename.
+/* Carries the SHA1 state of the last "domain-" prefix hashed over to
+   the next record; records of a domain come one after the other. */
+static mbdb_name_hasher_t name_hasher;
 
-   SHA1 output is stored in "sha1" variable, which MUST have at least 20 bytes allocated.
-   No error checking is performed. */
-void sha1_filename(const char* domain, const char* path,
-		char* /*OUTPUT*/ sha1)
+/* Prints the backup file name of a record: the SHA1 of "domain-path" in hex.
+   Both strings are taken with their MBDB sizes, they need not be NUL terminated. */
+void print_backup_filename(const mbdb_record_t* m)
 {
-	SHA_CTX shactx;
-	SHA1_Init(&shactx);
-	SHA1_Update(&shactx, domain, strlen(domain));
-	SHA1_Update(&shactx, "-", 1);
-	SHA1_Update(&shactx, path, strlen(path));
-	SHA1_Final(sha1, &shactx);
+	mbdb_name_key_t key = { m->domain, m->domain_size, m->path, m->path_size };
+	unsigned char hash[MBDB_NAME_HASH_SIZE];
+	char name[MBDB_NAME_SIZE + 1];
+
+	mbdb_name_hash_batch(&name_hasher, &key, 1, hash);
+	mbdb_name_format(hash, name);
+	fputs(name, stdout);
 }
 
 /* Prints a HexDump of input buffer 'data' to STDOUT */
@@ -133,7 +143,13 @@ void show_help()
 	printf(\
 "mbdbtool2 - iOS Mbdb File Parser\n" \
 "\n" \
-"Usage: mbdbtool2 [OPTIONS] DIR UDID CMD\n" \
+"Usage: mbdbtool2 [OPTIONS] DIR UDID CMD [ARGS]\n" \
+"       mbdbtool2 [OPTIONS] --manifest FILE CMD\n" \
+"\n" \
+"Options:\n" \
+"  -m, --manifest FILE - Read the MBDB records from FILE ('-' for STDIN)\n" \
+"                        instead of DIR/UDID/Manifest.mbdb.\n" \
+"                        Only the 'dump' and 'ls' commands support this.\n" \
 "\n" \
 "Required Parameters:\n" \
 "  DIR  - The backup directory\n" \
@@ -141,7 +157,7 @@ void show_help()
 "         The file 'DIR/UDID/Manifest.mbdb' must exist.\n" \
 "  CMD  - Command/Action to perform:\n");
 	while (command_names[i].name != NULL) {
-		printf("    %-5s - %s\n",
+		printf("    %-7s - %s\n",
 				command_names[i].name,
 				command_names[i].description);
 		++i;
@@ -164,6 +180,11 @@ void show_help()
 " 9e3156b537de1cea17a389fd1c9faaa8cb870701 Media/DCIM/100APPLE/IMG_0004.JPG IMG_0004.JPG JPG 2013/06/14 21:33:30\n" \
 " ...\n" \
 "\n" \
+" # Find the records of backup files\n" \
+" $ mbdbtool2 ~/iphone_backup/ c7030a299c4e61e0ef6f61b0f3ddf45111111111 resolve 343e26971dfe9c395c425c0ccf799df63ae6261e\n" \
+" 343e26971dfe9c395c425c0ccf799df63ae6261e CameraRollDomain Media/DCIM/100APPLE/IMG_0001.JPG\n" \
+" (without names, they are read from STDIN, one per line)\n" \
+"\n" \
 " # List Applications\n" \
 " $ mbdbtool2 ~/iphone_backup/ c7030a299c4e61e0ef6f61b0f3ddf45111111111 apps\n" \
 " com.apple.WebViewService\n" \
@@ -256,16 +277,36 @@ void setup_command(const char*cmd)
 void parse_command_line(int argc, char* argv[])
 {
 	int c,i;
-	while ( (c=getopt_long(argc,argv,"h",mbdb_options,&i)) != -1) {
+	while ( (c=getopt_long(argc,argv,"hm:",mbdb_options,&i)) != -1) {
 		switch (c)
 		{
 		case 'h':
 			show_help();
 			exit(0);
 			break;
+
+		case 'm':
+			manifest_file = strdup(optarg);
+			if (manifest_file==NULL)
+				err(1,"strdup failed");
+			break;
+
+		default:
+			usage_error(NULL);
 		}
 	}
 
+	if (manifest_file != NULL) {
+		/* With --manifest, only the CMD parameter is required */
+		if ( optind + 1 > argc )
+			usage_error("Missing required parameter (CMD).\n");
+
+		setup_command(argv[optind]);
+		if (command!=CMD_DUMP_MBDB && command!=CMD_LIST_FILES)
+			usage_error("error: command '%s' requires DIR and UDID\n", argv[optind]);
+		return;
+	}
+
 	/* We require at least three extra parameters: DIR UDID CMD */
 	if ( optind + 3 > argc )
 		usage_error("Missing 3 required parameters (DIR UDID CMD).\n");
@@ -273,6 +314,35 @@ void parse_command_line(int argc, char* argv[])
 	setup_DIR_UDID(argv[optind],argv[optind+1]);
 
 	setup_command(argv[optind+2]);
+
+	command_args = &argv[optind+3];
+	command_args_count = argc - (optind+3);
+}
+
+/* Opens a streaming reader on the MBDB file,
+   either the one given with --manifest or DIR/UDID/Manifest.mbdb.
+
+   The function always succeeds, or terminates on error.*/
+mbdb_reader_t* open_manifest_reader()
+{
+	mbdb_reader_t* reader = NULL;
+
+	if (manifest_file!=NULL && strcmp(manifest_file,"-")==0) {
+		reader = mbdb_reader_open_fd(STDIN_FILENO);
+	} else if (manifest_file!=NULL) {
+		reader = mbdb_reader_open(manifest_file);
+	} else {
+		char *path = malloc(strlen(backup_directory)+1+strlen("Manifest.mbdb")+1);
+		if (path==NULL)
+			err(1,"malloc failed");
+		strcpy(path,backup_directory);
+		strcat(path,"/Manifest.mbdb");
+		reader = mbdb_reader_open(path);
+		free(path);
+	}
+	if (reader==NULL)
+		errx(1,"error: failed to open MBDB file");
+	return reader;
 }
 
 /* Returns a pointer to the iOS/MBDB string,
@@ -288,59 +358,68 @@ const char* ios_string(unsigned short size, const char*str)
 	return str;
 }
 
-/* Dumps the content of the MBDB records to STDOUT.
+/* Prints an iOS/MBDB string (see ios_string) followed by 'suffix'.
 
-   Every variable of each record is printed, in hex/octal/hexdump as needed. */
-void dump_mbdb(backup_t* backup)
+   Strings of streamed records point into the read buffer and are
+   not NUL terminated, so the MBDB size is used. */
+void print_ios_string(unsigned short size, const char*str, const char* suffix)
 {
-	int i;
-	int file_counts = backup_get_num_files(backup);
-	if (file_counts<=0)
-		return;
+	const char* s = ios_string(size, str);
+	if (s==str)
+		printf("%.*s%s", size, str, suffix);
+	else
+		printf("%s%s", s, suffix);
+}
 
-	printf("RecNum\t" \
-	       "sha1\t" \
-	       "Domain\t" \
-	       "Path\t" \
-	       "Target\t" \
-	       "Datahash\t" \
-	       "Unknown1\t" \
-	       "Mode\t" \
-	       "Unknown2\t" \
-	       "inode\t" \
-	       "uid\t" \
-	       "gid\t" \
-	       "mtime\t" \
-	       "atime\t" \
-	       "ctime\t" \
-	       "filelen\t" \
-	       "flags\t" \
-	       "NumProps"
-	       );
-	printf("\n");
-	for (i = 0 ; i < file_counts ; ++i) {
-		backup_file_t* file = backup_get_file_by_index(backup, i);
+/* Dumps the content of the MBDB records to STDOUT.
 
-		const mbdb_record_t *m = file->mbdb_record;
+   Every variable of each record is printed, in hex/octal/hexdump as needed.
+   Records are streamed from 'reader', one at a time. */
+void dump_mbdb(mbdb_reader_t* reader)
+{
+	int i = 0;
+	const mbdb_record_t *m = NULL;
+	int res;
+
+	while ( (res=mbdb_reader_next(reader, &m)) > 0 ) {
+		if (i==0) {
+			printf("RecNum\t" \
+			       "sha1\t" \
+			       "Domain\t" \
+			       "Path\t" \
+			       "Target\t" \
+			       "Datahash\t" \
+			       "Unknown1\t" \
+			       "Mode\t" \
+			       "Unknown2\t" \
+			       "inode\t" \
+			       "uid\t" \
+			       "gid\t" \
+			       "mtime\t" \
+			       "atime\t" \
+			       "ctime\t" \
+			       "filelen\t" \
+			       "flags\t" \
+			       "NumProps"
+			       );
+			printf("\n");
+		}
 
 		printf("%d\t",i);
-		char sha1[20];
-
 		if (IS_MODE_FILE(m->mode)) {
-			sha1_filename(m->domain, m->path, sha1);
-			hexdump_buffer(sha1,20);
+			print_backup_filename(m);
 		} else {
 			printf("()");
 		}
 		putc(' ', stdout);
-		printf("%s\t",ios_string(m->domain_size, m->domain));
-		printf("%s\t",ios_string(m->path_size, m->path));
-		printf("%s\t",ios_string(m->target_size, m->target));
+		print_ios_string(m->domain_size, m->domain, "\t");
+		print_ios_string(m->path_size, m->path, "\t");
+		print_ios_string(m->target_size, m->target, "\t");
 		if (m->datahash_size==0 || m->datahash_size==65535)
 			printf("()\t");
 		else
 			hexdump_buffer(m->datahash,m->datahash_size);
-		printf("%s\t",ios_string(m->unknown1_size, m->unknown1));
+		print_ios_string(m->unknown1_size, m->unknown1, "\t");
 		printf("0x%x\t",m->mode);
 		printf("0x%d\t",m->unknown2);
 		printf("0x%x\t",m->inode);
@@ -350,10 +429,10 @@ void dump_mbdb(backup_t* backup)
 		printf("0x%x\t",m->flag);
 		printf("%d",m->property_count);
 		printf("\n");
-
-		//Segfault..
-		//backup_file_free(file_t);
+		++i;
 	}
+	if (res<0)
+		errx(1,"error: failed to read MBDB record %d", i);
 }
 
 /* Prints a user-friendly "ls"-like listing of files and directories in the
@@ -361,18 +440,16 @@ void dump_mbdb(backup_t* backup)
    Only selected fields are printed:
       SHA1 hash (calculated, not in MBDB),
       Domain, File Path, File type (directory, file, symlink),
-      size, file-mode, etc. */
-void list_backup_files(backup_t* backup)
+      size, file-mode, etc.
+   Records are streamed from 'reader', one at a time. */
+void list_backup_files(mbdb_reader_t* reader)
 {
-	int i;
-	int file_counts = backup_get_num_files(backup);
-	if (file_counts<=0)
-		return;
-
-	for (i = 0 ; i < file_counts ; ++i) {
-		backup_file_t* file = backup_get_file_by_index(backup, i);
+	int i = -1;
+	const mbdb_record_t *m = NULL;
+	int res;
 
-		const mbdb_record_t *m = file->mbdb_record;
+	while ( (res=mbdb_reader_next(reader, &m)) > 0 ) {
+		++i;
 
 		/* A Domain record? not a file... */
 		if (m->path_size==0 || m->path_size==65535)
@@ -403,24 +480,23 @@ void list_backup_files(backup_t* backup)
 
 		printf("%12lld ", m->length);
 
-		char sha1[20];
-		sha1_filename(m->domain, m->path, sha1);
-		hexdump_buffer(sha1,20);
+		print_backup_filename(m);
 
-		printf(" %s ",ios_string(m->domain_size, m->domain));
-		printf(" %s",ios_string(m->path_size, m->path));
+		putc(' ', stdout);
+		print_ios_string(m->domain_size, m->domain, " ");
+		putc(' ', stdout);
+		print_ios_string(m->path_size, m->path, "");
 
 		if (IS_MODE_SYMLINK(m->mode)) {
 			if (m->target_size==0 || m->target_size==65535)
-				errx(1,"error in MBDB record %s, symlink has empty target", i);
-			printf(" -> %s",m->target);
+				errx(1,"error in MBDB record %d, symlink has empty target", i);
+			printf(" -> %.*s", m->target_size, m->target);
 		}
 
 		printf("\n");
-
-		//Segfault..
-		//backup_file_free(file_t);
 	}
+	if (res<0)
+		errx(1,"error: failed to read MBDB record %d", i+1);
 }
 
 
@@ -453,13 +529,28 @@ void list_domains(backup_t* backup, enum DOMAIN_TYPE type)
 	if (domains==NULL)
 		errx(1,"malloc(domains) failed");
 
-	for (i = 0 ; i < file_counts ; ++i) {
-		backup_file_t* file = backup_get_file_by_index(backup, i);
+	/* Application domains are picked by their prefix, system domains
+	   are what is left */
+	mbdb_filter_t filter;
+	memset(&filter, 0, sizeof(filter));
+	if (type==LIST_APP_DOMAINS) {
+		filter.match = MBDB_FILTER_DOMAIN_PREFIX;
+		filter.domain = "AppDomain-";
+	}
+	mbdb_filter_compile(&filter);
 
-		const mbdb_record_t *m = file->mbdb_record;
+	mbdb_cursor_t cursor;
+	if (mbdb_cursor_init(&cursor, backup->mbdb, &filter)!=0)
+		errx(1,"error: failed to scan MBDB records");
 
+	while (mbdb_cursor_next(&cursor) > 0) {
 		/* A Domain/App record - must not have a "path" */
-		if (m->path_size!=0 && m->path_size!=65535)
+		if (!(cursor.entry.flags & MBDB_ENTRY_DOMAIN_ROOT))
+			continue;
+
+		/* Only these few are decoded, for their NUL terminated domain */
+		const mbdb_record_t *m = mbdb_cursor_record(&cursor);
+		if (m==NULL || m->domain==NULL)
 			continue;
 
 		int app_domain = strncmp(m->domain,"AppDomain",9)==0;
@@ -518,20 +609,24 @@ void list_camera_roll(backup_t* backup)
 	if (images==NULL)
 		err(1,"calloc(images) failed");
 
-	for (i = 0 ; i < file_counts ; ++i) {
-		backup_file_t* file = backup_get_file_by_index(backup, i);
-
-		const mbdb_record_t *m = file->mbdb_record;
-
-		/* Skip non-files,
-		   other domains,
-		   and files not under "Media/DCIM" */
-		if (!IS_MODE_FILE(m->mode)
-		    ||
-		    (strcmp(m->domain,"CameraRollDomain")!=0)
-		    ||
-		    (strncmp(m->path,"Media/DCIM/",11)!=0))
-		    continue;
+	/* Only files of the Camera Roll domain under "Media/DCIM",
+	   the scan skips the others without decoding them */
+	mbdb_filter_t filter;
+	memset(&filter, 0, sizeof(filter));
+	filter.match = MBDB_FILTER_DOMAIN | MBDB_FILTER_PATH_PREFIX | MBDB_FILTER_TYPE;
+	filter.domain = "CameraRollDomain";
+	filter.path = "Media/DCIM/";
+	filter.type = MBDB_MODE_FILE;
+	mbdb_filter_compile(&filter);
+
+	mbdb_cursor_t cursor;
+	if (mbdb_cursor_init(&cursor, backup->mbdb, &filter)!=0)
+		errx(1,"error: failed to scan MBDB records");
+
+	while (mbdb_cursor_next(&cursor) > 0) {
+		const mbdb_record_t *m = mbdb_cursor_record(&cursor);
+		if (m==NULL || m->path==NULL)
+			continue;
 
 		/* Check extension.
 		   TODO: is there a more reliable way to verify file type,
@@ -565,9 +660,6 @@ void list_camera_roll(backup_t* backup)
 			++extension;
 
 		/* List file information */
-		char sha1[20];
-		sha1_filename(m->domain, m->path, sha1);
-
 		const char *basename = rindex(m->path,'/');
 		if (basename!=NULL)
 			basename++;
@@ -575,7 +667,7 @@ void list_camera_roll(backup_t* backup)
 			basename = m->path;
 
 
-		hexdump_buffer(sha1,20);
+		print_backup_filename(m);
 		printf(" %s %s %s", m->path, basename, extension);
 
 		time_t t = (time_t)m->time3;
@@ -587,28 +679,178 @@ void list_camera_roll(backup_t* backup)
 
 		printf("\n");
 	}
+	free(images);
+}
+
+
+/* Prints a summary of the MBDB file: number of records per type,
+   and the total size of the files.
+
+   Works on the columnar view, so no record is decoded. */
+void show_mbdb_info(backup_t* backup)
+{
+	mbdb_columns_t* columns = mbdb_get_columns(backup->mbdb);
+	if (columns==NULL)
+		errx(1,"error: failed to build MBDB columns");
+
+	printf("Records:     %u\n", columns->count);
+	printf("Files:       %u\n", mbdb_columns_count_type(columns, MBDB_MODE_FILE));
+	printf("Directories: %u\n", mbdb_columns_count_type(columns, MBDB_MODE_DIRECTORY));
+	printf("Symlinks:    %u\n", mbdb_columns_count_type(columns, MBDB_MODE_SYMLINK));
+	printf("Total size:  %llu\n", mbdb_columns_total_length(columns, MBDB_MODE_FILE));
+}
+
+
+/* Prints the domain and path of the record stored in the backup file 'name'
+   (40 hex digits, optionally with leading directories).
+
+   Returns NON-ZERO if there is no such record. */
+int resolve_name(backup_t* backup, const char* name)
+{
+	const char *domain, *path;
+	unsigned short domain_size, path_size;
+
+	int idx = mbdb_find_record_by_name(backup->mbdb, name);
+	if (idx<0) {
+		fprintf(stderr,"%s: no such record\n", name);
+		return 1;
+	}
+
+	/* The key is read straight from the MBDB data, nothing is decoded */
+	mbdb_get_record_key(backup->mbdb, idx, &domain, &domain_size, &path, &path_size);
+	printf("%s %.*s %.*s\n", name, domain_size, domain, path_size, path);
+	return 0;
+}
+
+/* Resolves the names given on the command line,
+   or read from STDIN (one per line) if there are none.
+
+   Returns the number of names that were not found. */
+int resolve_names(backup_t* backup)
+{
+	int i, missing = 0;
+
+	if (command_args_count>0) {
+		for (i = 0; i < command_args_count; ++i)
+			missing += resolve_name(backup, command_args[i]);
+		return missing;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), stdin)!=NULL) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (strlen(line)==0)
+			continue;
+		missing += resolve_name(backup, line);
+	}
+	return missing;
+}
+
+
+/* Utility function to by used with "qsort", comparing duplicate groups
+   by the bytes they waste (largest first), then by their hash */
+static const mbdb_columns_t* dup_columns = NULL;
+static const mbdb_content_t* dup_content = NULL;
+
+static unsigned long long group_reclaimable(const mbdb_content_group_t* g)
+{
+	unsigned int first = dup_content->entries[g->first].record;
+	return (unsigned long long)(g->count - 1) * dup_columns->length[first];
+}
+
+static int
+compare_dup_groups(const void *p1, const void *p2)
+{
+	const mbdb_content_group_t* g1 = *(const mbdb_content_group_t**)p1;
+	const mbdb_content_group_t* g2 = *(const mbdb_content_group_t**)p2;
+	unsigned long long r1 = group_reclaimable(g1);
+	unsigned long long r2 = group_reclaimable(g2);
+
+	if (r1 != r2)
+		return (r1 > r2) ? -1 : 1;
+	return (g1->first > g2->first) - (g1->first < g2->first);
+}
+
+/* Prints the groups of files with identical contents (same datahash),
+   with the bytes that could be reclaimed by keeping a single copy.
+
+   Works on the content index (built from the columns),
+   so no record is decoded. */
+void list_duplicates(backup_t* backup)
+{
+	unsigned int i, j;
+	unsigned int num_dups = 0, copies = 0;
+	unsigned long long total = 0;
+
+	dup_columns = mbdb_get_columns(backup->mbdb);
+	dup_content = mbdb_get_content(backup->mbdb);
+	if (dup_columns==NULL || dup_content==NULL)
+		errx(1,"error: failed to build MBDB content index");
+
+	const mbdb_content_group_t **dups = calloc(dup_content->num_groups+1, sizeof(mbdb_content_group_t*));
+	if (dups==NULL)
+		err(1,"calloc(dups) failed");
+	for (i = 0; i < dup_content->num_groups; ++i) {
+		if (dup_content->groups[i].count > 1)
+			dups[num_dups++] = &dup_content->groups[i];
+	}
+	qsort(dups, num_dups, sizeof(mbdb_content_group_t*), compare_dup_groups);
+
+	for (i = 0; i < num_dups; ++i) {
+		const mbdb_content_group_t* g = dups[i];
+		unsigned int first = dup_content->entries[g->first].record;
+		unsigned long long reclaimable = group_reclaimable(g);
+
+		hexdump_buffer(dup_content->entries[g->first].hash, MBDB_COLUMNS_HASH_SIZE);
+		printf(" %u copies, %llu bytes each, %llu reclaimable\n",
+				g->count, dup_columns->length[first], reclaimable);
+		for (j = 0; j < g->count; ++j) {
+			unsigned int r = dup_content->entries[g->first + j].record;
+			printf("    %.*s %.*s\n",
+				(dup_columns->domain_size[r]==0xFFFF) ? 0 : dup_columns->domain_size[r], dup_columns->domain[r],
+				(dup_columns->path_size[r]==0xFFFF) ? 0 : dup_columns->path_size[r], dup_columns->path[r]);
+		}
+		copies += g->count - 1;
+		total += reclaimable;
+	}
+	free(dups);
+
+	printf("%u duplicate groups, %u redundant copies, %llu bytes reclaimable\n",
+			num_dups, copies, total);
 }
 
 
 int main(int argc, char* argv[])
 {
+	int status = 0;
+
 	parse_command_line(argc,argv);
 
-	backup_t* backup = backup_open(backup_parent_directory,
-					udid);
+	/* These commands stream the records and never load the whole MBDB */
+	if (command==CMD_DUMP_MBDB || command==CMD_LIST_FILES) {
+		mbdb_reader_t* reader = open_manifest_reader();
+		if (command==CMD_DUMP_MBDB)
+			dump_mbdb(reader);
+		else
+			list_backup_files(reader);
+		mbdb_reader_close(reader);
+		return 0;
+	}
+
+	/* "info", "resolve" and "dups" only need the columns or record keys,
+	   which don't require decoded records. The sidecar index spares
+	   them the scan for record boundaries (and "resolve" the hashing) */
+	unsigned int flags = 0;
+	if (command==CMD_MBDB_INFO || command==CMD_RESOLVE || command==CMD_LIST_DUPLICATES)
+		flags = MBDB_OPEN_MAPPED | MBDB_OPEN_LAZY | MBDB_OPEN_SIDECAR;
+
+	backup_t* backup = backup_open_ex(backup_parent_directory,
+					udid, flags);
 	if (backup==NULL)
 		errx(1,"error: failed to open iDevice Backup (backup_open() failed without further information)");
 
 	switch (command)
 	{
-	case CMD_LIST_FILES:
-		list_backup_files(backup);
-		break;
-
-	case CMD_DUMP_MBDB:
-		dump_mbdb(backup);
-		break;
-
 	case CMD_LIST_DOMAINS:
 		list_domains(backup,LIST_SYSTEM_DOMAINS);
 		break;
@@ -620,8 +862,20 @@ int main(int argc, char* argv[])
 	case CMD_LIST_CAMERA_ROLL:
 		list_camera_roll(backup);
 		break;
+
+	case CMD_MBDB_INFO:
+		show_mbdb_info(backup);
+		break;
+
+	case CMD_RESOLVE:
+		status = (resolve_names(backup)>0) ? 1 : 0;
+		break;
+
+	case CMD_LIST_DUPLICATES:
+		list_duplicates(backup);
+		break;
 	}
 
 	backup_free(backup);
-	return 0;
+	return status;
 }